@@ -4,7 +4,6 @@ set -e
 rsync -a -v --delete ../Components/src/utils/ src/utils/.
 rsync -a -v --delete ../Components/res/components/ res/components/.
 #rm src/utils/CVMidi.h
-rm src/utils/ExpanderMidi.h
 rm src/utils/LEDMatrix.h
 #rm src/utils/Midi*
 rm src/utils/ParamMapper.*
@@ -0,0 +1,484 @@
+/*
+ * MIDI Clock PLL Simulation Harness
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Kilpatrick Audio
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ * Drives the PLL on the host with scripted MIDI clock streams and reports
+ * how well it locks. Build and run with: make -C sim run
+ *
+ */
+#include "../src/MidiClockPll/MidiClockPll.h"
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// a piece of a scripted clock stream
+struct SimSegment {
+    double len;  // segment length (s)
+    float bpmStart;  // tempo at the start of the segment
+    float bpmEnd;  // tempo at the end of the segment - ramps from the start
+    float jitter;  // max random offset of each tick (us)
+    float dropProb;  // chance of each tick being lost - 0.0 to 1.0
+    float drift;  // sender clock error (ppm) - + = sender runs fast
+    int clock;  // 1 = ticks are sent, 0 = gap in the stream
+    int run;  // 1 = running, 0 = stopped - start / stop is sent on changes
+};
+
+// a scripted clock stream
+struct SimScenario {
+    const char *name;
+    const char *desc;
+    std::vector<SimSegment> segments;
+};
+
+// the built-in scenarios
+static const std::vector<SimScenario> scenarios = {
+    {"steady", "120 BPM - no jitter", {
+        {30.0, 120.0f, 120.0f, 0.0f, 0.0f, 0.0f, 1, 1},
+    }},
+    {"jitter", "120 BPM - +/-1 ms jitter", {
+        {30.0, 120.0f, 120.0f, 1000.0f, 0.0f, 0.0f, 1, 1},
+    }},
+    {"ramp", "100 to 140 BPM ramp over 20 s", {
+        {10.0, 100.0f, 100.0f, 0.0f, 0.0f, 0.0f, 1, 1},
+        {20.0, 100.0f, 140.0f, 0.0f, 0.0f, 0.0f, 1, 1},
+        {10.0, 140.0f, 140.0f, 0.0f, 0.0f, 0.0f, 1, 1},
+    }},
+    {"step", "120 to 128 BPM step", {
+        {15.0, 120.0f, 120.0f, 0.0f, 0.0f, 0.0f, 1, 1},
+        {15.0, 128.0f, 128.0f, 0.0f, 0.0f, 0.0f, 1, 1},
+    }},
+    {"halve", "120 to 60 BPM step - long intervals that aren't lost ticks", {
+        {15.0, 120.0f, 120.0f, 0.0f, 0.0f, 0.0f, 1, 1},
+        {15.0, 60.0f, 60.0f, 0.0f, 0.0f, 0.0f, 1, 1},
+    }},
+    {"dropout", "2% lost ticks - 80 ms gap - 500 ms gap", {
+        {15.0, 120.0f, 120.0f, 0.0f, 0.02f, 0.0f, 1, 1},
+        {0.08, 120.0f, 120.0f, 0.0f, 0.0f, 0.0f, 0, 1},
+        {10.0, 120.0f, 120.0f, 0.0f, 0.02f, 0.0f, 1, 1},
+        {0.5, 120.0f, 120.0f, 0.0f, 0.0f, 0.0f, 0, 1},
+        {15.0, 120.0f, 120.0f, 0.0f, 0.02f, 0.0f, 1, 1},
+    }},
+    {"drift", "120 BPM - sender clock +500 ppm", {
+        {30.0, 120.0f, 120.0f, 0.0f, 0.0f, 500.0f, 1, 1},
+    }},
+    {"startstop", "stop for 2 s with clock running then start", {
+        {10.0, 120.0f, 120.0f, 500.0f, 0.0f, 0.0f, 1, 1},
+        {2.0, 120.0f, 120.0f, 500.0f, 0.0f, 0.0f, 1, 0},
+        {10.0, 120.0f, 120.0f, 500.0f, 0.0f, 0.0f, 1, 1},
+    }},
+};
+
+// results of a run
+struct SimResult {
+    double lockTime;  // time from the first tick to the first lock (ms) - -1 = never locked
+    uint32_t relockCount;  // relocks reported by the PLL
+    int lockLosses;  // times the loop went from locked to unlocked
+    int syncLosses;  // times the external sync timed out
+    uint32_t skipped;  // lost ticks the PLL detected and skipped over
+    uint32_t idealTicks;  // ticks the sender meant to send
+    uint32_t inTicks;  // ticks sent to the PLL
+    uint32_t outTicks;  // ticks issued by the PLL
+    uint32_t errCount;  // output ticks measured while locked
+    double errSum;  // sum of phase errors (us)
+    double errSqSum;  // sum of squared phase errors (us)
+    double errMax;  // max absolute phase error (us)
+    float endTempo;  // PLL tempo at the end
+    float endTarget;  // sender tempo at the end
+};
+
+// watches the PLL and measures the output ticks
+class SimHandler : public MidiClockPllHandler {
+public:
+    MidiClockPll *pll;
+    double now;  // host time at the end of the current task (us)
+    double taskIntervalUs;
+    std::vector<double> idealTicks;  // tick times the sender meant to send (us)
+    std::vector<double> lockedTicks;  // output tick times while locked (us)
+    double firstTick;  // time of the first tick sent (us) - -1 = none yet
+    int locked;
+    uint32_t lostTicks;  // last lost tick count from the PLL - resets on resync
+    MidiClockPllStats stats;
+    SimResult result;
+    FILE *trace;
+
+    // constructor
+    SimHandler() {
+        pll = NULL;
+        now = 0.0;
+        taskIntervalUs = 1000;
+        firstTick = -1.0;
+        locked = 0;
+        lostTicks = 0;
+        memset(&stats, 0, sizeof(stats));
+        memset(&result, 0, sizeof(result));
+        result.lockTime = -1.0;
+        trace = NULL;
+    }
+
+    // clock ticked - keep the tick time to measure after the run
+    void midiClockTicked(uint32_t tickCount) override {
+        result.outTicks ++;
+        if(!locked) {
+            return;
+        }
+        // the module delays ticks by one task so they land on the exact sample
+        lockedTicks.push_back((now - taskIntervalUs) +
+            (double)pll->getTickOffset() * taskIntervalUs);
+    }
+
+    // measure the locked output ticks against the nearest ideal sender tick
+    void measure(void) {
+        double err;
+        size_t i, lo, hi, mid;
+        if(idealTicks.size() < 2) {
+            return;
+        }
+        for(i = 0; i < lockedTicks.size(); i ++) {
+            lo = 0;
+            hi = idealTicks.size() - 1;
+            while(hi - lo > 1) {
+                mid = (lo + hi) / 2;
+                if(idealTicks[mid] <= lockedTicks[i]) {
+                    lo = mid;
+                }
+                else {
+                    hi = mid;
+                }
+            }
+            err = lockedTicks[i] - idealTicks[lo];
+            if(fabs(lockedTicks[i] - idealTicks[hi]) < fabs(err)) {
+                err = lockedTicks[i] - idealTicks[hi];
+            }
+            result.errCount ++;
+            result.errSum += err;
+            result.errSqSum += err * err;
+            if(fabs(err) > result.errMax) {
+                result.errMax = fabs(err);
+            }
+        }
+    }
+
+    // external sync state changed
+    void midiClockExtSyncChanged(int synced) override {
+        if(!synced) {
+            result.syncLosses ++;
+            locked = 0;
+        }
+    }
+
+    // an external tick was processed by the sync loop
+    void midiClockExtSyncUpdated(const MidiClockPllStats& stats) override {
+        if(stats.locked && !locked && result.lockTime < 0.0 && firstTick >= 0.0) {
+            result.lockTime = (now - firstTick) / 1000.0;
+        }
+        if(!stats.locked && locked) {
+            result.lockLosses ++;
+        }
+        locked = stats.locked;
+        if(stats.lostTicks > lostTicks) {
+            result.skipped += stats.lostTicks - lostTicks;
+        }
+        lostTicks = stats.lostTicks;
+        this->stats = stats;
+        if(trace != NULL) {
+            fprintf(trace, "%.6f,%d,%.1f,%.1f,%.1f,%.3f,%u,%u\n",
+                now / 1000000.0, stats.locked, stats.phaseError,
+                stats.phaseJitter, stats.inputJitter, pll->getTempo(), stats.relockCount,
+                stats.lostTicks);
+        }
+    }
+};
+
+// run a scenario
+static void simRun(const SimScenario& scenario, int bandwidth, double taskIntervalUs,
+        unsigned seed, FILE *trace, SimResult *result) {
+    MidiClockPll pll;
+    SimHandler handler;
+    std::minstd_rand rand(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    double segStart = 0.0, segEnd, nextIdeal = 0.0, nextArrival = -1.0, lastArrival = 0.0;
+    double bpm, frac, period;
+    int seg, running = 0, tickSent;
+    const SimSegment *s = NULL;
+
+    handler.pll = &pll;
+    handler.taskIntervalUs = taskIntervalUs;
+    handler.trace = trace;
+    pll.registerHandler(&handler);
+    pll.setTaskInterval(taskIntervalUs);
+    pll.setInternalPpq(MIDI_NATIVE_PPQ);
+    pll.setLoopBandwidth(bandwidth);
+    pll.setSource(MidiClockPll::SOURCE_EXTERNAL);
+    pll.timerTask();  // apply the source change before the stream starts
+    if(trace != NULL) {
+        fprintf(trace, "# %s - %s\n", scenario.name, scenario.desc);
+        fprintf(trace, "time_s,locked,phase_error_us,phase_jitter_us,input_jitter_us,tempo_bpm,relocks,lost_ticks\n");
+    }
+
+    for(seg = 0; seg < (int)scenario.segments.size(); seg ++) {
+        s = &scenario.segments[seg];
+        segEnd = segStart + s->len * 1000000.0;
+        // start / stop on run changes
+        if(s->run && !running) {
+            pll.handleMidiStart();
+        }
+        else if(!s->run && running) {
+            pll.handleMidiStop();
+        }
+        running = s->run;
+        if(nextIdeal < segStart) {
+            nextIdeal = segStart;
+        }
+        while(handler.now < segEnd) {
+            handler.now += taskIntervalUs;
+            // work out the sender ticks that arrive during this task
+            tickSent = 0;
+            while(nextIdeal <= handler.now && nextIdeal < segEnd) {
+                if(nextArrival < 0.0) {
+                    nextArrival = nextIdeal;
+                    if(s->jitter > 0.0f) {
+                        nextArrival += (unit(rand) * 2.0 - 1.0) * s->jitter;
+                    }
+                    if(nextArrival < lastArrival) {
+                        nextArrival = lastArrival;  // MIDI can't reorder ticks
+                    }
+                    if(!s->clock || unit(rand) < s->dropProb) {
+                        nextArrival = -2.0;  // lost
+                    }
+                }
+                if(nextArrival > handler.now) {
+                    break;
+                }
+                if(nextArrival != -2.0) {
+                    // the PLL takes at most one tick per task like the module
+                    if(tickSent) {
+                        break;
+                    }
+                    pll.handleMidiTick();
+                    tickSent = 1;
+                    lastArrival = nextArrival;
+                    handler.result.inTicks ++;
+                    if(handler.firstTick < 0.0) {
+                        handler.firstTick = nextArrival;
+                    }
+                }
+                // the sender's grid carries on through gaps and lost ticks
+                handler.idealTicks.push_back(nextIdeal);
+                // advance to the next ideal tick
+                frac = (nextIdeal - segStart) / (segEnd - segStart);
+                bpm = s->bpmStart + (s->bpmEnd - s->bpmStart) * frac;
+                period = 60000000.0 / (bpm * (double)MIDI_NATIVE_PPQ);
+                nextIdeal += period * (1.0 - (double)s->drift * 0.000001);
+                nextArrival = -1.0;
+            }
+            pll.timerTask();
+        }
+        segStart = segEnd;
+    }
+    handler.measure();
+    *result = handler.result;
+    result->relockCount = handler.stats.relockCount;
+    result->idealTicks = handler.idealTicks.size();
+    result->endTempo = pll.getTempo();
+    result->endTarget = 0.0f;
+    if(s != NULL) {
+        result->endTarget = s->bpmEnd * (1.0f + s->drift * 0.000001f);
+    }
+}
+
+// results of an internal clock run
+struct SimGridResult {
+    uint32_t ticks;  // ticks issued
+    double errMean;  // mean phase error vs. the ideal grid (us)
+    double errRms;  // RMS phase error vs. the ideal grid (us)
+    double errMax;  // max absolute phase error vs. the ideal grid (us)
+    double errEnd;  // phase error of the last tick (us) - shows drift
+};
+
+// records every tick time of the internal clock
+class SimGridHandler : public MidiClockPllHandler {
+public:
+    MidiClockPll *pll;
+    double now;  // host time at the end of the current task (us)
+    double taskIntervalUs;
+    std::vector<double> ticks;  // output tick times (us)
+
+    // clock ticked - place the tick inside the task like the module does
+    void midiClockTicked(uint32_t tickCount) override {
+        ticks.push_back((now - taskIntervalUs) +
+            (double)pll->getTickOffset() * taskIntervalUs);
+    }
+};
+
+// run the internal clock at a fixed tempo and measure each tick against an
+// ideal grid anchored at the first tick - checks the getTickOffset() placement
+static void simGrid(float bpm, double len, double taskIntervalUs, SimGridResult *result) {
+    MidiClockPll pll;
+    SimGridHandler handler;
+    double period = 60000000.0 / ((double)bpm * (double)MIDI_NATIVE_PPQ);
+    double err, sum = 0.0, sqSum = 0.0;
+    size_t i;
+
+    handler.pll = &pll;
+    handler.now = 0.0;
+    handler.taskIntervalUs = taskIntervalUs;
+    pll.registerHandler(&handler);
+    pll.setTaskInterval(taskIntervalUs);
+    pll.setInternalPpq(MIDI_NATIVE_PPQ);
+    pll.setSource(MidiClockPll::SOURCE_INTERNAL);
+    pll.setTempo(bpm);
+    pll.timerTask();  // apply the source change
+    handler.ticks.clear();
+    while(handler.now < (len * 1000000.0)) {
+        handler.now += taskIntervalUs;
+        pll.timerTask();
+    }
+    memset(result, 0, sizeof(*result));
+    result->ticks = handler.ticks.size();
+    for(i = 0; i < handler.ticks.size(); i ++) {
+        err = handler.ticks[i] - (handler.ticks[0] + (double)i * period);
+        sum += err;
+        sqSum += err * err;
+        if(fabs(err) > result->errMax) {
+            result->errMax = fabs(err);
+        }
+        result->errEnd = err;
+    }
+    if(result->ticks > 0) {
+        result->errMean = sum / (double)result->ticks;
+        result->errRms = sqrt(sqSum / (double)result->ticks);
+    }
+}
+
+// print the usage
+static void usage(const char *prog) {
+    int i;
+    printf("usage: %s [options] [scenario ...]\n", prog);
+    printf("  -b <0-2>    loop bandwidth - 0 = low, 1 = medium, 2 = high - default: all\n");
+    printf("  -i <us>     timer task interval - can be fractional - default: 1000\n");
+    printf("  -s <seed>   random seed - default: 1\n");
+    printf("  -t <file>   write a CSV trace of every external tick\n");
+    printf("scenarios (default: all):\n");
+    for(i = 0; i < (int)scenarios.size(); i ++) {
+        printf("  %-10s  %s\n", scenarios[i].name, scenarios[i].desc);
+    }
+    printf("  %-10s  %s\n", "internal", "internal clock at fixed tempos vs. an ideal grid");
+}
+
+int main(int argc, char **argv) {
+    std::vector<const SimScenario *> run;
+    const char *bwNames[MidiClockPll::LOOP_BW_NUM_SETTINGS] = {"low", "medium", "high"};
+    int i, j, bw, bwFirst = 0, bwLast = MidiClockPll::LOOP_BW_NUM_SETTINGS - 1;
+    double taskIntervalUs = 1000.0;
+    unsigned seed = 1;
+    FILE *trace = NULL;
+    SimResult r;
+    SimGridResult g;
+    const float gridTempos[] = {60.0f, 97.3f, 120.0f, 133.33f, 174.0f, 300.0f};
+    int grid = 0;
+    double mean, rms;
+
+    for(i = 1; i < argc; i ++) {
+        if(strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            bwFirst = bwLast = atoi(argv[++ i]);
+            if(bwFirst < 0 || bwFirst >= MidiClockPll::LOOP_BW_NUM_SETTINGS) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            taskIntervalUs = atof(argv[++ i]);
+            if(taskIntervalUs < 1.0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = (unsigned)atoi(argv[++ i]);
+        }
+        else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            trace = fopen(argv[++ i], "w");
+            if(trace == NULL) {
+                fprintf(stderr, "can't open trace file: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        }
+        else if(strcmp(argv[i], "internal") == 0) {
+            grid = 1;
+        }
+        else {
+            for(j = 0; j < (int)scenarios.size(); j ++) {
+                if(strcmp(argv[i], scenarios[j].name) == 0) {
+                    run.push_back(&scenarios[j]);
+                    break;
+                }
+            }
+            if(j == (int)scenarios.size()) {
+                fprintf(stderr, "unknown scenario: %s\n", argv[i]);
+                usage(argv[0]);
+                return 1;
+            }
+        }
+    }
+    if(run.size() == 0 && !grid) {
+        for(j = 0; j < (int)scenarios.size(); j ++) {
+            run.push_back(&scenarios[j]);
+        }
+        grid = 1;
+    }
+
+    if(grid) {
+        printf("%-10s %8s %7s %9s %9s %9s %9s\n",
+            "internal", "bpm", "ticks", "pe.mean", "pe.rms", "pe.max", "pe.end");
+        for(i = 0; i < (int)(sizeof(gridTempos) / sizeof(gridTempos[0])); i ++) {
+            simGrid(gridTempos[i], 60.0, taskIntervalUs, &g);
+            printf("%-10s %8.2f %7u %9.1f %9.1f %9.1f %9.1f\n", "internal", gridTempos[i],
+                g.ticks, g.errMean, g.errRms, g.errMax, g.errEnd);
+        }
+        printf("pe = tick phase error vs. an ideal grid at the set tempo anchored at the "
+            "first tick (us) - 60 s per tempo\n");
+        if(run.size() == 0) {
+            return 0;
+        }
+        printf("\n");
+    }
+
+    printf("%-10s %-6s %9s %7s %6s %5s %5s %9s %9s %9s %8s %9s %9s %8s %8s\n",
+        "scenario", "bw", "lock(ms)", "relocks", "unlock", "lost", "skip",
+        "pe.mean", "pe.rms", "pe.max", "ticks.in", "ticks.out", "ticks.snd", "tempo", "target");
+    for(i = 0; i < (int)run.size(); i ++) {
+        for(bw = bwFirst; bw <= bwLast; bw ++) {
+            simRun(*run[i], bw, taskIntervalUs, seed, trace, &r);
+            mean = 0.0;
+            rms = 0.0;
+            if(r.errCount > 0) {
+                mean = r.errSum / (double)r.errCount;
+                rms = sqrt(r.errSqSum / (double)r.errCount);
+            }
+            printf("%-10s %-6s %9.0f %7u %6d %5d %5u %9.0f %9.0f %9.0f %8u %9u %9u %8.2f %8.2f\n",
+                run[i]->name, bwNames[bw], r.lockTime, r.relockCount, r.lockLosses,
+                r.syncLosses, r.skipped, mean, rms, r.errMax, r.inTicks, r.outTicks,
+                r.idealTicks, r.endTempo, r.endTarget);
+        }
+    }
+    printf("lock(ms) = first tick to first lock (-1 = never) - unlock = lock losses - "
+        "lost = sync timeouts\n");
+    printf("skip = lost ticks detected by the PLL - ticks.snd = ticks the sender meant "
+        "to send including lost ones\n");
+    printf("pe = output tick phase error vs. the ideal sender ticks while locked (us)\n");
+    if(trace != NULL) {
+        fclose(trace);
+    }
+    return 0;
+}
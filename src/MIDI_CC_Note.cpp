@@ -37,6 +37,10 @@ struct MIDI_CC_Note : Module, KilpatrickLabelHandler, MidiRepeaterSender {
 		OCT_DOWN_SW,
         OCT_OFFSET,  // octave offset
         CC_BASE,  // base CC offset
+        VMIDI_BURST,  // vMIDI output burst mode - 0 = off, 1 = on
+        VMIDI_EXPANDER,  // send vMIDI to the module on the right - 0 = off, 1 = on
+        VMIDI_COALESCE,  // vMIDI output controller coalescing - 0 = off, 1 = on
+        VMIDI_STATS_JSON,  // save vMIDI stats in the patch - 0 = off, 1 = on
 		PARAMS_LEN
 	};
 	enum InputId {
@@ -57,6 +61,7 @@ struct MIDI_CC_Note : Module, KilpatrickLabelHandler, MidiRepeaterSender {
     static constexpr int LED_PULSE_LEN = 50;
     static constexpr int LAST_NOTE_TIMEOUT = 500;
     dsp::ClockDivider taskTimer;
+    std::vector<CVMidi *> statsPorts;  // vMIDI ports shown in the stats
     CVMidi *cvMidiIn;
     CVMidi *cvMidiOut;
     MidiRepeater repeatHist;
@@ -75,12 +80,21 @@ struct MIDI_CC_Note : Module, KilpatrickLabelHandler, MidiRepeaterSender {
 		configParam(OCT_DOWN_SW, 0.f, 1.f, 0.f, "OCT DOWN");
         configParam(OCT_OFFSET, -6.0f, 6.0f, 0.0f, "OCT_OFFSET");
         configParam(CC_BASE, 0.0f, 120.0f, 0.0f, "CC BASE");
+        configParam(VMIDI_BURST, 0.0f, 1.0f, 0.0f, "VMIDI BURST");
+        configParam(VMIDI_EXPANDER, 0.0f, 1.0f, 0.0f, "VMIDI EXPANDER");
+        configParam(VMIDI_COALESCE, 0.0f, 1.0f, 0.0f, "VMIDI COALESCE");
+        configParam(VMIDI_STATS_JSON, 0.0f, 1.0f, 0.0f, "VMIDI STATS JSON");
 		configInput(MIDI_IN, "MIDI IN");
 		configOutput(MIDI_OUT, "MIDI OUT");
         cvMidiIn = new CVMidi(&inputs[MIDI_IN], 1);
+        cvMidiIn->setExpanderModule(this);  // receive from the module on the left
         cvMidiOut = new CVMidi(&outputs[MIDI_OUT], 0);
+        cvMidiOut->setExpanderModule(this);  // can send to the module on the right
         repeatHist.registerSender(this, 0);
         repeatHist.setMode(MidiRepeater::RepeaterMode::MODE_OFF);
+        cvMidiIn->setName("MIDI IN");
+        cvMidiOut->setName("MIDI OUT");
+        statsPorts = {cvMidiIn, cvMidiOut};
         onReset();
         onSampleRateChange();
 	}
@@ -97,14 +111,16 @@ struct MIDI_CC_Note : Module, KilpatrickLabelHandler, MidiRepeaterSender {
 
         // handle CV MIDI
         cvMidiIn->process();
+
+        // handle MIDI input every sample so messages go out in the sample they arrive
+        while(cvMidiIn->getInputMessage(&msg)) {
+            repeatHist.handleMessage(msg);
+        }
+
         cvMidiOut->process();
 
         // run tasks
         if(taskTimer.process()) {
-            // handle MIDI input
-            while(cvMidiIn->getInputMessage(&msg)) {
-                repeatHist.handleMessage(msg);
-            }
             lastNoteTimeout.update();
 
             // handle octave switches
@@ -122,9 +138,24 @@ struct MIDI_CC_Note : Module, KilpatrickLabelHandler, MidiRepeaterSender {
 
             // run tasks for the repeater
             repeatHist.taskTimer();
+
+            // vMIDI output settings
+            cvMidiOut->setBurstMode((int)params[VMIDI_BURST].getValue());
+            cvMidiOut->setCoalesceMode((int)params[VMIDI_COALESCE].getValue());
+            cvMidiOut->setExpanderSend((int)params[VMIDI_EXPANDER].getValue());
         }
 	}
 
+    // save custom JSON in patch
+    json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+        // vMIDI stats for finding bottlenecks
+        if((int)params[VMIDI_STATS_JSON].getValue()) {
+            CVMidi::statsListToJson(rootJ, statsPorts);
+        }
+		return rootJ;
+	}
+
     // samplerate changed
     void onSampleRateChange(void) override {
         taskTimer.setDivision((int)(APP->engine->getSampleRate() / RT_TASK_RATE));
@@ -249,6 +280,13 @@ struct MIDI_CC_NoteWidget : ModuleWidget {
         menuHelperAddItem(menu, new MIDI_CC_NoteCCBaseMenuItem(module, 96, "96"));
         menuHelperAddItem(menu, new MIDI_CC_NoteCCBaseMenuItem(module, 108, "108"));
         menuHelperAddItem(menu, new MIDI_CC_NoteCCBaseMenuItem(module, 120, "120"));
+
+        // vMIDI settings
+        menuHelperAddVmidiOutputs(menu, &module->params[MIDI_CC_Note::VMIDI_BURST],
+            &module->params[MIDI_CC_Note::VMIDI_COALESCE], &module->params[MIDI_CC_Note::VMIDI_EXPANDER]);
+
+        // vMIDI stats
+        menuHelperAddVmidiStats(menu, module->statsPorts, &module->params[MIDI_CC_Note::VMIDI_STATS_JSON]);
     }
 };
 
@@ -42,6 +42,8 @@ struct MIDI_CV : Module {
         MAP_CHAN2,  // channel for output 2 (CC mode)
         MAP_CHAN3,  // channel for output 3 (CC mode)
         BEND_RANGE,
+        VMIDI_STATS_JSON,  // save vMIDI stats in the patch - 0 = off, 1 = on
+        POLY_ALLOC,  // poly voice allocation mode
 		NUM_PARAMS
 	};
 	enum InputIds {
@@ -62,10 +64,11 @@ struct MIDI_CV : Module {
 		NUM_LIGHTS
 	};
     dsp::ClockDivider taskTimer;
+    std::vector<CVMidi *> statsPorts;  // vMIDI ports shown in the stats
     CVMidi *cvMidiIn;
     MidiHelper *midi;
     MidiCCMem ccMem;
-    Midi2Note midi2note;
+    Midi2Note<3> midi2note;
     putils::PosEdgeDetect learnEdge;
     putils::ParamChangeDetect cvModeChange;
     putils::ParamChangeDetect polyChange;
@@ -107,13 +110,19 @@ struct MIDI_CV : Module {
         configParam(MAP_CHAN1, 0.0f, 127.0f, 0.0f, "CHAN1");
         configParam(MAP_CHAN2, 0.0f, 127.0f, 0.0f, "CHAN2");
         configParam(MAP_CHAN3, 0.0f, 127.0f, 0.0f, "CHAN3");
+        configParam(VMIDI_STATS_JSON, 0.0f, 1.0f, 0.0f, "VMIDI STATS JSON");
+        configParam(POLY_ALLOC, 0.0f, (float)(Midi2Note<3>::ALLOC_NUM_MODES - 1),
+            (float)Midi2Note<3>::ALLOC_LOWEST_FREE, "POLY ALLOC");
         configInput(MIDI_IN, "MIDI IN");
         configOutput(P1_OUT, "P1 OUT");
         configOutput(G2_OUT, "G2 OUT");
         configOutput(V3_OUT, "V3 OUT");
         cvMidiIn = new CVMidi(&inputs[MIDI_IN], 1);
+        cvMidiIn->setExpanderModule(this);  // receive from the module on the left
         ccMem.setTimeout(RT_TASK_RATE * 2);  // 2 seconds
         timerDiv = 0;
+        cvMidiIn->setName("MIDI IN");
+        statsPorts = {cvMidiIn};
         onReset();
         onSampleRateChange();
 	}
@@ -131,59 +140,59 @@ struct MIDI_CV : Module {
         // handle CV MIDI
         cvMidiIn->process();
 
-        // run tasks
-        if(taskTimer.process()) {
-            ccMem.process();
-
-            // process MIDI
-            while(cvMidiIn->getInputMessage(&msg)) {
-                // handle CC messages - filter repeats
-                if(MidiHelper::isControlChangeMessage(msg)) {
-                    // ignore repeated messages
-                    if(ccMem.handleCC(msg) != 0) {
-                        continue;
-                    }
-                    // learn CC input when in learn mode
-                    if(learnMode != LEARN_DISABLE) {
-                        learn(msg);
-                        continue;
-                    }
+        // process MIDI every sample so the CV changes in the sample the message arrives
+        while(cvMidiIn->getInputMessage(&msg)) {
+            // handle CC messages - filter repeats
+            if(MidiHelper::isControlChangeMessage(msg)) {
+                // ignore repeated messages
+                if(ccMem.handleCC(msg) != 0) {
+                    continue;
                 }
-                // learn other messages
-                else if(learnMode != LEARN_DISABLE) {
+                // learn CC input when in learn mode
+                if(learnMode != LEARN_DISABLE) {
                     learn(msg);
                     continue;
                 }
+            }
+            // learn other messages
+            else if(learnMode != LEARN_DISABLE) {
+                learn(msg);
+                continue;
+            }
 
-                // handle output modes
-                switch((int)params[MODE_SW].getValue()) {
-                    case CV_MODE_CC:
-                        if(MidiHelper::isControlChangeMessage(msg)) {
-                            // check each CC output
-                            for(i = 0; i < 3; i ++) {
-                                if(msg.bytes[1] == (int)params[MAP_CC1 + i].getValue() &&
-                                        MidiHelper::getChannelMsgChannel(msg) == (int)params[MAP_CHAN1 + i].getValue()) {
-                                    outputVals[i] = (putils::midi2float(msg.bytes[2]) * 10.0f) + -5.0f;
-                                }
+            // handle output modes
+            switch((int)params[MODE_SW].getValue()) {
+                case CV_MODE_CC:
+                    if(MidiHelper::isControlChangeMessage(msg)) {
+                        // check each CC output
+                        for(i = 0; i < 3; i ++) {
+                            if(msg.bytes[1] == (int)params[MAP_CC1 + i].getValue() &&
+                                    MidiHelper::getChannelMsgChannel(msg) == (int)params[MAP_CHAN1 + i].getValue()) {
+                                outputVals[i] = (putils::midi2float(msg.bytes[2]) * 10.0f) + -5.0f;
                             }
                         }
-                        break;
-                    case CV_MODE_MONO:
-                        midi2note.handleMessage(msg);
-                        outputVals[P1_OUT] = midi2note.getPitchVoltage(0);
-                        outputVals[G2_OUT] = midi2note.getGateVoltage(0);
-                        outputVals[V3_OUT] = midi2note.getVelocityVoltage(0);
-                        break;
-                    case CV_MODE_POLY:
-                    default:
-                        midi2note.handleMessage(msg);
-                        temp = 2 - (int)params[POLY_SW].getValue();  // flip around poly switch values
-                        outputVals[P1_OUT] = midi2note.getPitchVoltage(temp);
-                        outputVals[G2_OUT] = midi2note.getGateVoltage(temp);
-                        outputVals[V3_OUT] = midi2note.getVelocityVoltage(temp);
-                        break;
-                }
+                    }
+                    break;
+                case CV_MODE_MONO:
+                    midi2note.handleMessage(msg);
+                    outputVals[P1_OUT] = midi2note.getPitchVoltage(0);
+                    outputVals[G2_OUT] = midi2note.getGateVoltage(0);
+                    outputVals[V3_OUT] = midi2note.getVelocityVoltage(0);
+                    break;
+                case CV_MODE_POLY:
+                default:
+                    midi2note.handleMessage(msg);
+                    temp = 2 - (int)params[POLY_SW].getValue();  // flip around poly switch values
+                    outputVals[P1_OUT] = midi2note.getPitchVoltage(temp);
+                    outputVals[G2_OUT] = midi2note.getGateVoltage(temp);
+                    outputVals[V3_OUT] = midi2note.getVelocityVoltage(temp);
+                    break;
             }
+        }
+
+        // run tasks
+        if(taskTimer.process()) {
+            ccMem.process();
 
             // handle learn button
             if(learnEdge.update((int)params[LEARN_SW].getValue())) {
@@ -339,6 +348,16 @@ struct MIDI_CV : Module {
         learnTimeout = 0;
     }
 
+    // save custom JSON in patch
+    json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+        // vMIDI stats for finding bottlenecks
+        if((int)params[VMIDI_STATS_JSON].getValue()) {
+            CVMidi::statsListToJson(rootJ, statsPorts);
+        }
+		return rootJ;
+	}
+
     // samplerate changed
     void onSampleRateChange(void) override {
         taskTimer.setDivision((int)(APP->engine->getSampleRate() / RT_TASK_RATE));
@@ -363,6 +382,7 @@ struct MIDI_CV : Module {
         setCVMode(params[MODE_SW].getValue());
         setPolyVoices(params[POLY_SW].getValue());
         midi2note.setBendRange(params[BEND_RANGE].getValue());
+        midi2note.setAllocMode((int)params[POLY_ALLOC].getValue());
     }
 
     // set the bend range
@@ -370,6 +390,12 @@ struct MIDI_CV : Module {
         params[BEND_RANGE].setValue(range);
         midi2note.setBendRange(range);
     }
+
+    // set the poly voice allocation mode
+    void setPolyAlloc(int mode) {
+        params[POLY_ALLOC].setValue(mode);
+        midi2note.setAllocMode(mode);
+    }
 };
 
 // handle choosing a pitch bend range
@@ -390,6 +416,24 @@ struct MIDI_CVBendRangeMenuItem : MenuItem {
     }
 };
 
+// handle choosing a poly voice allocation mode
+struct MIDI_CVPolyAllocMenuItem : MenuItem {
+    MIDI_CV *module;
+    int mode;
+
+    MIDI_CVPolyAllocMenuItem(Module *module, int mode, std::string name) {
+        this->module = dynamic_cast<MIDI_CV*>(module);
+        this->text = name;
+        this->rightText = CHECKMARK(mode == this->module->midi2note.getAllocMode());
+        this->mode = mode;
+    }
+
+    // the menu item was selected
+    void onAction(const event::Action &e) override {
+        this->module->setPolyAlloc(mode);
+    }
+};
+
 struct MIDI_CVWidget : ModuleWidget {
 	MIDI_CVWidget(MIDI_CV* module) {
 		setModule(module);
@@ -436,6 +480,20 @@ struct MIDI_CVWidget : ModuleWidget {
         menuHelperAddItem(menu, new MIDI_CVBendRangeMenuItem(module, 10));
         menuHelperAddItem(menu, new MIDI_CVBendRangeMenuItem(module, 11));
         menuHelperAddItem(menu, new MIDI_CVBendRangeMenuItem(module, 12));
+
+        // vMIDI stats
+        menuHelperAddSpacer(menu);
+        menuHelperAddLabel(menu, "Poly Voice Allocation");
+        menuHelperAddItem(menu, new MIDI_CVPolyAllocMenuItem(module,
+            Midi2Note<3>::ALLOC_LOWEST_FREE, "Lowest Free"));
+        menuHelperAddItem(menu, new MIDI_CVPolyAllocMenuItem(module,
+            Midi2Note<3>::ALLOC_ROUND_ROBIN, "Round Robin"));
+        menuHelperAddItem(menu, new MIDI_CVPolyAllocMenuItem(module,
+            Midi2Note<3>::ALLOC_STEAL_OLDEST, "Steal Oldest"));
+        menuHelperAddItem(menu, new MIDI_CVPolyAllocMenuItem(module,
+            Midi2Note<3>::ALLOC_UNISON, "Unison"));
+
+        menuHelperAddVmidiStats(menu, module->statsPorts, &module->params[MIDI_CV::VMIDI_STATS_JSON]);
     }
 };
 
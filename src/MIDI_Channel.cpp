@@ -23,6 +23,7 @@
 #include "plugin.hpp"
 #include "utils/CVMidi.h"
 #include "utils/KAComponents.h"
+#include "utils/MenuHelper.h"
 #include "utils/MidiHelper.h"
 #include "utils/MidiNoteMem.h"
 #include "utils/PUtils.h"
@@ -34,6 +35,10 @@ struct MIDI_Channel : Module, KilpatrickLabelHandler {
         KEY_SPLIT,  // key split point - 36 to 84 (C2 to C6)
         KEY_SPLIT_ENABLE,  // key split enable mode
         KEY_TRANS,  // key transpose - -24 to +24
+        VMIDI_BURST,  // vMIDI output burst mode - 0 = off, 1 = on
+        VMIDI_EXPANDER,  // send vMIDI to the module on the right - 0 = off, 1 = on
+        VMIDI_COALESCE,  // vMIDI output controller coalescing - 0 = off, 1 = on
+        VMIDI_STATS_JSON,  // save vMIDI stats in the patch - 0 = off, 1 = on
 		NUM_PARAMS
 	};
 	enum InputIds {
@@ -52,12 +57,14 @@ struct MIDI_Channel : Module, KilpatrickLabelHandler {
 		NUM_LIGHTS
 	};
     dsp::ClockDivider taskTimer;
+    std::vector<CVMidi *> statsPorts;  // vMIDI ports shown in the stats
     CVMidi *cvMidiIn;
     CVMidi *cvMidiOut[2];
     #define DOUBLE_CLICK_TIMEOUT (RT_TASK_RATE * 0.3)
     putils::Pulser doubleClickPulser;
     MidiNoteMem midiNoteMem[2];
     int resetOutputNotes;
+    int idle;  // 1 = processing is skipped until a cable is connected
     // defaults
     #define IN_CHAN_DEFAULT -1
     #define OUT_CHAN_DEFAULT 0
@@ -73,12 +80,22 @@ struct MIDI_Channel : Module, KilpatrickLabelHandler {
         configParam(KEY_TRANS, -24.0f, 24.0f, 0.0f, "KEY TRANS");
         configParam(KEY_SPLIT, 36.0f, 84.0f, 60.0f, "KEY SPLIT");
         configParam(KEY_SPLIT_ENABLE, 0.0f, 1.0f, 0.0f, "KEY SPLIT ENABLE");
+        configParam(VMIDI_BURST, 0.0f, 1.0f, 0.0f, "VMIDI BURST");
+        configParam(VMIDI_EXPANDER, 0.0f, 1.0f, 0.0f, "VMIDI EXPANDER");
+        configParam(VMIDI_COALESCE, 0.0f, 1.0f, 0.0f, "VMIDI COALESCE");
+        configParam(VMIDI_STATS_JSON, 0.0f, 1.0f, 0.0f, "VMIDI STATS JSON");
         configInput(MIDI_IN, "MIDI IN");
         configOutput(MIDI_OUT_L, "MIDI OUT L");
         configOutput(MIDI_OUT_R, "MIDI OUT R");
         cvMidiIn = new CVMidi(&inputs[MIDI_IN], 1);
+        cvMidiIn->setExpanderModule(this);  // receive from the module on the left
         cvMidiOut[MIDI_OUT_L] = new CVMidi(&outputs[MIDI_OUT_L], 0);
         cvMidiOut[MIDI_OUT_R] = new CVMidi(&outputs[MIDI_OUT_R], 0);
+        cvMidiOut[MIDI_OUT_R]->setExpanderModule(this);  // can send to the module on the right
+        cvMidiIn->setName("MIDI IN");
+        cvMidiOut[MIDI_OUT_L]->setName("MIDI OUT L");
+        cvMidiOut[MIDI_OUT_R]->setName("MIDI OUT R");
+        statsPorts = {cvMidiIn, cvMidiOut[MIDI_OUT_L], cvMidiOut[MIDI_OUT_R]};
         onReset();
         onSampleRateChange();
 	}
@@ -92,11 +109,48 @@ struct MIDI_Channel : Module, KilpatrickLabelHandler {
 
     // process a sample
 	void process(const ProcessArgs& args) override {
-        int i, outSelect;
+        int outSelect;
         midi::Message msg;
 
+        // skip everything while no cables are connected and all ports are idle
+        if(idle && isIdle()) {
+            return;
+        }
+        idle = 0;
+
         // handle CV MIDI
         cvMidiIn->process();
+
+        // process MIDI every sample so messages go out in the sample they arrive
+        while(cvMidiIn->getInputMessage(&msg)) {
+            outSelect = 1;  // right output
+            // filter channel messages
+            if(MidiHelper::isChannelMessage(msg)) {
+                // in channel filter
+                if((int)params[IN_CHAN].getValue() != -1 &&
+                        (int)params[IN_CHAN].getValue() != MidiHelper::getChannelMsgChannel(msg)) {
+                    continue;
+                }
+                // output channel mapping
+                msg.bytes[0] = (msg.bytes[0] & 0xf0) | ((int)params[OUT_CHAN].getValue() & 0x0f);
+
+                // process note messages
+                if(MidiHelper::isNoteMessage(msg)) {
+                    // key split
+                    if((int)params[KEY_SPLIT_ENABLE].getValue()) {
+                        // left hand
+                        if(msg.bytes[1] < (int)params[KEY_SPLIT].getValue()) {
+                            outSelect = 0;
+                        }
+                    }
+                    // key transpose
+                    msg.bytes[1] = putils::clamp(msg.bytes[1] + (int)params[KEY_TRANS].getValue(), 0, 127);
+                    midiNoteMem[outSelect].addNote(msg);  // keep track of notes we sent
+                }
+            }
+            cvMidiOut[MIDI_OUT_L + outSelect]->sendOutputMessage(msg);
+        }
+
         cvMidiOut[MIDI_OUT_L]->process();
         cvMidiOut[MIDI_OUT_R]->process();
 
@@ -105,52 +159,46 @@ struct MIDI_Channel : Module, KilpatrickLabelHandler {
             // reset notes that we output before
             if(resetOutputNotes) {
                 for(outSelect = 0; outSelect < NUM_OUTPUTS; outSelect ++) {
-                    for(i = 0; i < midiNoteMem[outSelect].getNumNotes(); i ++) {
-                        msg = midiNoteMem[outSelect].getNote(i);
-                        // convert note on to off
-                        msg.bytes[0] = MIDI_NOTE_OFF | (msg.bytes[0] & 0x0f);
+                    while(midiNoteMem[outSelect].popNoteOff(&msg)) {
                         cvMidiOut[MIDI_OUT_L + outSelect]->sendOutputMessage(msg);
                     }
                 }
                 resetOutputNotes = 0;
             }
 
-            // process MIDI
-            while(cvMidiIn->getInputMessage(&msg)) {
-                outSelect = 1;  // right output
-                // filter channel messages
-                if(MidiHelper::isChannelMessage(msg)) {
-                    // in channel filter
-                    if((int)params[IN_CHAN].getValue() != -1 &&
-                            (int)params[IN_CHAN].getValue() != MidiHelper::getChannelMsgChannel(msg)) {
-                        continue;
-                    }
-                    // output channel mapping
-                    msg.bytes[0] = (msg.bytes[0] & 0xf0) | ((int)params[OUT_CHAN].getValue() & 0x0f);
-
-                    // process note messages
-                    if(MidiHelper::isNoteMessage(msg)) {
-                        // key split
-                        if((int)params[KEY_SPLIT_ENABLE].getValue()) {
-                            // left hand
-                            if(msg.bytes[1] < (int)params[KEY_SPLIT].getValue()) {
-                                outSelect = 0;
-                            }
-                        }
-                        // key transpose
-                        msg.bytes[1] = putils::clamp(msg.bytes[1] + (int)params[KEY_TRANS].getValue(), 0, 127);
-                        midiNoteMem[outSelect].addNote(msg);  // keep track of notes we sent
-                    }
-                }
-                cvMidiOut[MIDI_OUT_L + outSelect]->sendOutputMessage(msg);
-            }
+            // vMIDI output settings
+            cvMidiOut[MIDI_OUT_L]->setBurstMode((int)params[VMIDI_BURST].getValue());
+            cvMidiOut[MIDI_OUT_L]->setCoalesceMode((int)params[VMIDI_COALESCE].getValue());
+            cvMidiOut[MIDI_OUT_R]->setBurstMode((int)params[VMIDI_BURST].getValue());
+            cvMidiOut[MIDI_OUT_R]->setCoalesceMode((int)params[VMIDI_COALESCE].getValue());
+            cvMidiOut[MIDI_OUT_R]->setExpanderSend((int)params[VMIDI_EXPANDER].getValue());
 
             // MIDI LEDs
             lights[MIDI_IN_LED].setBrightness(cvMidiIn->getLedState());
             lights[MIDI_OUT_L_LED].setBrightness(cvMidiOut[0]->getLedState());
             lights[MIDI_OUT_R_LED].setBrightness(cvMidiOut[1]->getLedState());
             doubleClickPulser.update();
+            idle = isIdle();
+        }
+	}
+
+    // check if all ports are idle and there is no work to do
+    int isIdle(void) {
+        if(resetOutputNotes || doubleClickPulser.timeout) {
+            return 0;
+        }
+        return cvMidiIn->isIdle() && cvMidiOut[MIDI_OUT_L]->isIdle() &&
+            cvMidiOut[MIDI_OUT_R]->isIdle();
+    }
+
+    // save custom JSON in patch
+    json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+        // vMIDI stats for finding bottlenecks
+        if((int)params[VMIDI_STATS_JSON].getValue()) {
+            CVMidi::statsListToJson(rootJ, statsPorts);
         }
+		return rootJ;
 	}
 
     // samplerate changed
@@ -170,6 +218,7 @@ struct MIDI_Channel : Module, KilpatrickLabelHandler {
         params[KEY_SPLIT_ENABLE].setValue(KEY_SPLIT_ENABLE_DEFAULT);
         params[KEY_TRANS].setValue(KEY_TRANS_DEFAULT);
         resetOutputNotes = 1;  // force reset
+        idle = 0;
     }
 
     //
@@ -322,6 +371,21 @@ struct MIDI_ChannelWidget : ModuleWidget {
         addChild(createLightCentered<MediumLight<RedLight>>(mm2px(Vec(3.81, 86.15)), module, MIDI_Channel::MIDI_OUT_L_LED));
         addChild(createLightCentered<MediumLight<RedLight>>(mm2px(Vec(3.81, 102.15)), module, MIDI_Channel::MIDI_OUT_R_LED));
 	}
+
+    // add menu items
+    void appendContextMenu(Menu *menu) override {
+        MIDI_Channel *module = dynamic_cast<MIDI_Channel*>(this->module);
+        if(!module) {
+            return;
+        }
+
+        // vMIDI settings
+        menuHelperAddVmidiOutputs(menu, &module->params[MIDI_Channel::VMIDI_BURST],
+            &module->params[MIDI_Channel::VMIDI_COALESCE], &module->params[MIDI_Channel::VMIDI_EXPANDER]);
+
+        // vMIDI stats
+        menuHelperAddVmidiStats(menu, module->statsPorts, &module->params[MIDI_Channel::VMIDI_STATS_JSON]);
+    }
 };
 
 Model* modelMIDI_Channel = createModel<MIDI_Channel, MIDI_ChannelWidget>("MIDI_Channel");
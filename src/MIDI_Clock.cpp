@@ -24,11 +24,39 @@
 #include "utils/CVMidi.h"
 #include "utils/KAComponents.h"
 #include "utils/MenuHelper.h"
+#include "utils/MidiClockTransport.h"
 #include "utils/MidiHelper.h"
 #include "utils/PLog.h"
 #include "utils/PUtils.h"
+#include "utils/SpscQueue.h"
 #include "utils/VUtils.h"
 #include "MidiClockPll/MidiClockPll.h"
+#include "MidiClockPll/MidiClockTaps.h"
+
+// clock tap rates - in quarter notes
+struct MIDI_ClockTapRate {
+    const char *name;
+    int num;
+    int den;
+};
+static const MIDI_ClockTapRate tapRates[] = {
+    {"Off", 0, 1},
+    {"1/256", 1, 64},
+    {"1/128", 1, 32},
+    {"1/64", 1, 16},
+    {"1/32", 1, 8},
+    {"1/16T", 1, 6},
+    {"1/16", 1, 4},
+    {"1/8T", 1, 3},
+    {"1/8", 1, 2},
+    {"1/4T", 2, 3},
+    {"1/4", 1, 1},
+    {"1/2", 2, 1},
+    {"1 Bar", 4, 1},
+    {"2 Bars", 8, 1},
+    {"4 Bars", 16, 1}
+};
+#define MIDI_CLOCK_NUM_TAP_RATES ((int)(sizeof(tapRates) / sizeof(MIDI_ClockTapRate)))
 
 struct MIDI_Clock : Module, MidiClockPllHandler {
 	enum ParamId {
@@ -39,6 +67,15 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
         AUTOSTART_EN,  // 0 = disable, 1.0 = enable
         CLOCK_SOURCE,  // 0 = ext, 1 = int
         RUN_IN_MODE,  // 0 = momentary, 1 = run, 2 = toggle
+        VMIDI_BURST,  // vMIDI output burst mode - 0 = off, 1 = on
+        VMIDI_EXPANDER,  // send vMIDI to the module on the right - 0 = off, 1 = on
+        VMIDI_COALESCE,  // vMIDI output controller coalescing - 0 = off, 1 = on
+        VMIDI_STATS_JSON,  // save vMIDI stats in the patch - 0 = off, 1 = on
+        SYNC_BANDWIDTH,  // external sync loop bandwidth - MidiClockPll::LoopBandwidth
+        TAP_RATE,  // clock tap rate for each tap - index into tapRates
+        TAP_SWING = TAP_RATE + MidiClockTaps::MAX_TAPS,  // clock tap swing for each tap - 0.5 to 0.75
+        TAP_PHASE = TAP_SWING + MidiClockTaps::MAX_TAPS,  // clock tap phase for each tap - 0.0 to <1.0
+        TRANSPORT_BUS = TAP_PHASE + MidiClockTaps::MAX_TAPS,  // shared transport bus - 0 = off, 1+ = bus
 		PARAMS_LEN
 	};
 	enum InputId {
@@ -73,7 +110,9 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
     static constexpr int AUTOSTART_TIMEOUT = 200;  // 200ms
     static constexpr int ANALOG_CLOCK_TIMEOUT = 2000;  // 2s
     static constexpr int RUN_IN_IGNORE_TIMEOUT = 200;  // 200ms
+    static constexpr int TASK_INTERVAL_US = 1000000 / RT_TASK_RATE;
     dsp::ClockDivider taskTimer;
+    std::vector<CVMidi *> statsPorts;  // vMIDI ports shown in the stats
     CVMidi *cvMidiIn;
     CVMidi *cvMidiOut;
     putils::PosEdgeDetect resetSwEdge;
@@ -88,14 +127,61 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
     putils::Pulser stopInLedPulse;
     putils::Pulser clockInLedPulse;
     putils::Pulser resetInLedPulse;
-    putils::Pulser clockOutPulse;
-    putils::Pulser resetOutPulse;
     putils::Pulser clockOutLedPulse;
     putils::Pulser resetOutLedPulse;
     putils::Pulser analogClockTimeout;
     MidiClockPll midiClock;
     int outputDiv;  // current running output divider ratio
     int outputDivCount;
+    // clock output events - the PLL ticks are delayed by one task interval
+    // so that each one can be placed on the exact sample it belongs on
+    enum ClockEventType {
+        EVENT_MIDI,  // send a vMIDI message
+        EVENT_CLOCK_PULSE,  // start a CLOCK OUT pulse
+        EVENT_RESET_PULSE  // start a RESET OUT pulse
+    };
+    struct ClockEvent {
+        int64_t due;  // engine frame to fire the event on
+        int type;
+        int len;  // vMIDI message length
+        uint8_t bytes[3];  // vMIDI message data
+        uint32_t tickPos;  // PLL tick position when the event was queued
+        int running;  // PLL run state when the event was queued
+    };
+    SpscQueue<ClockEvent, 32> clockEvents;
+    int64_t curFrame;  // engine frame being processed
+    int64_t lastEventDue;  // keeps events in order if offsets go backwards
+    int clockOutSamples;  // remaining CLOCK OUT pulse time
+    int resetOutSamples;  // remaining RESET OUT pulse time
+    uint32_t eventDropCount;  // clock and tap events dropped because a ring was full
+    float samplesPerUs;  // converts clock times to samples
+    // clock output timing - tick phase vs. an ideal grid at the internal tempo
+    int64_t gridStartFrame;  // frame of the tick the grid starts on - -1 = start on the next tick
+    uint32_t gridTicks;  // ticks sent since the grid start
+    float gridTempo;  // tempo the grid was started at
+    MidiHelperJitter tickPhase;  // phase error of each tick vs. the grid (us) - audio thread only
+    std::atomic<uint32_t> tickPhaseCount;  // copy of tickPhase for the UI
+    std::atomic<int64_t> tickPhaseMin;
+    std::atomic<int64_t> tickPhaseMax;
+    std::atomic<int64_t> tickPhaseSum;
+    std::atomic<int> tickPhaseReset;  // stats reset requested by the UI
+    // clock taps - extra channels on CLOCK OUT
+    MidiClockTaps clockTaps;
+    MidiClockTapPulse tapPulses[MidiClockTaps::MAX_PULSES];
+    struct TapEvent {
+        int64_t due;  // engine frame to start the pulse on
+        int tap;
+        int len;  // pulse length in samples
+    };
+    SpscQueue<TapEvent, 256> tapEvents;
+    int64_t lastTapDue;  // keeps tap pulses in order if the tempo changes
+    int tapSamples[MidiClockTaps::MAX_TAPS];  // remaining pulse time for each tap
+    int tapRestart[MidiClockTaps::MAX_TAPS];  // pulse to start after a low sample - 0 = none
+    int tapChannels;  // number of CLOCK OUT channels - 1 = no taps
+    // shared transport - published as the events go out
+    int transportBus;  // bus we want to publish on - -1 = off
+    MidiClockTransport *transport;  // bus we are publishing on - NULL = none
+    MidiClockTransportState transportState;
     enum RunInMode {
         RUNSTOP_MOMENTARY = 0,
         RUNSTOP_RUN,
@@ -112,6 +198,19 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
         configParam(AUTOSTART_EN, 0.0f, 1.0f, 0.0f, "AUTOSTART");
         configParam(CLOCK_SOURCE, 0.0f, 1.0f, 1.0f, "SOURCE");
         configParam(RUN_IN_MODE, 0.0f, 2.0f, 0.0f, "RUN IN MODE");
+        configParam(VMIDI_BURST, 0.0f, 1.0f, 0.0f, "VMIDI BURST");
+        configParam(VMIDI_EXPANDER, 0.0f, 1.0f, 0.0f, "VMIDI EXPANDER");
+        configParam(VMIDI_COALESCE, 0.0f, 1.0f, 0.0f, "VMIDI COALESCE");
+        configParam(VMIDI_STATS_JSON, 0.0f, 1.0f, 0.0f, "VMIDI STATS JSON");
+        configParam(SYNC_BANDWIDTH, 0.0f, (float)(MidiClockPll::LOOP_BW_NUM_SETTINGS - 1),
+            (float)MidiClockPll::LOOP_BW_MEDIUM, "SYNC BANDWIDTH");
+        for(int i = 0; i < MidiClockTaps::MAX_TAPS; i ++) {
+            configParam(TAP_RATE + i, 0.0f, (float)(MIDI_CLOCK_NUM_TAP_RATES - 1), 0.0f,
+                "TAP RATE " + std::to_string(i + 1));
+            configParam(TAP_SWING + i, 0.5f, 0.75f, 0.5f, "TAP SWING " + std::to_string(i + 1));
+            configParam(TAP_PHASE + i, 0.0f, 0.875f, 0.0f, "TAP PHASE " + std::to_string(i + 1));
+        }
+        configParam(TRANSPORT_BUS, 0.0f, (float)MidiClockTransport::NUM_BUSES, 0.0f, "TRANSPORT BUS");
 		configInput(CLOCK_IN, "CLOCK IN");
 		configInput(MIDI_IN, "MIDI IN");
         configInput(RUN_IN, "RUN IN");
@@ -121,16 +220,50 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
 		configOutput(CLOCK_OUT, "CLOCK OUT");
 		configOutput(RESET_OUT, "RESET OUT");
         cvMidiIn = new CVMidi(&inputs[MIDI_IN], 1);
+        cvMidiIn->setExpanderModule(this);  // receive from the module on the left
         cvMidiOut = new CVMidi(&outputs[MIDI_OUT], 0);
-        midiClock.setTaskInterval(1000000 / RT_TASK_RATE);
+        cvMidiOut->setExpanderModule(this);  // can send to the module on the right
+        midiClock.setTaskInterval(TASK_INTERVAL_US);
         midiClock.setInternalPpq(24);
         midiClock.registerHandler(this);
+        cvMidiIn->setName("MIDI IN");
+        cvMidiOut->setName("MIDI OUT");
+        statsPorts = {cvMidiIn, cvMidiOut};
+        curFrame = 0;
+        lastEventDue = 0;
+        clockOutSamples = 0;
+        resetOutSamples = 0;
+        eventDropCount = 0;
+        samplesPerUs = 0.048f;
+        gridStartFrame = -1;
+        gridTicks = 0;
+        gridTempo = 0.0f;
+        tickPhaseReset = 1;
+        clockTaps.setPpq(24);
+        lastTapDue = 0;
+        for(int i = 0; i < MidiClockTaps::MAX_TAPS; i ++) {
+            tapSamples[i] = 0;
+            tapRestart[i] = 0;
+        }
+        tapChannels = 1;
+        transportBus = -1;
+        transport = NULL;
+        transportState.running = 0;
+        transportState.tickPos = 0;
+        transportState.ppq = 24;
+        transportState.tempo = 120.0f;
+        transportState.tickFrame = 0;
+        transportState.nextTickFrame = 0;
+        transportState.resetCount = 0;
         onReset();
         onSampleRateChange();
 	}
 
     // destructor
     ~MIDI_Clock() {
+        if(transport != NULL) {
+            transport->release(this);
+        }
         delete cvMidiIn;
         delete cvMidiOut;
     }
@@ -138,6 +271,54 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
     // process a sample
 	void process(const ProcessArgs& args) override {
         float tempf;
+        int i;
+        ClockEvent *event;
+        TapEvent *tapEvent;
+        curFrame = args.frame;
+        if(tickPhaseReset) {
+            tickPhase.reset();
+            publishTickPhase();
+            gridStartFrame = -1;
+            eventDropCount = 0;
+            tickPhaseReset = 0;
+        }
+
+        // fire clock events that are due - before vMIDI so they go out now
+        while((event = clockEvents.peek()) != NULL && event->due <= curFrame) {
+            fireClockEvent(event, args.sampleTime);
+            clockEvents.pop(event);
+        }
+        while((tapEvent = tapEvents.peek()) != NULL && tapEvent->due <= curFrame) {
+            // a pulse that is still high ends first so the new one has an edge
+            if(tapSamples[tapEvent->tap] > 0) {
+                tapSamples[tapEvent->tap] = 0;
+                tapRestart[tapEvent->tap] = tapEvent->len;
+            }
+            else {
+                tapSamples[tapEvent->tap] = tapEvent->len;
+            }
+            tapEvents.pop(tapEvent);
+        }
+        outputs[CLOCK_OUT].setChannels(tapChannels);
+        outputs[CLOCK_OUT].setVoltage((clockOutSamples > 0) * 10.0f, 0);
+        for(i = 1; i < tapChannels; i ++) {
+            outputs[CLOCK_OUT].setVoltage((tapSamples[i - 1] > 0) * 10.0f, i);
+            if(tapSamples[i - 1] > 0) {
+                tapSamples[i - 1] --;
+            }
+            else if(tapRestart[i - 1] > 0) {
+                tapSamples[i - 1] = tapRestart[i - 1];
+                tapRestart[i - 1] = 0;
+            }
+        }
+        outputs[RESET_OUT].setVoltage((resetOutSamples > 0) * 10.0f);
+        if(clockOutSamples > 0) {
+            clockOutSamples --;
+        }
+        if(resetOutSamples > 0) {
+            resetOutSamples --;
+        }
+
         // handle CV MIDI
         cvMidiIn->process();
         cvMidiOut->process();
@@ -223,10 +404,6 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
             // run the MIDI clock
             midiClock.timerTask();
 
-            // outputs
-            outputs[CLOCK_OUT].setVoltage((clockOutPulse.update() != 0) * 10.0f);
-            outputs[RESET_OUT].setVoltage((resetOutPulse.update() != 0) * 10.0f);
-
             // LEDs
             lights[CLOCK_IN_LED].setBrightness(clockInLedPulse.update() != 0);
             lights[RESET_IN_LED].setBrightness(resetInLedPulse.update() != 0);
@@ -235,6 +412,22 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
             lights[MIDI_IN_LED].setBrightness(cvMidiIn->getLedState());
             lights[MIDI_OUT_LED].setBrightness(cvMidiOut->getLedState());
 
+            // vMIDI output settings
+            cvMidiOut->setBurstMode((int)params[VMIDI_BURST].getValue());
+            cvMidiOut->setCoalesceMode((int)params[VMIDI_COALESCE].getValue());
+            cvMidiOut->setExpanderSend((int)params[VMIDI_EXPANDER].getValue());
+
+            // clock tap settings
+            updateTaps();
+
+            // shared transport
+            updateTransport();
+
+            // external sync settings
+            if((int)params[SYNC_BANDWIDTH].getValue() != midiClock.getLoopBandwidth()) {
+                midiClock.setLoopBandwidth((int)params[SYNC_BANDWIDTH].getValue());
+            }
+
             // update source param
             if((int)params[CLOCK_SOURCE].getValue() != midiClock.getSource()) {
                 params[CLOCK_SOURCE].setValue(midiClock.getSource());
@@ -242,9 +435,25 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
         }
 	}
 
+    // save custom JSON in patch
+    json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+        // vMIDI stats for finding bottlenecks
+        if((int)params[VMIDI_STATS_JSON].getValue()) {
+            CVMidi::statsListToJson(rootJ, statsPorts);
+        }
+		return rootJ;
+	}
+
     // samplerate changed
     void onSampleRateChange(void) override {
-        taskTimer.setDivision((int)(APP->engine->getSampleRate() / RT_TASK_RATE));
+        float sampleRate = APP->engine->getSampleRate();
+        taskTimer.setDivision((int)(sampleRate / RT_TASK_RATE));
+        // the task doesn't always divide the sample rate evenly - i.e. 44 samples at 44.1kHz
+        midiClock.setTaskInterval((double)taskTimer.getDivision() * 1000000.0 / (double)sampleRate);
+        samplesPerUs = sampleRate / 1000000.0f;
+        gridStartFrame = -1;
+        flushClockEvents();
     }
 
     // module initialize
@@ -253,6 +462,7 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
         midiClock.setTempo(params[TEMPO].getValue());
         outputDiv = 1;
         outputDivCount = 0;
+        flushClockEvents();
     }
 
     // module added (post initialize)
@@ -290,6 +500,194 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
         }
     }
 
+    // update the clock tap settings
+    void updateTaps(void) {
+        int i, rate;
+        tapChannels = 1;
+        for(i = 0; i < MidiClockTaps::MAX_TAPS; i ++) {
+            rate = putils::clamp((int)params[TAP_RATE + i].getValue(), 0, MIDI_CLOCK_NUM_TAP_RATES - 1);
+            clockTaps.setTap(i, tapRates[rate].num, tapRates[rate].den,
+                params[TAP_SWING + i].getValue(), params[TAP_PHASE + i].getValue());
+            if(clockTaps.isTapEnabled(i)) {
+                tapChannels = i + 2;
+            }
+        }
+    }
+
+    // claim or release the shared transport bus
+    void updateTransport(void) {
+        int bus = (int)params[TRANSPORT_BUS].getValue() - 1;
+        if(bus != transportBus) {
+            if(transport != NULL) {
+                transport->release(this);
+                transport = NULL;
+            }
+            transportBus = bus;
+        }
+        // keep trying in case another clock gives up the bus
+        if(transport == NULL && transportBus != -1) {
+            transport = MidiClockTransport::getBus(transportBus);
+            if(transport != NULL && transport->claim(this) == -1) {
+                transport = NULL;
+            }
+            else if(transport != NULL) {
+                transport->publish(transportState);
+            }
+        }
+    }
+
+    // update the shared transport for an event that is going out now
+    void publishTransport(ClockEvent *event) {
+        float samplesPerTick;
+        if(transport == NULL) {
+            return;
+        }
+        transportState.running = event->running;
+        switch(event->bytes[0]) {
+            case MIDI_TIMING_TICK:
+                samplesPerTick = (float)midiClock.getUsPerTick() * samplesPerUs;
+                transportState.tickPos = event->tickPos + 1;
+                transportState.tickFrame = curFrame;
+                transportState.nextTickFrame = curFrame + (int64_t)(samplesPerTick + 0.5f);
+                transportState.tempo = midiClock.getTempo();
+                break;
+            case MIDI_SONG_POSITION:  // sent on every position reset
+                transportState.tickPos = 0;
+                transportState.resetCount ++;
+                break;
+        }
+        transport->publish(transportState);
+    }
+
+    // get the frame that the tick being issued by the PLL will go out on
+    int64_t getTickDue(void) {
+        return curFrame + 1 +
+            (int64_t)(midiClock.getTickOffset() * (float)taskTimer.getDivision());
+    }
+
+    // queue the clock tap pulses that fall within the tick being issued
+    void queueTapPulses(uint32_t tickCount) {
+        TapEvent event;
+        int i, count;
+        int64_t tickDue = getTickDue();
+        float samplesPerTick = (float)midiClock.getUsPerTick() * samplesPerUs;
+        count = clockTaps.processTick(tickCount, tapPulses);
+        for(i = 0; i < count; i ++) {
+            event.due = tickDue + (int64_t)(tapPulses[i].offset * samplesPerTick);
+            if(event.due < lastTapDue) {
+                event.due = lastTapDue;
+            }
+            lastTapDue = event.due;
+            event.tap = tapPulses[i].tap;
+            // keep fast taps from running together - swing shortens the gap
+            // after odd pulses so use half of the shortest gap
+            event.len = std::min(OUT_PULSE_LEN * (int)taskTimer.getDivision(),
+                (int)(tapPulses[i].minGap * samplesPerTick * 0.5f));
+            if(event.len < 1) {
+                event.len = 1;
+            }
+            if(tapEvents.push(event) == -1) {
+                eventDropCount ++;
+            }
+        }
+    }
+
+    // queue a clock event for the tick that is being issued by the PLL
+    void queueClockEvent(int type, const midi::Message *msg) {
+        ClockEvent event;
+        int i;
+        event.due = getTickDue();
+        if(event.due < lastEventDue) {
+            event.due = lastEventDue;
+        }
+        lastEventDue = event.due;
+        event.type = type;
+        event.len = 0;
+        event.tickPos = midiClock.getTickPos();
+        event.running = midiClock.getRunState();
+        if(msg != NULL) {
+            event.len = msg->getSize();
+            for(i = 0; i < event.len && i < 3; i ++) {
+                event.bytes[i] = msg->bytes[i];
+            }
+        }
+        if(clockEvents.push(event) == -1) {
+            eventDropCount ++;
+        }
+    }
+
+    // drop queued clock events and end any pulses in progress
+    // - queued events were timed for the old division or position
+    void flushClockEvents(void) {
+        int i;
+        clockEvents.clear();
+        tapEvents.clear();
+        lastEventDue = 0;
+        lastTapDue = 0;
+        clockOutSamples = 0;
+        resetOutSamples = 0;
+        for(i = 0; i < MidiClockTaps::MAX_TAPS; i ++) {
+            tapSamples[i] = 0;
+            tapRestart[i] = 0;
+        }
+    }
+
+    // fire a clock event on the current sample
+    void fireClockEvent(ClockEvent *event, float sampleTime) {
+        midi::Message msg;
+        int i;
+        switch(event->type) {
+            case EVENT_MIDI:
+                msg.setSize(event->len);
+                for(i = 0; i < event->len; i ++) {
+                    msg.bytes[i] = event->bytes[i];
+                }
+                cvMidiOut->sendOutputMessage(msg);
+                publishTransport(event);
+                if(event->len == 1 && event->bytes[0] == MIDI_TIMING_TICK) {
+                    measureTick(sampleTime);
+                }
+                break;
+            case EVENT_CLOCK_PULSE:
+                clockOutSamples = OUT_PULSE_LEN * taskTimer.getDivision();
+                break;
+            case EVENT_RESET_PULSE:
+                resetOutSamples = OUT_PULSE_LEN * taskTimer.getDivision();
+                break;
+        }
+    }
+
+    // measure the tick going out now against an ideal grid at the internal tempo
+    // - the grid starts on the first tick and restarts when the tempo changes
+    // - external sync is measured against the sender by the sync stats and sim harness
+    void measureTick(float sampleTime) {
+        float tempo = midiClock.getTempo();
+        double samplesPerTick;
+        if(midiClock.getSource() != MidiClockPll::SOURCE_INTERNAL) {
+            gridStartFrame = -1;
+            return;
+        }
+        if(gridStartFrame == -1 || tempo != gridTempo) {
+            gridStartFrame = curFrame;
+            gridTicks = 0;
+            gridTempo = tempo;
+            return;
+        }
+        gridTicks ++;
+        samplesPerTick = 60.0 / ((double)gridTempo * (double)MIDI_NATIVE_PPQ * (double)sampleTime);
+        tickPhase.add((int64_t)(((double)(curFrame - gridStartFrame) -
+            ((double)gridTicks * samplesPerTick)) * (double)sampleTime * 1000000.0));
+        publishTickPhase();
+    }
+
+    // copy the tick phase stats for the UI
+    void publishTickPhase(void) {
+        tickPhaseCount = tickPhase.count;
+        tickPhaseMin = tickPhase.min;
+        tickPhaseMax = tickPhase.max;
+        tickPhaseSum = tickPhase.sum;
+    }
+
     // update stored tempo
     void updateTempoParam(void) {
         if(midiClock.getSource() == MidiClockPll::SOURCE_INTERNAL) {
@@ -326,7 +724,7 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
         else {
             msg.bytes[0] = MIDI_CLOCK_STOP;
         }
-        cvMidiOut->sendOutputMessage(msg);
+        queueClockEvent(EVENT_MIDI, &msg);
     }
 
     // tap tempo locked
@@ -340,12 +738,13 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
         // MIDI out
         msg.setSize(1);
         msg.bytes[0] = MIDI_TIMING_TICK;
-        cvMidiOut->sendOutputMessage(msg);
+        queueClockEvent(EVENT_MIDI, &msg);
 
         // clock out
         if(midiClock.getRunState()) {
+            queueTapPulses(tickCount);
             if(outputDivCount == 0) {
-                clockOutPulse.timeout = OUT_PULSE_LEN;
+                queueClockEvent(EVENT_CLOCK_PULSE, NULL);
                 clockOutLedPulse.timeout = LED_PULSE_LEN;
             }
             outputDivCount ++;
@@ -358,22 +757,23 @@ struct MIDI_Clock : Module, MidiClockPllHandler {
     // clock position was reset
     void midiClockPositionReset(void) override {
         midi::Message msg;
-        resetOutPulse.timeout = OUT_PULSE_LEN;
+        queueClockEvent(EVENT_RESET_PULSE, NULL);
         resetOutLedPulse.timeout = LED_PULSE_LEN;
         outputDivCount = 0;
+        clockTaps.reset();
 
         // if we are running send the reset right away
         if(midiClock.getRunState()) {
             msg.setSize(1);
             msg.bytes[0] = MIDI_CLOCK_START;
-            cvMidiOut->sendOutputMessage(msg);
+            queueClockEvent(EVENT_MIDI, &msg);
         }
         // send song position pointer
         msg.setSize(3);
         msg.bytes[0] = MIDI_SONG_POSITION;
         msg.bytes[1] = 0;
         msg.bytes[2] = 0;
-        cvMidiOut->sendOutputMessage(msg);
+        queueClockEvent(EVENT_MIDI, &msg);
     }
 
     // external sync state changed
@@ -701,6 +1101,158 @@ struct MIDIClockRunModeMenuItem : MenuItem {
     }
 };
 
+// set up a clock tap
+struct MIDIClockTapMenuItem : MenuItem {
+    MIDI_Clock *module;
+    int tap;
+
+    MIDIClockTapMenuItem(Module *module, int tap) {
+        int rate;
+        this->module = dynamic_cast<MIDI_Clock*>(module);
+        this->tap = tap;
+        rate = putils::clamp((int)this->module->params[MIDI_Clock::TAP_RATE + tap].getValue(),
+            0, MIDI_CLOCK_NUM_TAP_RATES - 1);
+        this->text = "Tap " + std::to_string(tap + 1) + " - Channel " + std::to_string(tap + 2);
+        this->rightText = std::string(tapRates[rate].name) + " " + RIGHT_ARROW;
+    }
+
+    // create the tap submenu
+    Menu *createChildMenu(void) override {
+        Menu *menu = new Menu;
+        int i;
+        Param *rate = &module->params[MIDI_Clock::TAP_RATE + tap];
+        Param *swing = &module->params[MIDI_Clock::TAP_SWING + tap];
+        Param *phase = &module->params[MIDI_Clock::TAP_PHASE + tap];
+        const float swings[] = {0.5f, 0.54f, 0.58f, 0.62f, 0.66f, 0.7f, 0.75f};
+        menuHelperAddLabel(menu, "Rate");
+        for(i = 0; i < MIDI_CLOCK_NUM_TAP_RATES; i ++) {
+            menuHelperAddItem(menu, new MenuHelperParamValueItem(tapRates[i].name, rate, (float)i));
+        }
+        menuHelperAddSpacer(menu);
+        menuHelperAddLabel(menu, "Swing");
+        for(i = 0; i < (int)(sizeof(swings) / sizeof(float)); i ++) {
+            menuHelperAddItem(menu, new MenuHelperParamValueItem(
+                putils::format("%.0f%%", swings[i] * 100.0f), swing, swings[i]));
+        }
+        menuHelperAddSpacer(menu);
+        menuHelperAddLabel(menu, "Phase");
+        for(i = 0; i < 8; i ++) {
+            menuHelperAddItem(menu, new MenuHelperParamValueItem(
+                putils::format("%.1f%%", (float)i * 12.5f), phase, (float)i * 0.125f));
+        }
+        return menu;
+    }
+};
+
+// handle choosing the shared transport bus
+struct MIDIClockTransportMenuItem : MenuItem {
+    MIDI_Clock *module;
+    int bus;
+
+    MIDIClockTransportMenuItem(Module *module, int bus) {
+        MidiClockTransport *transport;
+        this->module = dynamic_cast<MIDI_Clock*>(module);
+        this->bus = bus;
+        if(bus == 0) {
+            this->text = "Off";
+        }
+        else {
+            this->text = "Bus " + std::to_string(bus);
+            transport = MidiClockTransport::getBus(bus - 1);
+            if(transport != NULL && transport->isClaimedByOther(this->module)) {
+                this->text += " (in use)";
+            }
+        }
+        this->rightText = CHECKMARK((int)this->module->params[MIDI_Clock::TRANSPORT_BUS].getValue() == bus);
+    }
+
+    // the menu item was selected
+    void onAction(const event::Action &e) override {
+        this->module->params[MIDI_Clock::TRANSPORT_BUS].setValue(bus);
+    }
+};
+
+// handle choosing the external sync bandwidth
+struct MIDIClockSyncBandwidthMenuItem : MenuItem {
+    MIDI_Clock *module;
+    int bandwidth;
+
+    MIDIClockSyncBandwidthMenuItem(Module *module, int bandwidth, std::string name) {
+        this->module = dynamic_cast<MIDI_Clock*>(module);
+        this->bandwidth = bandwidth;
+        this->text = name;
+        this->rightText = CHECKMARK((int)this->module->params[MIDI_Clock::SYNC_BANDWIDTH].getValue() == bandwidth);
+    }
+
+    // the menu item was selected
+    void onAction(const event::Action &e) override {
+        this->module->params[MIDI_Clock::SYNC_BANDWIDTH].setValue(bandwidth);
+    }
+};
+
+// show the external sync loop stats
+struct MIDIClockSyncStatsMenuItem : MenuItem {
+    MIDI_Clock *module;
+
+    MIDIClockSyncStatsMenuItem(Module *module) {
+        this->module = dynamic_cast<MIDI_Clock*>(module);
+        this->text = "Sync Stats";
+        this->rightText = RIGHT_ARROW;
+    }
+
+    // create the stats submenu
+    Menu *createChildMenu(void) override {
+        Menu *menu = new Menu;
+        MidiClockPllStats stats;
+        module->midiClock.getExtSyncStats(&stats);
+        menu->addChild(createMenuLabel(putils::format("Locked: %s",
+            stats.locked ? "yes" : "no")));
+        menu->addChild(createMenuLabel(putils::format("Lock Time (ms): %.0f", stats.lockTime)));
+        menu->addChild(createMenuLabel(putils::format("Phase Error (us): %.0f - RMS: %.0f",
+            stats.phaseError, stats.phaseJitter)));
+        menu->addChild(createMenuLabel(putils::format("Input Jitter (us): %.0f", stats.inputJitter)));
+        menu->addChild(createMenuLabel(putils::format("Tempo Relocks: %u", stats.relockCount)));
+        menu->addChild(createMenuLabel(putils::format("Lost Ticks: %u", stats.lostTicks)));
+        return menu;
+    }
+};
+
+// show the clock output timing stats
+struct MIDIClockJitterMenuItem : MenuItem {
+    MIDI_Clock *module;
+
+    MIDIClockJitterMenuItem(Module *module) {
+        this->module = dynamic_cast<MIDI_Clock*>(module);
+        this->text = "Clock Out Timing";
+        this->rightText = RIGHT_ARROW;
+    }
+
+    // create the stats submenu
+    Menu *createChildMenu(void) override {
+        Menu *menu = new Menu;
+        uint32_t count = module->tickPhaseCount;
+        int64_t min = module->tickPhaseMin;
+        int64_t max = module->tickPhaseMax;
+        int64_t sum = module->tickPhaseSum;
+        if(module->midiClock.getSource() == MidiClockPll::SOURCE_INTERNAL) {
+            menu->addChild(createMenuLabel("Phase vs. Ideal Grid at the Set Tempo"));
+        }
+        else {
+            menu->addChild(createMenuLabel("Internal Clock Only - See Sync Stats"));
+        }
+        menu->addChild(createMenuLabel(putils::format("Ticks: %u", count)));
+        menu->addChild(createMenuLabel(putils::format("Error (us): min: %lld - avg: %.1f - max: %lld",
+            (long long)min, count ? ((double)sum / (double)count) : 0.0, (long long)max)));
+        menu->addChild(createMenuLabel(putils::format("Jitter (us): %lld",
+            (long long)(max - min))));
+        menu->addChild(createMenuLabel(putils::format("Dropped Events: %u", module->eventDropCount)));
+        menu->addChild(createMenuItem("Reset Stats", "", [=]() {
+            module->tickPhaseReset = 1;
+        }));
+        return menu;
+    }
+};
+
 struct MIDI_ClockWidget : ModuleWidget {
 	MIDI_ClockWidget(MIDI_Clock* module) {
 		setModule(module);
@@ -739,6 +1291,7 @@ struct MIDI_ClockWidget : ModuleWidget {
 
     // add menu items
     void appendContextMenu(Menu *menu) override {
+        int i;
         MIDI_Clock *module = dynamic_cast<MIDI_Clock*>(this->module);
         if(!module) {
             return;
@@ -750,6 +1303,39 @@ struct MIDI_ClockWidget : ModuleWidget {
         menuHelperAddItem(menu, new MIDIClockRunModeMenuItem(module, MIDI_Clock::RUNSTOP_MOMENTARY, "Momentary"));
         menuHelperAddItem(menu, new MIDIClockRunModeMenuItem(module, MIDI_Clock::RUNSTOP_RUN, "Run"));
         menuHelperAddItem(menu, new MIDIClockRunModeMenuItem(module, MIDI_Clock::RUNSTOP_TOGGLE, "Toggle"));
+
+        // clock taps
+        menuHelperAddSpacer(menu);
+        menuHelperAddLabel(menu, "Clock Out Taps");
+        for(i = 0; i < MidiClockTaps::MAX_TAPS; i ++) {
+            menuHelperAddItem(menu, new MIDIClockTapMenuItem(module, i));
+        }
+
+        // shared transport
+        menuHelperAddSpacer(menu);
+        menuHelperAddLabel(menu, "Shared Transport");
+        for(i = 0; i <= MidiClockTransport::NUM_BUSES; i ++) {
+            menuHelperAddItem(menu, new MIDIClockTransportMenuItem(module, i));
+        }
+
+        // external sync
+        menuHelperAddSpacer(menu);
+        menuHelperAddLabel(menu, "External Sync Bandwidth");
+        menuHelperAddItem(menu, new MIDIClockSyncBandwidthMenuItem(module,
+            MidiClockPll::LOOP_BW_LOW, "Low - Best Jitter Rejection"));
+        menuHelperAddItem(menu, new MIDIClockSyncBandwidthMenuItem(module,
+            MidiClockPll::LOOP_BW_MEDIUM, "Medium"));
+        menuHelperAddItem(menu, new MIDIClockSyncBandwidthMenuItem(module,
+            MidiClockPll::LOOP_BW_HIGH, "High - Fastest Tracking"));
+        menuHelperAddItem(menu, new MIDIClockSyncStatsMenuItem(module));
+
+        // vMIDI settings
+        menuHelperAddVmidiOutputs(menu, &module->params[MIDI_Clock::VMIDI_BURST],
+            &module->params[MIDI_Clock::VMIDI_COALESCE], &module->params[MIDI_Clock::VMIDI_EXPANDER]);
+
+        // vMIDI stats
+        menuHelperAddVmidiStats(menu, module->statsPorts, &module->params[MIDI_Clock::VMIDI_STATS_JSON]);
+        menuHelperAddItem(menu, new MIDIClockJitterMenuItem(module));
     }
 };
 
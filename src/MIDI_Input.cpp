@@ -23,12 +23,21 @@
 #include "plugin.hpp"
 #include "utils/CVMidi.h"
 #include "utils/KAComponents.h"
+#include "utils/MenuHelper.h"
 #include "utils/MidiHelper.h"
+#ifdef KA_MIDI_LOOPBACK
+#include "utils/MidiLoopback.h"
+#endif
 #include "utils/PUtils.h"
 #include "utils/VUtils.h"
 
 struct MIDI_Input : Module, KilpatrickLabelHandler {
 	enum ParamIds {
+        VMIDI_BURST,  // vMIDI output burst mode - 0 = off, 1 = on
+        VMIDI_EXPANDER,  // send vMIDI to the module on the right - 0 = off, 1 = on
+        VMIDI_COALESCE,  // vMIDI output controller coalescing - 0 = off, 1 = on
+        VMIDI_STATS_JSON,  // save vMIDI stats in the patch - 0 = off, 1 = on
+        MIDI_JITTER,  // measure hardware input jitter - 0 = off, 1 = on
 		NUM_PARAMS
 	};
 	enum InputIds {
@@ -49,21 +58,34 @@ struct MIDI_Input : Module, KilpatrickLabelHandler {
 
     #define NUM_OUTPUTS 3
     dsp::ClockDivider taskTimer;
+    std::vector<CVMidi *> statsPorts;  // vMIDI ports shown in the stats
     CVMidi *cvMidiOuts[NUM_OUTPUTS];
     MidiHelper *midi;
+    midi::Message inMsg;  // reserved up front so receiving a dump never allocates
 
     // constructor
 	MIDI_Input() {
         int port;
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
+        configParam(VMIDI_BURST, 0.0f, 1.0f, 0.0f, "VMIDI BURST");
+        configParam(VMIDI_EXPANDER, 0.0f, 1.0f, 0.0f, "VMIDI EXPANDER");
+        configParam(VMIDI_COALESCE, 0.0f, 1.0f, 0.0f, "VMIDI COALESCE");
+        configParam(VMIDI_STATS_JSON, 0.0f, 1.0f, 0.0f, "VMIDI STATS JSON");
+        configParam(MIDI_JITTER, 0.0f, 1.0f, 0.0f, "MIDI JITTER");
         configOutput(MIDI_OUT1, "CHN OUT");
         configOutput(MIDI_OUT2, "SYS OUT");
         configOutput(MIDI_OUT3, "ALL OUT");
         for(port = 0; port < NUM_OUTPUTS; port ++) {
             cvMidiOuts[port] = new CVMidi(&outputs[MIDI_OUT1 + port], 0);
         }
+        cvMidiOuts[MIDI_OUT3]->setExpanderModule(this);  // can send to the module on the right
         midi = new MidiHelper(1, 0, 1);
+        inMsg.bytes.reserve(MidiSysexPool::BUF_LEN);
         midi->setCombinedInOutMode(0);
+        cvMidiOuts[MIDI_OUT1]->setName("CHN OUT");
+        cvMidiOuts[MIDI_OUT2]->setName("SYS OUT");
+        cvMidiOuts[MIDI_OUT3]->setName("ALL OUT");
+        statsPorts = {cvMidiOuts[MIDI_OUT1], cvMidiOuts[MIDI_OUT2], cvMidiOuts[MIDI_OUT3]};
         onReset();
         onSampleRateChange();
 	}
@@ -79,8 +101,26 @@ struct MIDI_Input : Module, KilpatrickLabelHandler {
 
     // process a sample
 	void process(const ProcessArgs& args) override {
-        midi::Message msg;
-        int port;
+        midi::Message& msg = inMsg;
+        int port, sysex;
+
+        // get incoming MIDI - each message is handled on the frame it was stamped with
+        if(midi->isAssigned(1, 0)) {
+            while(midi->getInputMessage(0, &msg, args.frame)) {
+                if(MidiHelper::isChannelMessage(msg)) {
+                    cvMidiOuts[MIDI_OUT1]->sendOutputMessage(msg);
+                    cvMidiOuts[MIDI_OUT3]->sendOutputMessage(msg);
+                }
+                // SYSEX dumps arrive whole and are split up by CVMidi
+                sysex = MidiHelper::isSysexMessage(msg);
+                if(MidiHelper::isSystemCommonMessage(msg) ||
+                        MidiHelper::isSystemRealtimeMessage(msg) ||
+                        sysex == 1 || sysex == 4) {
+                    cvMidiOuts[MIDI_OUT2]->sendOutputMessage(msg);
+                    cvMidiOuts[MIDI_OUT3]->sendOutputMessage(msg);
+                }
+            }
+        }
 
         // handle CV MIDI
         for(port = 0; port < NUM_OUTPUTS; port ++) {
@@ -89,22 +129,12 @@ struct MIDI_Input : Module, KilpatrickLabelHandler {
 
         // run tasks
         if(taskTimer.process()) {
-            // get incoming MIDI
-            if(midi->isAssigned(1, 0)) {
-                while(midi->getInputMessage(0, &msg)) {
-                    if(MidiHelper::isChannelMessage(msg)) {
-                        cvMidiOuts[MIDI_OUT1]->sendOutputMessage(msg);
-                        cvMidiOuts[MIDI_OUT3]->sendOutputMessage(msg);
-                    }
-                    if(MidiHelper::isSystemCommonMessage(msg) ||
-                            MidiHelper::isSystemRealtimeMessage(msg)) {
-                        cvMidiOuts[MIDI_OUT2]->sendOutputMessage(msg);
-                        cvMidiOuts[MIDI_OUT3]->sendOutputMessage(msg);
-                    }
-                }
-            }
+            midi->setJitterMode((int)params[MIDI_JITTER].getValue());
             // handle outputs
             for(port = 0; port < NUM_OUTPUTS; port ++) {
+                cvMidiOuts[port]->setBurstMode((int)params[VMIDI_BURST].getValue());
+                cvMidiOuts[port]->setCoalesceMode((int)params[VMIDI_COALESCE].getValue());
+                cvMidiOuts[port]->setExpanderSend((int)params[VMIDI_EXPANDER].getValue());
                 lights[MIDI_OUT1_LED + port].setBrightness(cvMidiOuts[port]->getLedState());
             }
         }
@@ -129,6 +159,10 @@ struct MIDI_Input : Module, KilpatrickLabelHandler {
     json_t* dataToJson() override {
 		json_t* rootJ = json_object();
         midi->dataToJson(rootJ);  // add MIDI settings
+        // vMIDI stats for finding bottlenecks
+        if((int)params[VMIDI_STATS_JSON].getValue()) {
+            CVMidi::statsListToJson(rootJ, statsPorts);
+        }
 		return rootJ;
 	}
 
@@ -178,6 +212,12 @@ struct MIDI_InputWidget : ModuleWidget {
         addChild(l);
 	}
 
+    // scan for MIDI devices on the UI thread
+    void step(void) override {
+        MidiDeviceTable::step();
+        ModuleWidget::step();
+    }
+
     // add menu items
     void appendContextMenu(Menu *menu) override {
         MIDI_Input *module = dynamic_cast<MIDI_Input*>(this->module);
@@ -188,6 +228,28 @@ struct MIDI_InputWidget : ModuleWidget {
         // MIDI settings
         module->midi->populateDriverMenu(menu, "MIDI Input Device");
         module->midi->populateInputMenu(menu, "", 0);
+
+        // MIDI input timing
+        menuHelperAddSpacer(menu);
+        menuHelperAddLabel(menu, "MIDI Input Timing");
+        menuHelperAddItem(menu, new MenuHelperParamToggleItem("Measure Input Jitter",
+            &module->params[MIDI_Input::MIDI_JITTER]));
+        if(module->params[MIDI_Input::MIDI_JITTER].getValue() > 0.5f) {
+            menuHelperAddItem(menu, new MidiHelperJitterStatsMenuItem(module->midi, 0));
+        }
+
+        // vMIDI settings
+        menuHelperAddVmidiOutputs(menu, &module->params[MIDI_Input::VMIDI_BURST],
+            &module->params[MIDI_Input::VMIDI_COALESCE], &module->params[MIDI_Input::VMIDI_EXPANDER]);
+
+        // vMIDI stats
+        menuHelperAddVmidiStats(menu, module->statsPorts, &module->params[MIDI_Input::VMIDI_STATS_JSON]);
+
+#ifdef KA_MIDI_LOOPBACK
+        // loopback driver test controls
+        menuHelperAddSpacer(menu);
+        menuHelperAddItem(menu, new MidiLoopbackMenuItem());
+#endif
     }
 };
 
@@ -23,6 +23,7 @@
 #include "plugin.hpp"
 #include "utils/CVMidi.h"
 #include "utils/KAComponents.h"
+#include "utils/MenuHelper.h"
 #include "utils/MidiHelper.h"
 #include "utils/MidiCCMem.h"
 #include "utils/PUtils.h"
@@ -41,6 +42,10 @@ struct MIDI_Mapper : Module, KilpatrickLabelHandler {
         MAP_CC_OUT4,
         MAP_CC_OUT5,
         MAP_CC_OUT6,
+        VMIDI_BURST,  // vMIDI output burst mode - 0 = off, 1 = on
+        VMIDI_EXPANDER,  // send vMIDI to the module on the right - 0 = off, 1 = on
+        VMIDI_COALESCE,  // vMIDI output controller coalescing - 0 = off, 1 = on
+        VMIDI_STATS_JSON,  // save vMIDI stats in the patch - 0 = off, 1 = on
 		NUM_PARAMS
 	};
 	enum InputIds {
@@ -61,6 +66,7 @@ struct MIDI_Mapper : Module, KilpatrickLabelHandler {
     #define NUM_MAP_CHANS 6
     #define UNMAP -1.0f
     dsp::ClockDivider taskTimer;
+    std::vector<CVMidi *> statsPorts;  // vMIDI ports shown in the stats
     CVMidi *cvMidiIn;
     CVMidi *cvMidiOut;
     MidiCCMem ccMem;
@@ -75,6 +81,8 @@ struct MIDI_Mapper : Module, KilpatrickLabelHandler {
     };
     int mapMode;
     int mapTimeout;
+    int idle;  // 1 = processing is skipped until a cable is connected
+    uint32_t idleTasks;  // number of task runs skipped while idle
 
     // constructor
 	MIDI_Mapper() {
@@ -91,11 +99,20 @@ struct MIDI_Mapper : Module, KilpatrickLabelHandler {
         configParam(MAP_CC_OUT4, 0.0f, 255.0f, 0.0f, "CC_OUT4");
         configParam(MAP_CC_OUT5, 0.0f, 255.0f, 0.0f, "CC_OUT5");
         configParam(MAP_CC_OUT6, 0.0f, 255.0f, 0.0f, "CC_OUT6");
+        configParam(VMIDI_BURST, 0.0f, 1.0f, 0.0f, "VMIDI BURST");
+        configParam(VMIDI_EXPANDER, 0.0f, 1.0f, 0.0f, "VMIDI EXPANDER");
+        configParam(VMIDI_COALESCE, 0.0f, 1.0f, 0.0f, "VMIDI COALESCE");
+        configParam(VMIDI_STATS_JSON, 0.0f, 1.0f, 0.0f, "VMIDI STATS JSON");
         configInput(MIDI_IN, "MIDI IN");
         configOutput(MIDI_OUT, "MIDI OUT");
         cvMidiIn = new CVMidi(&inputs[MIDI_IN], 1);
+        cvMidiIn->setExpanderModule(this);  // receive from the module on the left
         cvMidiOut = new CVMidi(&outputs[MIDI_OUT], 0);
+        cvMidiOut->setExpanderModule(this);  // can send to the module on the right
         ccMem.setTimeout(RT_TASK_RATE * 2);  // 2 seconds
+        cvMidiIn->setName("MIDI IN");
+        cvMidiOut->setName("MIDI OUT");
+        statsPorts = {cvMidiIn, cvMidiOut};
         onReset();
         onSampleRateChange();
 	}
@@ -111,34 +128,57 @@ struct MIDI_Mapper : Module, KilpatrickLabelHandler {
         int i;
         midi::Message msg;
 
+        // skip everything while no cables are connected and all ports are idle
+        // - the task timer keeps counting so timeouts still run while idle
+        if(idle && isIdle()) {
+            if(taskTimer.process()) {
+                idleTasks ++;
+            }
+            return;
+        }
+        if(idle) {
+            ccMem.advance(idleTasks);
+        }
+        idle = 0;
+        idleTasks = 0;
+
         // handle CV MIDI
         cvMidiIn->process();
-        cvMidiOut->process();
 
-        // run tasks
-        if(taskTimer.process()) {
-            while(cvMidiIn->getInputMessage(&msg)) {
-                // handle CC messages
-                if(MidiHelper::isControlChangeMessage(msg)) {
-                    // filter repeated messages from mapping
-                    if(ccMem.handleCC(msg) == 0) {
-                        // learn maping
-                        if(mapMode != MAP_DISABLE) {
-                            setMap(mapMode, msg.bytes[1], msg.bytes[1]);
-                            mapTimeout = 0;
-                            mapMode = MAP_DISABLE;
-                        }
+        // process MIDI every sample so messages go out in the sample they arrive
+        while(cvMidiIn->getInputMessage(&msg)) {
+            // handle CC messages
+            if(MidiHelper::isControlChangeMessage(msg)) {
+                // filter repeated messages from mapping
+                if(ccMem.handleCC(msg) == 0) {
+                    // learn maping
+                    if(mapMode != MAP_DISABLE) {
+                        setMap(mapMode, msg.bytes[1], msg.bytes[1]);
+                        mapTimeout = 0;
+                        mapMode = MAP_DISABLE;
                     }
-                    // process maps
-                    for(i = 0; i < NUM_MAP_CHANS; i ++) {
-                        if(msg.bytes[1] == (int)params[MAP_CC_IN1 + i].getValue()) {
-                            msg.bytes[1] = (int)params[MAP_CC_OUT1 + i].getValue();
-                            break;
-                        }
+                }
+                // process maps
+                for(i = 0; i < NUM_MAP_CHANS; i ++) {
+                    if(msg.bytes[1] == (int)params[MAP_CC_IN1 + i].getValue()) {
+                        msg.bytes[1] = (int)params[MAP_CC_OUT1 + i].getValue();
+                        break;
                     }
                 }
-                cvMidiOut->sendOutputMessage(msg);
             }
+            cvMidiOut->sendOutputMessage(msg);
+        }
+
+        cvMidiOut->process();
+
+        // run tasks
+        if(taskTimer.process()) {
+            ccMem.process();
+
+            // vMIDI output settings
+            cvMidiOut->setBurstMode((int)params[VMIDI_BURST].getValue());
+            cvMidiOut->setCoalesceMode((int)params[VMIDI_COALESCE].getValue());
+            cvMidiOut->setExpanderSend((int)params[VMIDI_EXPANDER].getValue());
 
             // MIDI LEDs
             lights[MIDI_IN_LED].setBrightness(cvMidiIn->getLedState());
@@ -151,7 +191,26 @@ struct MIDI_Mapper : Module, KilpatrickLabelHandler {
                     mapMode = MAP_DISABLE;
                 }
             }
+            idle = isIdle();
+        }
+	}
+
+    // check if all ports are idle and there is no work to do
+    int isIdle(void) {
+        if(mapMode != MAP_DISABLE) {
+            return 0;
+        }
+        return cvMidiIn->isIdle() && cvMidiOut->isIdle();
+    }
+
+    // save custom JSON in patch
+    json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+        // vMIDI stats for finding bottlenecks
+        if((int)params[VMIDI_STATS_JSON].getValue()) {
+            CVMidi::statsListToJson(rootJ, statsPorts);
         }
+		return rootJ;
 	}
 
     // samplerate changed
@@ -172,6 +231,8 @@ struct MIDI_Mapper : Module, KilpatrickLabelHandler {
         mapMode = MAP_DISABLE;
         mapTimeout = 0;
         ccMem.reset();
+        idle = 0;
+        idleTasks = 0;
     }
 
     // set a mapping - updates local map and params
@@ -317,6 +378,21 @@ struct MIDI_MapperWidget : ModuleWidget {
         addChild(createLightCentered<MediumLight<RedLight>>(mm2px(Vec(3.81, 102.15)), module, MIDI_Mapper::MIDI_OUT_LED));
 
 	}
+
+    // add menu items
+    void appendContextMenu(Menu *menu) override {
+        MIDI_Mapper *module = dynamic_cast<MIDI_Mapper*>(this->module);
+        if(!module) {
+            return;
+        }
+
+        // vMIDI settings
+        menuHelperAddVmidiOutputs(menu, &module->params[MIDI_Mapper::VMIDI_BURST],
+            &module->params[MIDI_Mapper::VMIDI_COALESCE], &module->params[MIDI_Mapper::VMIDI_EXPANDER]);
+
+        // vMIDI stats
+        menuHelperAddVmidiStats(menu, module->statsPorts, &module->params[MIDI_Mapper::VMIDI_STATS_JSON]);
+    }
 };
 
 Model* modelMIDI_Mapper = createModel<MIDI_Mapper, MIDI_MapperWidget>("MIDI_Mapper");
@@ -23,11 +23,16 @@
 #include "plugin.hpp"
 #include "utils/CVMidi.h"
 #include "utils/KAComponents.h"
+#include "utils/MenuHelper.h"
 #include "utils/MidiHelper.h"
 #include "utils/PUtils.h"
 
 struct MIDI_Merger : Module {
 	enum ParamIds {
+        VMIDI_BURST,  // vMIDI output burst mode - 0 = off, 1 = on
+        VMIDI_EXPANDER,  // send vMIDI to the module on the right - 0 = off, 1 = on
+        VMIDI_COALESCE,  // vMIDI output controller coalescing - 0 = off, 1 = on
+        VMIDI_STATS_JSON,  // save vMIDI stats in the patch - 0 = off, 1 = on
 		NUM_PARAMS
 	};
 	enum InputIds {
@@ -56,14 +61,32 @@ struct MIDI_Merger : Module {
 
     #define NUM_INPUTS 4
     #define NUM_OUTPUTS 3
+    #define SYSEX_TIMEOUT (RT_TASK_RATE / 2)  // give up on a stalled dump after 500ms
+    #define HOLD_LEN 256  // messages held per input while another input sends a dump
     dsp::ClockDivider taskTimer;
+    std::vector<CVMidi *> statsPorts;  // vMIDI ports shown in the stats
     CVMidi *cvMidiIns[NUM_INPUTS];
     CVMidi *cvMidiOuts[NUM_OUTPUTS];
+    int sysexOwner;  // input sending a SYSEX dump - -1 = none
+    int sysexTimeout;
+    // a short message held back until a dump on another input is done
+    struct HeldMessage {
+        uint8_t bytes[3];
+        int len;
+    };
+    HeldMessage held[NUM_INPUTS][HOLD_LEN];
+    int heldCount[NUM_INPUTS];
+    uint32_t heldDropCount;  // messages dropped because a hold buffer was full or they were SYSEX
+    int idle;  // 1 = processing is skipped until a cable is connected
 
     // constructor
 	MIDI_Merger() {
         int port;
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
+        configParam(VMIDI_BURST, 0.0f, 1.0f, 0.0f, "VMIDI BURST");
+        configParam(VMIDI_EXPANDER, 0.0f, 1.0f, 0.0f, "VMIDI EXPANDER");
+        configParam(VMIDI_COALESCE, 0.0f, 1.0f, 0.0f, "VMIDI COALESCE");
+        configParam(VMIDI_STATS_JSON, 0.0f, 1.0f, 0.0f, "VMIDI STATS JSON");
         configInput(MIDI_IN1, "MIDI IN1");
         configInput(MIDI_IN2, "MIDI IN2");
         configInput(MIDI_IN3, "MIDI IN3");
@@ -77,6 +100,18 @@ struct MIDI_Merger : Module {
         for(port = 0; port < NUM_OUTPUTS; port ++) {
             cvMidiOuts[port] = new CVMidi(&outputs[MIDI_OUT1 + port], 0);
         }
+        cvMidiOuts[MIDI_OUT3]->setExpanderModule(this);  // can send to the module on the right
+        cvMidiIns[0]->setExpanderModule(this);  // receive from the module on the left
+        for(port = 0; port < NUM_INPUTS; port ++) {
+            cvMidiIns[port]->setName(putils::format("MIDI IN%d", port + 1));
+            statsPorts.push_back(cvMidiIns[port]);
+        }
+        cvMidiOuts[MIDI_OUT1]->setName("CHN OUT");
+        cvMidiOuts[MIDI_OUT2]->setName("SYS OUT");
+        cvMidiOuts[MIDI_OUT3]->setName("ALL OUT");
+        for(port = 0; port < NUM_OUTPUTS; port ++) {
+            statsPorts.push_back(cvMidiOuts[port]);
+        }
         onReset();
         onSampleRateChange();
 	}
@@ -97,40 +132,160 @@ struct MIDI_Merger : Module {
         midi::Message msg;
         int port;
 
+        // skip everything while no cables are connected and all ports are idle
+        if(idle && isIdle()) {
+            return;
+        }
+        idle = 0;
+
         // handle CV MIDI
         for(port = 0; port < NUM_INPUTS; port ++) {
             cvMidiIns[port]->process();
         }
+
+        // process MIDI every sample so messages go out in the sample they arrive
+        for(port = 0; port < NUM_INPUTS; port ++) {
+            // send messages that were held during a dump on another input
+            if(sysexOwner == -1 && heldCount[port]) {
+                sendHeldMessages(port, &msg);
+            }
+            // input messages
+            while(cvMidiIns[port]->getInputMessage(&msg)) {
+                // another input is sending a SYSEX dump
+                // - realtime messages can go inside the dump
+                // - other messages are held until the dump is done
+                if(sysexOwner != -1 && sysexOwner != port &&
+                        !MidiHelper::isSystemRealtimeMessage(msg)) {
+                    holdMessage(port, msg);
+                    continue;
+                }
+                switch(MidiHelper::isSysexMessage(msg)) {
+                    case 1:  // start
+                        sysexOwner = port;
+                        sysexTimeout = SYSEX_TIMEOUT;
+                        break;
+                    case 2:  // continuation
+                        if(sysexOwner != port) {
+                            continue;  // not part of a dump - drop it
+                        }
+                        sysexTimeout = SYSEX_TIMEOUT;
+                        break;
+                    case 3:  // end
+                        if(sysexOwner != port) {
+                            continue;  // not part of a dump - drop it
+                        }
+                        sysexOwner = -1;
+                        break;
+                    case 4:  // complete dump - no need to hold the other inputs
+                        if(sysexOwner == port) {
+                            sysexOwner = -1;  // a new dump ends the old one
+                        }
+                        break;
+                    default:
+                        // a new status byte ends the dump
+                        if(sysexOwner == port &&
+                                !MidiHelper::isSystemRealtimeMessage(msg)) {
+                            sysexOwner = -1;
+                        }
+                        break;
+                }
+                sendMessage(msg);
+            }
+        }
+
         for(port = 0; port < NUM_OUTPUTS; port ++) {
             cvMidiOuts[port]->process();
         }
 
         // run tasks
         if(taskTimer.process()) {
-            // check inputs
-            for(port = 0; port < NUM_INPUTS; port ++) {
-                // input messages
-                while(cvMidiIns[port]->getInputMessage(&msg)) {
-                    if(MidiHelper::isChannelMessage(msg)) {
-                        cvMidiOuts[MIDI_OUT1]->sendOutputMessage(msg);
-                        cvMidiOuts[MIDI_OUT3]->sendOutputMessage(msg);
-                    }
-                    if(MidiHelper::isSystemCommonMessage(msg) ||
-                            MidiHelper::isSystemRealtimeMessage(msg)) {
-                        cvMidiOuts[MIDI_OUT2]->sendOutputMessage(msg);
-                        cvMidiOuts[MIDI_OUT3]->sendOutputMessage(msg);
-                    }
-                    // XXX handle SYSEX messages
+            // time out a SYSEX dump that stopped part way
+            if(sysexOwner != -1) {
+                sysexTimeout --;
+                if(sysexTimeout <= 0) {
+                    sysexOwner = -1;
                 }
-                // MIDI in LEDs
+            }
+
+            // MIDI in LEDs
+            for(port = 0; port < NUM_INPUTS; port ++) {
                 lights[MIDI_IN1_LED + port].setBrightness(cvMidiIns[port]->getLedState());
             }
 
             // handle outputs
             for(port = 0; port < NUM_OUTPUTS; port ++) {
+                cvMidiOuts[port]->setBurstMode((int)params[VMIDI_BURST].getValue());
+                cvMidiOuts[port]->setCoalesceMode((int)params[VMIDI_COALESCE].getValue());
+                cvMidiOuts[port]->setExpanderSend((int)params[VMIDI_EXPANDER].getValue());
                 lights[MIDI_OUT1_LED + port].setBrightness(cvMidiOuts[port]->getLedState());
             }
+            idle = isIdle();
+        }
+	}
+
+    // send a message to the outputs
+    void sendMessage(const midi::Message& msg) {
+        if(MidiHelper::isChannelMessage(msg)) {
+            cvMidiOuts[MIDI_OUT1]->sendOutputMessage(msg);
+            cvMidiOuts[MIDI_OUT3]->sendOutputMessage(msg);
+        }
+        else {
+            cvMidiOuts[MIDI_OUT2]->sendOutputMessage(msg);
+            cvMidiOuts[MIDI_OUT3]->sendOutputMessage(msg);
+        }
+    }
+
+    // hold a message from an input while another input is sending a dump
+    // - SYSEX from the held input can't be merged into the dump so it is dropped
+    void holdMessage(int port, const midi::Message& msg) {
+        if(MidiHelper::isSysexMessage(msg) || msg.getSize() > 3 ||
+                heldCount[port] >= HOLD_LEN) {
+            heldDropCount ++;
+            return;
+        }
+        held[port][heldCount[port]].len = msg.getSize();
+        memcpy(held[port][heldCount[port]].bytes, msg.bytes.data(), msg.getSize());
+        heldCount[port] ++;
+    }
+
+    // send the messages held for an input - msg is used as scratch space
+    void sendHeldMessages(int port, midi::Message *msg) {
+        int i;
+        for(i = 0; i < heldCount[port]; i ++) {
+            msg->setSize(held[port][i].len);
+            memcpy(msg->bytes.data(), held[port][i].bytes, held[port][i].len);
+            sendMessage(*msg);
+        }
+        heldCount[port] = 0;
+    }
+
+    // check if all ports are idle and there is no work to do
+    int isIdle(void) {
+        int port;
+        if(sysexOwner != -1) {
+            return 0;
+        }
+        for(port = 0; port < NUM_INPUTS; port ++) {
+            if(!cvMidiIns[port]->isIdle() || heldCount[port]) {
+                return 0;
+            }
         }
+        for(port = 0; port < NUM_OUTPUTS; port ++) {
+            if(!cvMidiOuts[port]->isIdle()) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    // save custom JSON in patch
+    json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+        // vMIDI stats for finding bottlenecks
+        if((int)params[VMIDI_STATS_JSON].getValue()) {
+            CVMidi::statsListToJson(rootJ, statsPorts);
+        }
+		return rootJ;
 	}
 
     // samplerate changed
@@ -144,6 +299,13 @@ struct MIDI_Merger : Module {
         for(i = 0; i < NUM_LIGHTS; i ++) {
             lights[i].setBrightness(0.0f);
         }
+        sysexOwner = -1;
+        sysexTimeout = 0;
+        for(i = 0; i < NUM_INPUTS; i ++) {
+            heldCount[i] = 0;
+        }
+        heldDropCount = 0;
+        idle = 0;
     }
 };
 
@@ -173,6 +335,22 @@ struct MIDI_MergerWidget : ModuleWidget {
         addChild(createLightCentered<MediumLight<RedLight>>(mm2px(Vec(3.81, 90.15)), module, MIDI_Merger::MIDI_OUT2_LED));
         addChild(createLightCentered<MediumLight<RedLight>>(mm2px(Vec(3.81, 102.15)), module, MIDI_Merger::MIDI_OUT3_LED));
 	}
+
+    // add menu items
+    void appendContextMenu(Menu *menu) override {
+        MIDI_Merger *module = dynamic_cast<MIDI_Merger*>(this->module);
+        if(!module) {
+            return;
+        }
+
+        // vMIDI settings
+        menuHelperAddVmidiOutputs(menu, &module->params[MIDI_Merger::VMIDI_BURST],
+            &module->params[MIDI_Merger::VMIDI_COALESCE], &module->params[MIDI_Merger::VMIDI_EXPANDER]);
+
+        // vMIDI stats
+        menuHelperAddVmidiStats(menu, module->statsPorts, &module->params[MIDI_Merger::VMIDI_STATS_JSON]);
+        menuHelperAddLabel(menu, putils::format("Dropped During SYSEX: %u", module->heldDropCount));
+    }
 };
 
 Model* modelMIDI_Merger = createModel<MIDI_Merger, MIDI_MergerWidget>("MIDI_Merger");
@@ -23,6 +23,7 @@
 #include "plugin.hpp"
 #include "utils/CVMidi.h"
 #include "utils/KAComponents.h"
+#include "utils/MenuHelper.h"
 #include "utils/MidiHelper.h"
 #include "utils/PUtils.h"
 
@@ -32,6 +33,7 @@ struct MIDI_Monitor : Module, KilpatrickLabelHandler {
 		MIDI_IN2_SW,
 		MIDI_IN3_SW,
 		MIDI_IN4_SW,
+        VMIDI_STATS_JSON,  // save vMIDI stats in the patch - 0 = off, 1 = on
 		NUM_PARAMS
 	};
 	enum InputIds {
@@ -59,6 +61,7 @@ struct MIDI_Monitor : Module, KilpatrickLabelHandler {
     #define NUM_INPUTS 4
     #define DISPLAY_LINES 7
     dsp::ClockDivider taskTimer;
+    std::vector<CVMidi *> statsPorts;  // vMIDI ports shown in the stats
     CVMidi *cvMidi[NUM_INPUTS];
     int inputEnable[NUM_INPUTS];
     std::list<std::string> displayLines;
@@ -73,6 +76,7 @@ struct MIDI_Monitor : Module, KilpatrickLabelHandler {
 		configParam(MIDI_IN2_SW, 0.f, 1.f, 0.f, "MIDI IN2");
 		configParam(MIDI_IN3_SW, 0.f, 1.f, 0.f, "MIDI IN3");
 		configParam(MIDI_IN4_SW, 0.f, 1.f, 0.f, "MIDI IN4");
+        configParam(VMIDI_STATS_JSON, 0.0f, 1.0f, 0.0f, "VMIDI STATS JSON");
         configInput(MIDI_IN1, "MIDI IN1");
         configInput(MIDI_IN2, "MIDI IN2");
         configInput(MIDI_IN3, "MIDI IN3");
@@ -80,6 +84,11 @@ struct MIDI_Monitor : Module, KilpatrickLabelHandler {
         for(port = 0; port < NUM_INPUTS; port ++) {
             cvMidi[port] = new CVMidi(&inputs[MIDI_IN1 + port], 1);
         }
+        cvMidi[0]->setExpanderModule(this);  // receive from the module on the left
+        for(port = 0; port < NUM_INPUTS; port ++) {
+            cvMidi[port]->setName(putils::format("MIDI IN%d", port + 1));
+            statsPorts.push_back(cvMidi[port]);
+        }
         onReset();
         onSampleRateChange();
 	}
@@ -147,6 +156,16 @@ struct MIDI_Monitor : Module, KilpatrickLabelHandler {
         }
 	}
 
+    // save custom JSON in patch
+    json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+        // vMIDI stats for finding bottlenecks
+        if((int)params[VMIDI_STATS_JSON].getValue()) {
+            CVMidi::statsListToJson(rootJ, statsPorts);
+        }
+		return rootJ;
+	}
+
     // samplerate changed
     void onSampleRateChange(void) override {
         taskTimer.setDivision((int)(APP->engine->getSampleRate() / RT_TASK_RATE));
@@ -256,6 +275,17 @@ struct MIDI_MonitorWidget : ModuleWidget {
 		addChild(createLightCentered<MediumLight<RedLight>>(mm2px(Vec(6.499, 102.5)), module, MIDI_Monitor::MIDI_IN4_LED));
 		addChild(createLightCentered<MediumLight<RedLight>>(mm2px(Vec(22.499, 102.5)), module, MIDI_Monitor::MIDI_IN4_SW_LED));
 	}
+
+    // add menu items
+    void appendContextMenu(Menu *menu) override {
+        MIDI_Monitor *module = dynamic_cast<MIDI_Monitor*>(this->module);
+        if(!module) {
+            return;
+        }
+
+        // vMIDI stats
+        menuHelperAddVmidiStats(menu, module->statsPorts, &module->params[MIDI_Monitor::VMIDI_STATS_JSON]);
+    }
 };
 
 Model* modelMIDI_Monitor = createModel<MIDI_Monitor, MIDI_MonitorWidget>("MIDI_Monitor");
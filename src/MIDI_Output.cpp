@@ -23,12 +23,20 @@
 #include "plugin.hpp"
 #include "utils/CVMidi.h"
 #include "utils/KAComponents.h"
+#include "utils/MenuHelper.h"
 #include "utils/MidiHelper.h"
+#ifdef KA_MIDI_LOOPBACK
+#include "utils/MidiLoopback.h"
+#endif
+#include "utils/MidiSysex.h"
 #include "utils/PUtils.h"
 #include "utils/VUtils.h"
 
 struct MIDI_Output : Module, KilpatrickLabelHandler {
 	enum ParamIds {
+        VMIDI_STATS_JSON,  // save vMIDI stats in the patch - 0 = off, 1 = on
+        OUT_RATE,  // output byte rate limit in bytes/s - 0 = unlimited
+        OUT_COALESCE,  // output controller coalescing - 0 = off, 1 = on
 		NUM_PARAMS
 	};
 	enum InputIds {
@@ -43,17 +51,28 @@ struct MIDI_Output : Module, KilpatrickLabelHandler {
 		NUM_LIGHTS
 	};
 
+    #define DIN_BYTE_RATE 3125  // 31250 baud / 10 bits per byte
     dsp::ClockDivider taskTimer;
+    std::vector<CVMidi *> statsPorts;  // vMIDI ports shown in the stats
     CVMidi *cvMidiIn;
     MidiHelper *midi;
+    MidiSysexAssembler sysex;
+    midi::Message sysexMsg;  // reserved up front so sending a dump never allocates
 
     // constructor
 	MIDI_Output() {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
+        configParam(VMIDI_STATS_JSON, 0.0f, 1.0f, 0.0f, "VMIDI STATS JSON");
+        configParam(OUT_RATE, 0.0f, 31250.0f, 0.0f, "OUT RATE");
+        configParam(OUT_COALESCE, 0.0f, 1.0f, 0.0f, "OUT COALESCE");
         configInput(MIDI_IN, "MIDI IN");
+        sysexMsg.bytes.reserve(MidiSysexPool::BUF_LEN);
         cvMidiIn = new CVMidi(&inputs[MIDI_IN], 1);
+        cvMidiIn->setExpanderModule(this);  // receive from the module on the left
         midi = new MidiHelper(0, 1, 1);
         midi->setCombinedInOutMode(0);
+        cvMidiIn->setName("MIDI IN");
+        statsPorts = {cvMidiIn};
         onReset();
         onSampleRateChange();
 	}
@@ -71,16 +90,34 @@ struct MIDI_Output : Module, KilpatrickLabelHandler {
         // handle CV MIDI
         cvMidiIn->process();
 
-        // run tasks
-        if(taskTimer.process()) {
-            while(cvMidiIn->getInputMessage(&msg)) {
-                if(midi->isAssigned(0, 0)) {
-                    midi->sendOutputMessage(0, msg);
-                }
+        // send MIDI every sample so messages go out in the sample they arrive
+        while(cvMidiIn->getInputMessage(&msg)) {
+            // stamp with the frame it arrived on so it is sent at the right time
+            msg.setFrame(args.frame);
+            // SYSEX chunks are collected and sent as one message
+            switch(sysex.handleMessage(msg)) {
+                case 0:
+                    if(midi->isAssigned(0, 0)) {
+                        midi->sendOutputMessage(0, msg);
+                    }
+                    break;
+                case 2:
+                    if(midi->isAssigned(0, 0) && sysex.copyToMessage(&sysexMsg) == 0) {
+                        sysexMsg.setFrame(args.frame);
+                        midi->sendOutputMessage(0, sysexMsg);
+                    }
+                    sysex.reset();
+                    break;
             }
+        }
 
+        // run tasks
+        if(taskTimer.process()) {
             // MIDI in LEDs
             lights[MIDI_IN_LED].setBrightness(cvMidiIn->getLedState());
+            // output shaping
+            midi->setOutputRate((int)params[OUT_RATE].getValue());
+            midi->setOutputCoalesce((int)params[OUT_COALESCE].getValue());
         }
 
         midi->process();
@@ -94,12 +131,17 @@ struct MIDI_Output : Module, KilpatrickLabelHandler {
     // module initialize
     void onReset(void) override {
         lights[MIDI_IN_LED].setBrightness(0.0f);
+        sysex.reset();
     }
 
     // save custom JSON in patch
     json_t* dataToJson() override {
 		json_t* rootJ = json_object();
         midi->dataToJson(rootJ);  // add MIDI settings
+        // vMIDI stats for finding bottlenecks
+        if((int)params[VMIDI_STATS_JSON].getValue()) {
+            CVMidi::statsListToJson(rootJ, statsPorts);
+        }
 		return rootJ;
 	}
 
@@ -145,6 +187,12 @@ struct MIDI_OutputWidget : ModuleWidget {
         addChild(l);
 	}
 
+    // scan for MIDI devices on the UI thread
+    void step(void) override {
+        MidiDeviceTable::step();
+        ModuleWidget::step();
+    }
+
     // add menu items
     void appendContextMenu(Menu *menu) override {
         MIDI_Output *module = dynamic_cast<MIDI_Output*>(this->module);
@@ -155,6 +203,30 @@ struct MIDI_OutputWidget : ModuleWidget {
         // MIDI settings
         module->midi->populateDriverMenu(menu, "MIDI Output Device");
         module->midi->populateOutputMenu(menu, "", 0);
+
+        // output shaping
+        menuHelperAddSpacer(menu);
+        menuHelperAddLabel(menu, "MIDI Output Rate");
+        menuHelperAddItem(menu, new MidiHelperOutputRateMenuItem("Unlimited",
+            &module->params[MIDI_Output::OUT_RATE], 0));
+        menuHelperAddItem(menu, new MidiHelperOutputRateMenuItem("DIN MIDI",
+            &module->params[MIDI_Output::OUT_RATE], DIN_BYTE_RATE));
+        menuHelperAddItem(menu, new MidiHelperOutputRateMenuItem("DIN MIDI x2",
+            &module->params[MIDI_Output::OUT_RATE], DIN_BYTE_RATE * 2));
+        menuHelperAddItem(menu, new MidiHelperOutputRateMenuItem("DIN MIDI x4",
+            &module->params[MIDI_Output::OUT_RATE], DIN_BYTE_RATE * 4));
+        menuHelperAddItem(menu, new MenuHelperParamToggleItem("Coalesce Controllers",
+            &module->params[MIDI_Output::OUT_COALESCE]));
+        menuHelperAddItem(menu, new MidiHelperOutputStatsMenuItem(module->midi, 0));
+
+        // vMIDI stats
+        menuHelperAddVmidiStats(menu, module->statsPorts, &module->params[MIDI_Output::VMIDI_STATS_JSON]);
+
+#ifdef KA_MIDI_LOOPBACK
+        // loopback driver test controls
+        menuHelperAddSpacer(menu);
+        menuHelperAddItem(menu, new MidiLoopbackMenuItem());
+#endif
     }
 };
 
@@ -23,6 +23,7 @@
 #include "plugin.hpp"
 #include "utils/CVMidi.h"
 #include "utils/KAComponents.h"
+#include "utils/MenuHelper.h"
 #include "utils/MidiHelper.h"
 #include "utils/MidiRepeater.h"
 #include "utils/PUtils.h"
@@ -30,6 +31,10 @@
 struct MIDI_Repeater : Module, MidiRepeaterSender {
 	enum ParamIds {
 		MODE_SW,
+        VMIDI_BURST,  // vMIDI output burst mode - 0 = off, 1 = on
+        VMIDI_EXPANDER,  // send vMIDI to the module on the right - 0 = off, 1 = on
+        VMIDI_COALESCE,  // vMIDI output controller coalescing - 0 = off, 1 = on
+        VMIDI_STATS_JSON,  // save vMIDI stats in the patch - 0 = off, 1 = on
 		NUM_PARAMS
 	};
 	enum InputIds {
@@ -56,15 +61,22 @@ struct MIDI_Repeater : Module, MidiRepeaterSender {
 
     #define NUM_PORTS 3
     dsp::ClockDivider taskTimer;
+    std::vector<CVMidi *> statsPorts;  // vMIDI ports shown in the stats
     CVMidi *cvMidiIns[NUM_PORTS];
     CVMidi *cvMidiOuts[NUM_PORTS];
     MidiRepeater repeaterHist[NUM_PORTS];
+    int idle;  // 1 = processing is skipped until a cable is connected
+    uint32_t idleTasks;  // number of task runs skipped while idle
 
     // constructor
 	MIDI_Repeater() {
         int port;
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
 		configParam(MODE_SW, 0.0f, 2.0f, 0.0f, "MODE");
+        configParam(VMIDI_BURST, 0.0f, 1.0f, 0.0f, "VMIDI BURST");
+        configParam(VMIDI_EXPANDER, 0.0f, 1.0f, 0.0f, "VMIDI EXPANDER");
+        configParam(VMIDI_COALESCE, 0.0f, 1.0f, 0.0f, "VMIDI COALESCE");
+        configParam(VMIDI_STATS_JSON, 0.0f, 1.0f, 0.0f, "VMIDI STATS JSON");
         configInput(MIDI_IN1, "MIDI IN1");
         configInput(MIDI_IN2, "MIDI IN2");
         configInput(MIDI_IN3, "MIDI IN3");
@@ -77,6 +89,16 @@ struct MIDI_Repeater : Module, MidiRepeaterSender {
             cvMidiOuts[port] = new CVMidi(&outputs[MIDI_OUT1 + port], 0);
             repeaterHist[port].registerSender(this, port);
         }
+        cvMidiOuts[0]->setExpanderModule(this);  // can send to the module on the right
+        cvMidiIns[0]->setExpanderModule(this);  // receive from the module on the left
+        for(port = 0; port < NUM_PORTS; port ++) {
+            cvMidiIns[port]->setName(putils::format("MIDI IN%d", port + 1));
+            statsPorts.push_back(cvMidiIns[port]);
+        }
+        for(port = 0; port < NUM_PORTS; port ++) {
+            cvMidiOuts[port]->setName(putils::format("MIDI OUT%d", port + 1));
+            statsPorts.push_back(cvMidiOuts[port]);
+        }
         onReset();
         onSampleRateChange();
 	}
@@ -95,9 +117,30 @@ struct MIDI_Repeater : Module, MidiRepeaterSender {
         midi::Message msg;
         int port, temp;
 
+        // skip everything while no cables are connected and all ports are idle
+        // - the task timer keeps counting so timeouts still run while idle
+        if(idle && isIdle()) {
+            if(taskTimer.process()) {
+                idleTasks ++;
+            }
+            return;
+        }
+        if(idle) {
+            for(port = 0; port < NUM_PORTS; port ++) {
+                repeaterHist[port].advance(idleTasks);
+            }
+        }
+        idle = 0;
+        idleTasks = 0;
+
         // handle CV MIDI
         for(port = 0; port < NUM_PORTS; port ++) {
             cvMidiIns[port]->process();
+            // input message - every sample so messages go out in the sample they arrive
+            while(cvMidiIns[port]->getInputMessage(&msg)) {
+//                MidiHelper::printMessage(&msg);
+                repeaterHist[port].handleMessage(msg);  // let the repeater handle all incoming MIDI
+            }
             cvMidiOuts[port]->process();
         }
 
@@ -105,11 +148,10 @@ struct MIDI_Repeater : Module, MidiRepeaterSender {
         if(taskTimer.process()) {
             // check channels
             for(port = 0; port < NUM_PORTS; port ++) {
-                // input message
-                while(cvMidiIns[port]->getInputMessage(&msg)) {
-//                    MidiHelper::printMessage(&msg);
-                    repeaterHist[port].handleMessage(msg);  // let the repeater handle all incoming MIDI
-                }
+                // vMIDI output settings
+                cvMidiOuts[port]->setBurstMode((int)params[VMIDI_BURST].getValue());
+                cvMidiOuts[port]->setCoalesceMode((int)params[VMIDI_COALESCE].getValue());
+                cvMidiOuts[port]->setExpanderSend((int)params[VMIDI_EXPANDER].getValue());
                 // MIDI LEDs
                 lights[MIDI_IN1_LED + port].setBrightness(cvMidiIns[port]->getLedState());
                 lights[MIDI_OUT1_LED + port].setBrightness(cvMidiOuts[port]->getLedState());
@@ -135,7 +177,29 @@ struct MIDI_Repeater : Module, MidiRepeaterSender {
             for(port = 0; port < NUM_PORTS; port ++) {
                 repeaterHist[port].taskTimer();
             }
+            idle = isIdle();
+        }
+	}
+
+    // check if all ports are idle and there is no work to do
+    int isIdle(void) {
+        int port;
+        for(port = 0; port < NUM_PORTS; port ++) {
+            if(!cvMidiIns[port]->isIdle() || !cvMidiOuts[port]->isIdle()) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    // save custom JSON in patch
+    json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+        // vMIDI stats for finding bottlenecks
+        if((int)params[VMIDI_STATS_JSON].getValue()) {
+            CVMidi::statsListToJson(rootJ, statsPorts);
         }
+		return rootJ;
 	}
 
     // samplerate changed
@@ -152,6 +216,8 @@ struct MIDI_Repeater : Module, MidiRepeaterSender {
         for(i = 0; i < NUM_PORTS; i ++) {
             repeaterHist[i].reset();
         }
+        idle = 0;
+        idleTasks = 0;
     }
 
     //
@@ -192,6 +258,21 @@ struct MIDI_RepeaterWidget : ModuleWidget {
 
         addParam(createParamCentered<KilpatrickToggle3P>(mm2px(Vec(10.16, 66.5)), module, MIDI_Repeater::MODE_SW));
 	}
+
+    // add menu items
+    void appendContextMenu(Menu *menu) override {
+        MIDI_Repeater *module = dynamic_cast<MIDI_Repeater*>(this->module);
+        if(!module) {
+            return;
+        }
+
+        // vMIDI settings
+        menuHelperAddVmidiOutputs(menu, &module->params[MIDI_Repeater::VMIDI_BURST],
+            &module->params[MIDI_Repeater::VMIDI_COALESCE], &module->params[MIDI_Repeater::VMIDI_EXPANDER]);
+
+        // vMIDI stats
+        menuHelperAddVmidiStats(menu, module->statsPorts, &module->params[MIDI_Repeater::VMIDI_STATS_JSON]);
+    }
 };
 
 Model* modelMIDI_Repeater = createModel<MIDI_Repeater, MIDI_RepeaterWidget>("MIDI_Repeater");
@@ -26,20 +26,32 @@
 #include "../utils/PUtils.h"
 
 // constructor
-Midi2Note::Midi2Note() {
+template <int VOICES>
+Midi2Note<VOICES>::Midi2Note() {
     setBendRange(2);
+    allocMode = ALLOC_LOWEST_FREE;
     setPolyMode(0);
     reset();
 }
 
 // reset everything
-void Midi2Note::reset() {
+template <int VOICES>
+void Midi2Note<VOICES>::reset() {
     int i;
     damper = 0;
-    monoPrio.clear();
-    for(i = 0; i < POLY_MAX_VOICES; i ++) {
+    for(i = 0; i < 128; i ++) {
+        stackPrev[i] = -1;
+        stackNext[i] = -1;
+        noteVoices[i] = 0;
+    }
+    stackTop = -1;
+    stackLen = 0;
+    noteCount = 0;
+    rrNext = 0;
+    for(i = 0; i < VOICES; i ++) {
         heldNotes[i] = -1;
         currentNotes[i] = -1;
+        voiceAge[i] = 0;
         pitchOut[i] = 0.0f;
         gateOut[i] = 0;
         velOut[i] = 0.0f;
@@ -49,7 +61,8 @@ void Midi2Note::reset() {
 }
 
 // handle an input message
-void Midi2Note::handleMessage(const midi::Message& msg) {
+template <int VOICES>
+void Midi2Note<VOICES>::handleMessage(const midi::Message& msg) {
     if(!MidiHelper::isChannelMessage(msg)) {
         return;
     }
@@ -82,23 +95,47 @@ void Midi2Note::handleMessage(const midi::Message& msg) {
 }
 
 // get the poly mode state
-int Midi2Note::getPolyMode(void) {
+template <int VOICES>
+int Midi2Note<VOICES>::getPolyMode(void) {
     return polyMode;
 }
 
 // set the poly mode on or off
-void Midi2Note::setPolyMode(int enable) {
+template <int VOICES>
+void Midi2Note<VOICES>::setPolyMode(int enable) {
     polyMode = enable;
     reset();
 }
 
+// get the poly voice allocation mode
+template <int VOICES>
+int Midi2Note<VOICES>::getAllocMode(void) {
+    return allocMode;
+}
+
+// set the poly voice allocation mode
+template <int VOICES>
+void Midi2Note<VOICES>::setAllocMode(int mode) {
+    int chan;
+    if(mode < 0 || mode >= ALLOC_NUM_MODES || mode == allocMode) {
+        return;
+    }
+    allocMode = mode;
+    // notes held with the old mode can't be tracked with the new one
+    chan = channel;
+    reset();
+    channel = chan;
+}
+
 // get the receive channel
-int Midi2Note::getChannel(void) {
+template <int VOICES>
+int Midi2Note<VOICES>::getChannel(void) {
     return channel;
 }
 
 // set the receive channel
-void Midi2Note::setChannel(int chan) {
+template <int VOICES>
+void Midi2Note<VOICES>::setChannel(int chan) {
     if(chan < -1 || chan >= MIDI_NUM_CHANNELS) {
         return;
     }
@@ -106,12 +143,14 @@ void Midi2Note::setChannel(int chan) {
 }
 
 // get the bend range
-int Midi2Note::getBendRange(void) {
+template <int VOICES>
+int Midi2Note<VOICES>::getBendRange(void) {
     return bendRange;
 }
 
 // set the bend range
-void Midi2Note::setBendRange(int semis) {
+template <int VOICES>
+void Midi2Note<VOICES>::setBendRange(int semis) {
     if(semis < 1 || semis > 12) {
         return;
     }
@@ -119,24 +158,27 @@ void Midi2Note::setBendRange(int semis) {
 }
 
 // get the current voltage for a voice - returns 0.0 on error
-float Midi2Note::getPitchVoltage(int voice) {
-    if(voice < 0 || voice >= POLY_MAX_VOICES) {
+template <int VOICES>
+float Midi2Note<VOICES>::getPitchVoltage(int voice) {
+    if(voice < 0 || voice >= VOICES) {
         return 0.0f;
     }
     return pitchOut[voice];
 }
 
 // get the current gate voltage for a voice - returns 0.0 on error
-float Midi2Note::getGateVoltage(int voice) {
-    if(voice < 0 || voice >= POLY_MAX_VOICES) {
+template <int VOICES>
+float Midi2Note<VOICES>::getGateVoltage(int voice) {
+    if(voice < 0 || voice >= VOICES) {
         return 0.0f;
     }
     return (float)gateOut[voice] * 10.0f;
 }
 
 // get the current velocity voltage for a voice - returns 0.0 on error
-float Midi2Note::getVelocityVoltage(int voice) {
-    if(voice < 0 || voice >= POLY_MAX_VOICES) {
+template <int VOICES>
+float Midi2Note<VOICES>::getVelocityVoltage(int voice) {
+    if(voice < 0 || voice >= VOICES) {
         return 0.0f;
     }
     return velOut[voice];
@@ -146,97 +188,84 @@ float Midi2Note::getVelocityVoltage(int voice) {
 // private methods
 //
 // handle a note off
-void Midi2Note::handleNoteOff(midi::Message msg) {
-    int i;
-    std::vector<midi::Message>::iterator iter;
-    if(msg.bytes[1] < NOTE_MIN || msg.bytes[1] > NOTE_MAX) {
+template <int VOICES>
+void Midi2Note<VOICES>::handleNoteOff(const midi::Message& msg) {
+    int i, voices;
+    uint16_t mask;
+    int note = msg.bytes[1];
+    if(note < NOTE_MIN || note > NOTE_MAX) {
         return;
     }
     // poly mode
-    if(polyMode) {
-        // free the slots that contain this note
-        for(i = 0; i < POLY_MAX_VOICES; i ++) {
-            if(heldNotes[i] == msg.bytes[1]) {
-                heldNotes[i] = -1;
-                setVoiceNote(i, -1, -1);
-            }
+    if(polyMode && allocMode != ALLOC_UNISON) {
+        // free the voices that contain this note
+        mask = noteVoices[note];
+        noteVoices[note] = 0;
+        while(mask) {
+            i = __builtin_ctz(mask);
+            mask &= mask - 1;
+            heldNotes[i] = -1;
+            setVoiceNote(i, -1, -1);
         }
     }
-    // mono mode
+    // mono / unison mode
     else {
-        // check that note is not already in the list
-        iter = monoPrio.begin();
-        while(iter != monoPrio.end()) {
-            if(iter->bytes[1] == msg.bytes[1]) {
-                monoPrio.erase(iter);
-                continue;
+        stackRemove(note);
+        voices = getNumStackVoices();
+        for(i = 0; i < voices; i ++) {
+            // no more notes
+            if(stackLen == 0) {
+                heldNotes[i] = -1;
+                setVoiceNote(i, -1, -1);  // turn off note
+            }
+            // set the latest note - don't update velocity
+            else {
+                heldNotes[i] = stackTop;
+                setVoiceNote(i, heldNotes[i], -1);
             }
-            ++iter;
-        }
-        // no more notes
-        if(monoPrio.size() == 0) {
-            heldNotes[0] = -1;
-            setVoiceNote(0, -1, -1);  // turn off note
-        }
-        // set the latest note - don't update velocity
-        else {
-            heldNotes[0] = monoPrio.back().bytes[1];
-            setVoiceNote(0, heldNotes[0], -1);
         }
     }
 }
 
 // handle a note on
-void Midi2Note::handleNoteOn(midi::Message msg) {
-    int i, newStart = 0;
-    std::vector<midi::Message>::iterator iter;
-    if(msg.bytes[1] < NOTE_MIN || msg.bytes[1] > NOTE_MAX) {
+template <int VOICES>
+void Midi2Note<VOICES>::handleNoteOn(const midi::Message& msg) {
+    int i, voices, newStart;
+    int note = msg.bytes[1];
+    if(note < NOTE_MIN || note > NOTE_MAX) {
         return;
     }
     // poly mode
-    if(polyMode) {
-        // find a free voice slot
-        for(i = 0; i < POLY_MAX_VOICES; i ++) {
-            // need to check currentNotes[] because of damper
-            if(currentNotes[i] == -1) {
-                heldNotes[i] = msg.bytes[1];
-                setVoiceNote(i, msg.bytes[1], msg.bytes[2]);
-                break;
-            }
+    if(polyMode && allocMode != ALLOC_UNISON) {
+        i = findPolyVoice();
+        if(i != -1) {
+            startPolyVoice(i, note, msg.bytes[2]);
         }
     }
-    // mono mode
+    // mono / unison mode
     else {
         // no notes are down - keep track for starting with new velocity
-        if(monoPrio.size() == 0) {
-            newStart = 1;
-        }
-        // check that note is not already in the list
-        iter = monoPrio.begin();
-        while(iter != monoPrio.end()) {
-            if(iter->bytes[1] == msg.bytes[1]) {
-                monoPrio.erase(iter);
-                continue;
+        newStart = (stackLen == 0);
+        // move the note to the top of the stack
+        stackPush(note);
+        voices = getNumStackVoices();
+        for(i = 0; i < voices; i ++) {
+            heldNotes[i] = note;
+            // new note - send velocity
+            if(newStart) {
+                setVoiceNote(i, note, msg.bytes[2]);
+            }
+            // note is already on - don't update velocity
+            else {
+                setVoiceNote(i, note, -1);
             }
-            ++iter;
-        }
-        // add note to the end of the list
-        monoPrio.push_back(msg);
-        heldNotes[0] = monoPrio.back().bytes[1];
-        // new note - send velocity
-        if(newStart) {
-            heldNotes[0] = monoPrio.back().bytes[1];
-            setVoiceNote(0, heldNotes[0], monoPrio.back().bytes[2]);
-        }
-        // note is already on - don't update velocity
-        else {
-            setVoiceNote(0, monoPrio.back().bytes[1], -1);
         }
     }
 }
 
 // handle a CC
-void Midi2Note::handleCC(midi::Message msg) {
+template <int VOICES>
+void Midi2Note<VOICES>::handleCC(const midi::Message& msg) {
     int i;
     switch(msg.bytes[1]) {
         case MIDI_CONTROLLER_DAMPER_PEDAL:
@@ -246,18 +275,9 @@ void Midi2Note::handleCC(midi::Message msg) {
             else {
                 damper = 0;
                 // if notes are playing we need to release them
-                // poly mode
-                if(polyMode) {
-                    for(i = 0; i < POLY_MAX_VOICES; i ++) {
-                        if(heldNotes[i] == -1) {
-                            setVoiceNote(i, -1, -1);  // turn off note
-                        }
-                    }
-                }
-                // mono mode
-                else {
-                    if(heldNotes[0] == -1) {
-                        setVoiceNote(0, -1, -1);  // turn off note
+                for(i = 0; i < VOICES; i ++) {
+                    if(heldNotes[i] == -1) {
+                        setVoiceNote(i, -1, -1);  // turn off note
                     }
                 }
             }
@@ -268,24 +288,19 @@ void Midi2Note::handleCC(midi::Message msg) {
 }
 
 // handle a pitch bend
-void Midi2Note::handleBend(midi::Message msg) {
+template <int VOICES>
+void Midi2Note<VOICES>::handleBend(const midi::Message& msg) {
     int i;
     int bend = MidiHelper::getPitchBendVal(msg);
     currentBend = ((float)bend * (float)bendRange) * 0.000010173;
-    // poly mode
-    if(polyMode) {
-        for(i = 0; i < POLY_MAX_VOICES; i ++) {
-            setVoiceNote(i, currentNotes[i], -1);  // update bend
-        }
-    }
-    // mono mode
-    else {
-        setVoiceNote(0, currentNotes[0], -1);
+    for(i = 0; i < VOICES; i ++) {
+        setVoiceNote(i, currentNotes[i], -1);  // update bend
     }
 }
 
 // set a voice note
-void Midi2Note::setVoiceNote(int voice, int note, int vel) {
+template <int VOICES>
+void Midi2Note<VOICES>::setVoiceNote(int voice, int note, int vel) {
     // turn on note
     if(note >= 0) {
         pitchOut[voice] = ((float)note * 0.083333333f) + currentBend - 5.0f;
@@ -302,3 +317,104 @@ void Midi2Note::setVoiceNote(int voice, int note, int vel) {
     }
     currentNotes[voice] = note;
 }
+
+// push a note on to the top of the mono stack
+template <int VOICES>
+void Midi2Note<VOICES>::stackPush(int note) {
+    stackRemove(note);
+    stackPrev[note] = stackTop;
+    stackNext[note] = -1;
+    if(stackTop != -1) {
+        stackNext[stackTop] = note;
+    }
+    stackTop = note;
+    stackLen ++;
+}
+
+// remove a note from the mono stack if it's there
+template <int VOICES>
+void Midi2Note<VOICES>::stackRemove(int note) {
+    int prev, next;
+    // only the top note has no next note
+    if(note != stackTop && stackNext[note] == -1) {
+        return;
+    }
+    prev = stackPrev[note];
+    next = stackNext[note];
+    if(prev != -1) {
+        stackNext[prev] = next;
+    }
+    if(next != -1) {
+        stackPrev[next] = prev;
+    }
+    else {
+        stackTop = prev;
+    }
+    stackPrev[note] = -1;
+    stackNext[note] = -1;
+    stackLen --;
+}
+
+// find a voice for a new poly note
+// returns the voice or -1 if no voice is available
+template <int VOICES>
+int Midi2Note<VOICES>::findPolyVoice(void) {
+    int i, voice;
+    switch(allocMode) {
+        case ALLOC_ROUND_ROBIN:
+            for(i = 0; i < VOICES; i ++) {
+                voice = (rrNext + i) % VOICES;
+                if(currentNotes[voice] == -1) {
+                    rrNext = (voice + 1) % VOICES;
+                    return voice;
+                }
+            }
+            return -1;
+        case ALLOC_STEAL_OLDEST:
+        case ALLOC_LOWEST_FREE:
+        default:
+            // need to check currentNotes[] because of damper
+            for(i = 0; i < VOICES; i ++) {
+                if(currentNotes[i] == -1) {
+                    return i;
+                }
+            }
+            if(allocMode != ALLOC_STEAL_OLDEST) {
+                return -1;
+            }
+            // all busy - take the voice that was started longest ago
+            voice = 0;
+            for(i = 1; i < VOICES; i ++) {
+                if((noteCount - voiceAge[i]) > (noteCount - voiceAge[voice])) {
+                    voice = i;
+                }
+            }
+            return voice;
+    }
+}
+
+// start a note on a poly voice - steals the voice if it is playing
+template <int VOICES>
+void Midi2Note<VOICES>::startPolyVoice(int voice, int note, int vel) {
+    if(heldNotes[voice] != -1) {
+        noteVoices[heldNotes[voice]] &= ~(1 << voice);
+    }
+    heldNotes[voice] = note;
+    noteVoices[note] |= (1 << voice);
+    voiceAge[voice] = noteCount;
+    noteCount ++;
+    setVoiceNote(voice, note, vel);
+}
+
+// get the number of voices that follow the mono stack
+template <int VOICES>
+int Midi2Note<VOICES>::getNumStackVoices(void) {
+    if(polyMode) {
+        return VOICES;  // unison
+    }
+    return 1;
+}
+
+// MIDI CV uses 3 voices - 16 voices is built for the full poly checks in test/
+template class Midi2Note<3>;
+template class Midi2Note<16>;
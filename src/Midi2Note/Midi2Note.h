@@ -25,35 +25,63 @@
 
 #include "../plugin.hpp"
 
+// convert MIDI notes to pitch / gate / velocity for up to 16 voices
+// - notes are kept in fixed size tables so nothing is allocated
+// - note on and note off are O(1) for any number of held notes
+template <int VOICES>
 class Midi2Note {
 private:
+    static_assert(VOICES >= 1 && VOICES <= 16, "VOICES must be 1 to 16");
     // settings
-    #define POLY_MAX_VOICES 3
     #define NOTE_MIN 12
     #define NOTE_MAX (127-12)
     // settings
     int bendRange;  // pitch bend range
     int polyMode;  // 1 = poly mode, 0 = mono mode
+    int allocMode;  // poly voice allocation mode
     int channel;  // receive channel
     // state
     int damper;  // damper pedal state - 1 = pressed, 0 = released
-    std::vector<midi::Message> monoPrio;  // mono note list
-    int heldNotes[POLY_MAX_VOICES];  // held notes for each voice - voice 0 = mono
-    int currentNotes[POLY_MAX_VOICES];  // note for each voice - voice 0 = mono
+    // mono note priority stack - a linked list through all notes
+    int8_t stackPrev[128];  // previous note in the stack - -1 = none
+    int8_t stackNext[128];  // next note in the stack - -1 = none
+    int stackTop;  // latest note - -1 = stack is empty
+    int stackLen;  // number of notes in the stack
+    uint16_t noteVoices[128];  // voices holding each note - 1 bit per voice
+    uint32_t voiceAge[VOICES];  // note on count when each voice was started
+    uint32_t noteCount;  // number of note ons for voice age
+    int rrNext;  // next voice to try for round robin
+    int heldNotes[VOICES];  // held notes for each voice - voice 0 = mono
+    int currentNotes[VOICES];  // note for each voice - voice 0 = mono
     float currentBend;  // current pitch bend amount in volts
     // outputs
-    float pitchOut[POLY_MAX_VOICES];  // pitch output voltage for each voice
-    int gateOut[POLY_MAX_VOICES];  // gate output state for each voice
-    float velOut[POLY_MAX_VOICES];  // velocity output voltage for each voice
+    float pitchOut[VOICES];  // pitch output voltage for each voice
+    int gateOut[VOICES];  // gate output state for each voice
+    float velOut[VOICES];  // velocity output voltage for each voice
 
     // private methods
-    void handleNoteOff(midi::Message msg);
-    void handleNoteOn(midi::Message msg);
-    void handleCC(midi::Message msg);
-    void handleBend(midi::Message msg);
+    void handleNoteOff(const midi::Message& msg);
+    void handleNoteOn(const midi::Message& msg);
+    void handleCC(const midi::Message& msg);
+    void handleBend(const midi::Message& msg);
     void setVoiceNote(int voice, int note, int vel);
+    void stackPush(int note);
+    void stackRemove(int note);
+    int findPolyVoice(void);
+    void startPolyVoice(int voice, int note, int vel);
+    int getNumStackVoices(void);
 
 public:
+    // poly voice allocation modes
+    enum AllocMode {
+        ALLOC_LOWEST_FREE = 0,  // use the lowest free voice - drop notes if all are busy
+        ALLOC_ROUND_ROBIN,  // use the next free voice after the last one used
+        ALLOC_STEAL_OLDEST,  // use the lowest free voice - steal the oldest if all are busy
+        ALLOC_UNISON,  // all voices play the latest note
+        ALLOC_NUM_MODES
+    };
+    static constexpr int NUM_VOICES = VOICES;
+
     // constructor
     Midi2Note();
 
@@ -69,6 +97,12 @@ public:
     // set the poly mode on or off
     void setPolyMode(int enable);
 
+    // get the poly voice allocation mode
+    int getAllocMode(void);
+
+    // set the poly voice allocation mode
+    void setAllocMode(int mode);
+
     // get the receive channel
     int getChannel(void);
 
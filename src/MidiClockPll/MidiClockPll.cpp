@@ -8,13 +8,15 @@
  *
  */
 #include "MidiClockPll.h"
-#include "../utils/PLog.h"
-#include "../utils/PUtils.h"
+#include <math.h>
+#include <stdlib.h>
 
 // constructor
 MidiClockPll::MidiClockPll() {
     handler = NULL;
     taskIntervalUs = 1000;  // default
+    taskIntervalFrac = 0.0;
+    taskTimeFrac = 0.0;
     setInternalPpq(24);  // default
     // general clock state
     desiredSource = SOURCE_INTERNAL;
@@ -26,17 +28,23 @@ MidiClockPll::MidiClockPll() {
     extTickf = 0;
     timeCount = 0;
     nextTickTime = 0;
+    tickOffset = 0.0f;
     intLastTickTime = 0;
+    intTickRemCount = 0;
     // internal clock state
     runTickCount = 0;
     stopTickCount = 0;
     setTempo(DEFAULT_TEMPO);
     // external clock recovery state
     extIntervalCount = 0;
+    extIntervalEst = 0;
+    extLongCount = 0;
     extSyncTimeout = 0;  // timed out
     extLastTickTime = 0;
     extRunTickCount = 0;
     extSyncTempoAverage = intUsPerTick;  // default
+    setLoopBandwidth(LOOP_BW_MEDIUM);
+    resetExtLoop();
     // tap tempo
     tapBeatf = 0;
     tapClockLastTap = 0;
@@ -50,8 +58,10 @@ void MidiClockPll::registerHandler(MidiClockPllHandler *handler) {
 }
 
 // set the task interval in us to calculate tempo
-void MidiClockPll::setTaskInterval(int taskIntervalUs) {
-    this->taskIntervalUs = taskIntervalUs;
+void MidiClockPll::setTaskInterval(double taskIntervalUs) {
+    this->taskIntervalUs = (int)taskIntervalUs;
+    taskIntervalFrac = taskIntervalUs - (double)this->taskIntervalUs;
+    taskTimeFrac = 0.0;
 }
 
 // set the internal PPQ of the clock - i.e. 24 or 96
@@ -66,9 +76,10 @@ void MidiClockPll::setInternalPpq(int ppq) {
 
 // run the timer task
 void MidiClockPll::timerTask(void) {
-    int i, extDriftError, extPhaseError;
+    int i;
     uint32_t tick_count;
     int32_t temp;
+    int64_t taskStart;
 
     // handle playback state change flags
     switch(runstopf) {
@@ -106,10 +117,21 @@ void MidiClockPll::timerTask(void) {
         }
     }
 
-    // run clock timebase
+    // run clock timebase - carry the fractional part of the interval
+    taskStart = timeCount;
     timeCount += taskIntervalUs;
+    taskTimeFrac += taskIntervalFrac;
+    if(taskTimeFrac >= 1.0) {
+        taskTimeFrac -= 1.0;
+        timeCount ++;
+    }
     // decide if we should issue a clock
     while(timeCount > nextTickTime) {
+        // find where the tick falls in the interval that just ended
+        tickOffset = (float)(nextTickTime - taskStart) / (float)(timeCount - taskStart);
+        if(tickOffset < 0.0f) {
+            tickOffset = 0.0f;  // late tick - i.e. tempo was raised
+        }
         // if run state changed
         if(runState != desiredRunState) {
             // stopping
@@ -137,6 +159,12 @@ void MidiClockPll::timerTask(void) {
 
         tick_count ++;
         nextTickTime += intUsPerTick;
+        // spread the rounding left over from the beat over its ticks so the tempo is exact
+        intTickRemCount += intUsPerTickRem;
+        if(intTickRemCount >= clockInternalPpq) {
+            intTickRemCount -= clockInternalPpq;
+            nextTickTime ++;
+        }
         intLastTickTime = timeCount;
         // write back the tick count
         if(runState) {
@@ -146,71 +174,14 @@ void MidiClockPll::timerTask(void) {
             stopTickCount = tick_count;
         }
     }
+    tickOffset = 0.0f;
 
     // recover external clock and drive the internal clock
     if(source == SOURCE_EXTERNAL) {
         // a tick was received
         if(extTickf) {
             extTickf = 0;
-            // ext sync started
-            if(!extSyncTimeout && handler != NULL) {
-                handler->midiClockExtSyncChanged(1);
-                extRunTickCount = runTickCount;
-            }
-            extSyncTimeout = EXT_SYNC_TIMEOUT;
-            // measure interval - skip the very first time since it will be wrong
-            extIntervalHist[(extIntervalCount - 1) & EXT_HIST_MASK] =
-                timeCount - extLastTickTime;
-            // average the number of samples we have
-            temp = 0;
-            for(i = 0; i < EXT_HIST_LEN && i < extIntervalCount; i ++) {
-                temp += extIntervalHist[i];
-            }
-            // if we have at least EXT_MIN_HIST samples let's update the internal clock
-            if(i >= EXT_MIN_HIST) {
-                temp /= i;
-                // set the internal clock to this value
-                intUsPerTick = temp / midiClockUpsample;  // convert to internal PPQ (might be >24)
-//                // XXX debug
-//                log_debug("i: %d - avg: %d - time: %lld - last: %lld - diff: %lld", i, temp,
-//                    timeCount, extLastTickTime,
-//                    (timeCount - extLastTickTime));
-                extSyncTempoAverage = ((float)extSyncTempoAverage *
-                    EXT_SYNC_TEMPO_FILTER) +
-                    ((float)intUsPerTick * (1.0 - EXT_SYNC_TEMPO_FILTER ));
-                // use smoothed value
-                intUsPerTick = extSyncTempoAverage;
-            }
-            extLastTickTime = timeCount;
-            extIntervalCount ++;
-
-            // adjust drift and phase if running
-            if(runState) {
-                extRunTickCount += midiClockUpsample;
-//                PDEBUG("eta: %d - us: %d", extSyncTempoAverage, intUsPerTick);
-                // compensate for drift error
-                extDriftError = runTickCount - extRunTickCount;
-                if(extDriftError < 0) {
-                    intUsPerTick -= EXT_ERROR_ADJ;
-                }
-                else if(extDriftError > 0) {
-                    intUsPerTick += EXT_ERROR_ADJ;
-                }
-                // compare for phase error
-                extPhaseError = intLastTickTime - extLastTickTime;
-                // + phase means internal is ahead of ext, - phase means int is behind ext
-                // only adjust if drift is zero
-                if(extDriftError == 0) {
-//                    PDEBUG("drift: %d - phase: %d", extDriftError, extPhaseError);
-                    if(extPhaseError < 0) {
-                        intUsPerTick += EXT_ERROR_ADJ;
-                    }
-                    else if(extPhaseError > 0) {
-                        intUsPerTick -= EXT_ERROR_ADJ;
-                    }
-                }
-            }
-
+            handleExtTick();
         }
     }
 
@@ -219,10 +190,13 @@ void MidiClockPll::timerTask(void) {
         extSyncTimeout -= taskIntervalUs;
         // ext sync lost
         if(extSyncTimeout <= 0) {
+            extSyncTimeout = 0;
             if(handler != NULL) {
                 handler->midiClockExtSyncChanged(0);
             }
             extIntervalCount = 0;  // reset
+            extIntervalEst = 0;
+            extStats.locked = 0;
             runstopf = RUNSTOP_STOP;
         }
     }
@@ -254,6 +228,7 @@ void MidiClockPll::timerTask(void) {
                 intUsPerTick = temp;
             }
             intUsPerBeat = intUsPerTick * clockInternalPpq;
+            intUsPerTickRem = 0;
             if(handler != NULL) {
                 handler->midiClockTapTempoLocked();
             }
@@ -265,6 +240,16 @@ void MidiClockPll::timerTask(void) {
     }
 }
 
+// get the position of the tick being issued within the task interval
+float MidiClockPll::getTickOffset(void) {
+    return tickOffset;
+}
+
+// get the current tick interval in us
+int MidiClockPll::getUsPerTick(void) {
+    return intUsPerTick;
+}
+
 // get the MIDI clock source
 int MidiClockPll::getSource(void) {
     return source;
@@ -288,6 +273,41 @@ int MidiClockPll::isExtSynced(void) {
     return 0;
 }
 
+// get the external sync loop bandwidth
+int MidiClockPll::getLoopBandwidth(void) {
+    return extLoopBandwidth;
+}
+
+// set the external sync loop bandwidth
+void MidiClockPll::setLoopBandwidth(int bandwidth) {
+    float wn;
+    switch(bandwidth) {
+        // wn is the loop natural frequency in radians per external tick
+        // - the loop settles to 2% in about 4 / (zeta * wn) ticks
+        case LOOP_BW_LOW:
+            wn = 0.02f;  // ~280 ticks - ~12 beats at 24 PPQ
+            break;
+        case LOOP_BW_HIGH:
+            wn = 0.12f;  // ~47 ticks - ~2 beats at 24 PPQ
+            break;
+        case LOOP_BW_MEDIUM:
+        default:
+            bandwidth = LOOP_BW_MEDIUM;
+            wn = 0.05f;  // ~113 ticks - ~5 beats at 24 PPQ
+            break;
+    }
+    extLoopBandwidth = bandwidth;
+    // second-order loop with Butterworth damping (zeta = 0.707)
+    // - a little overshoot in exchange for faster settling than critical damping
+    extLoopKp = 2.0f * 0.707f * wn;
+    extLoopKi = wn * wn;
+}
+
+// get the external sync loop stats
+void MidiClockPll::getExtSyncStats(MidiClockPllStats *stats) {
+    *stats = extStats;
+}
+
 // get the clock tempo
 float MidiClockPll::getTempo(void) {
     if(source == SOURCE_EXTERNAL) {
@@ -298,8 +318,9 @@ float MidiClockPll::getTempo(void) {
 
 // set the clock tempo
 void MidiClockPll::setTempo(float tempo) {
-    intUsPerBeat = (int32_t)(60000000.0f / tempo);
+    intUsPerBeat = (int32_t)((60000000.0 / (double)tempo) + 0.5);
     intUsPerTick = intUsPerBeat / clockInternalPpq;
+    intUsPerTickRem = intUsPerBeat - (intUsPerTick * clockInternalPpq);
 }
 
 // handle tap tempo
@@ -361,6 +382,194 @@ void MidiClockPll::handleMidiStop(void) {
 //
 // private methods
 //
+// handle a received external tick - runs from the timer task
+// - the interval estimate sets the loop frequency when stopped or on a tempo jump
+// - when running a PI loop steers the internal tick period to zero phase error
+// - an interval of about 2x the estimate or more means ticks were lost - it is
+//   kept out of the history and the tick count skips ahead to the tick that arrived
+void MidiClockPll::handleExtTick(void) {
+    int32_t est, last, interval;
+    int64_t tickTime;
+    double phaseError, periodOut, lockWindow;
+    int lost = 0;
+    // ext sync started
+    if(!extSyncTimeout) {
+        if(handler != NULL) {
+            handler->midiClockExtSyncChanged(1);
+        }
+        extRunTickCount = runTickCount;
+        resetExtLoop();
+    }
+    extSyncTimeout = EXT_SYNC_TIMEOUT;
+    // measure interval - skip the very first time since it will be wrong
+    if(extIntervalCount > 0) {
+        interval = (int32_t)(timeCount - extLastTickTime);
+        if(extIntervalEst > 0 && interval > (extIntervalEst + (extIntervalEst / 2))) {
+            extLongCount ++;
+        }
+        else {
+            extLongCount = 0;
+        }
+        // lost ticks - unless it keeps happening and the tempo really dropped
+        if(extLongCount > 0 && extLongCount <= EXT_LONG_MAX) {
+            lost = ((interval + (extIntervalEst / 2)) / extIntervalEst) - 1;
+        }
+        else {
+            extIntervalHist[(extIntervalCount - 1) & EXT_HIST_MASK] = interval;
+            extIntervalCount ++;
+        }
+    }
+    else {
+        extIntervalCount ++;
+    }
+    extLastTickTime = timeCount;
+    if(runState) {
+        extRunTickCount += midiClockUpsample;
+    }
+    // we need at least EXT_MIN_HIST intervals to run the loop
+    if((extIntervalCount - 1) < EXT_MIN_HIST) {
+        return;
+    }
+    est = getExtIntervalEstimate(extIntervalCount - 1);
+    extIntervalEst = est;
+    if(!lost) {
+        last = extIntervalHist[(extIntervalCount - 2) & EXT_HIST_MASK];
+        extInputDev = (extInputDev * EXT_STATS_FILTER) +
+            ((float)abs(last - est) * (1.0f - EXT_STATS_FILTER));
+        extStats.inputJitter = extInputDev;
+    }
+
+    // stopped - just follow the estimate
+    if(!runState) {
+        extPeriod = est;
+        periodOut = extPeriod;
+    }
+    else {
+        // seed the loop or reseed it if the tempo jumped too far to track
+        if(extPeriod == 0.0 ||
+                fabs(est - extPeriod) > ((extPeriod * 0.04) + (0.5 * taskIntervalUs))) {
+            if(extPeriod != 0.0) {
+                extStats.relockCount ++;
+            }
+            extPeriod = est;
+            extStats.locked = 0;
+            extLockCount = 0;
+            extLockStart = timeCount;
+        }
+        // scheduled time of the internal tick that matches this external tick
+        tickTime = nextTickTime +
+            ((int64_t)(extRunTickCount - 1 - runTickCount) * intUsPerTick);
+        // + phase means internal is ahead of ext, - phase means int is behind ext
+        // - the external tick arrived some time during the last task interval
+        phaseError = (double)(timeCount - (taskIntervalUs / 2) - tickTime);
+        // lost ticks leave the phase error near a whole number of periods
+        // - move the count on to the tick that arrived so the phase isn't disturbed
+        if(lost > 0) {
+            lost = (int)floor((phaseError / extPeriod) + 0.5);
+            if(lost > 0) {
+                extRunTickCount += lost * midiClockUpsample;
+                phaseError -= lost * extPeriod;
+                extStats.lostTicks += lost;
+            }
+        }
+        if(phaseError > extPeriod) {
+            phaseError = extPeriod;
+        }
+        else if(phaseError < -extPeriod) {
+            phaseError = -extPeriod;
+        }
+        // PI loop filter
+        extPeriod += extLoopKi * phaseError;
+        periodOut = extPeriod + (extLoopKp * phaseError);
+
+        // lock detection
+        lockWindow = (double)taskIntervalUs + (extPeriod * 0.02);
+        if(fabs(phaseError) < lockWindow) {
+            if(extLockCount < EXT_LOCK_COUNT) {
+                extLockCount ++;
+            }
+            if(!extStats.locked && extLockCount == EXT_LOCK_COUNT) {
+                extStats.locked = 1;
+                extStats.lockTime = (float)(timeCount - extLockStart) * 0.001f;
+            }
+        }
+        else {
+            extLockCount = 0;
+            if(extStats.locked && fabs(phaseError) > (lockWindow * 2.0)) {
+                extStats.locked = 0;
+                extLockStart = timeCount;
+            }
+        }
+        if(extStats.locked) {
+            extPhaseVar = (extPhaseVar * EXT_STATS_FILTER) +
+                ((float)(phaseError * phaseError) * (1.0f - EXT_STATS_FILTER));
+            extStats.phaseJitter = sqrtf(extPhaseVar);
+        }
+        extStats.phaseError = (float)phaseError;
+    }
+    if(handler != NULL) {
+        handler->midiClockExtSyncUpdated(extStats);
+    }
+
+    // set the internal clock - convert to internal PPQ (might be >24)
+    intUsPerTick = (int32_t)((periodOut / (double)midiClockUpsample) + 0.5);
+    intUsPerTickRem = 0;
+    if(intUsPerTick < usPerTickMin) {
+        intUsPerTick = usPerTickMin;
+    }
+    else if(intUsPerTick > usPerTickMax) {
+        intUsPerTick = usPerTickMax;
+    }
+    // smoothed value for display
+    extSyncTempoAverage = ((float)extSyncTempoAverage * EXT_SYNC_TEMPO_FILTER) +
+        ((float)(extPeriod / (double)midiClockUpsample) * (1.0 - EXT_SYNC_TEMPO_FILTER));
+}
+
+// get the external tick interval estimate from the history
+// - intervals too far from the median are dropped to reject jitter and lost ticks
+// - the rest are averaged so timer task rounding doesn't bias the estimate
+int32_t MidiClockPll::getExtIntervalEstimate(int count) {
+    int32_t sorted[EXT_HIST_LEN];
+    int32_t temp, median, window;
+    int i, j, used = 0;
+    int64_t sum = 0;
+    if(count > EXT_HIST_LEN) {
+        count = EXT_HIST_LEN;
+    }
+    for(i = 0; i < count; i ++) {
+        temp = extIntervalHist[i];
+        for(j = i; j > 0 && sorted[j - 1] > temp; j --) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = temp;
+    }
+    median = sorted[count / 2];
+    window = taskIntervalUs + (median / 8);
+    for(i = 0; i < count; i ++) {
+        if(abs(sorted[i] - median) <= window) {
+            sum += sorted[i];
+            used ++;
+        }
+    }
+    return (int32_t)(sum / used);
+}
+
+// reset the external sync loop
+void MidiClockPll::resetExtLoop(void) {
+    extPeriod = 0.0;
+    extLockCount = 0;
+    extLockStart = timeCount;
+    extPhaseVar = 0.0f;
+    extInputDev = 0.0f;
+    extStats.locked = 0;
+    extStats.lockTime = 0.0f;
+    extStats.phaseError = 0.0f;
+    extStats.phaseJitter = 0.0f;
+    extStats.inputJitter = 0.0f;
+    extStats.relockCount = 0;
+    extStats.lostTicks = 0;
+}
+
 // reset the position
 void MidiClockPll::resetPos(void) {
     runTickCount = 0;
@@ -376,6 +585,10 @@ void MidiClockPll::changeRunState(int run) {
     int isReset = 0;
     desiredRunState = run;
     runState = run;
+    // start a new lock - the phase loop only runs while running
+    extStats.locked = 0;
+    extLockCount = 0;
+    extLockStart = timeCount;
     if(handler != NULL) {
         if(runState && runTickCount == 0) {
             isReset = 1;
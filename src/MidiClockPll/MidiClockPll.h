@@ -10,8 +10,19 @@
 #ifndef MIDI_CLOCK_PLL_H
 #define MIDI_CLOCK_PLL_H
 
-#include "../plugin.hpp"
 #include "../utils/MidiProtocol.h"
+#include <stdint.h>
+
+// external sync loop stats
+struct MidiClockPllStats {
+    int locked;  // 1 = the loop is locked to the external clock
+    float lockTime;  // time taken by the last lock or relock (ms)
+    float phaseError;  // last phase error - + = internal is ahead (us)
+    float phaseJitter;  // RMS phase error while locked (us)
+    float inputJitter;  // average deviation of the received intervals (us)
+    uint32_t relockCount;  // number of tempo jumps that needed a relock
+    uint32_t lostTicks;  // number of external ticks that were detected as lost
+};
 
 // callback handlers for MIDI clock events
 class MidiClockPllHandler {
@@ -39,9 +50,14 @@ public:
 
     // external sync state changed
     virtual void midiClockExtSyncChanged(int synced) { }
+
+    // an external tick was processed by the sync loop - for tracing the loop
+    virtual void midiClockExtSyncUpdated(const MidiClockPllStats& stats) { }
 };
 
 // MIDI clock PLL class
+// - has no Rack dependencies so it can be driven outside the engine
+// - time only advances when timerTask() is called so runs are deterministic
 class MidiClockPll {
 private:
     // settings
@@ -59,14 +75,18 @@ private:
     static constexpr int EXT_HIST_LEN = 8;  // number of historical intervals to average (must be a power of 2)
     static constexpr int EXT_HIST_MASK = (EXT_HIST_LEN - 1);
     static constexpr int EXT_MIN_HIST = 3;  // number of interval samples needed before changing internal clock
+    static constexpr int EXT_LONG_MAX = 3;  // long intervals in a row taken as lost ticks before they count as a tempo change
     static constexpr int EXT_SYNC_TIMEOUT = 125000;  // timeout for receiving external sync (us)
-    static constexpr int EXT_ERROR_ADJ = 500;  // lock adjust amount
+    static constexpr int EXT_LOCK_COUNT = 24;  // ticks within the lock window before we are locked
+    static constexpr float EXT_STATS_FILTER = 0.95f;  // jitter stats average filter coeff
     static constexpr float EXT_SYNC_TEMPO_FILTER = 0.9f;  // tempo average filter coeff
     MidiClockPllHandler *handler;
     int usPerTickMax;  // max allowed us per tick
     int usPerTickMin;  // min allowed us per tick
     int clockInternalPpq;  // the internal PPQ rate of the clock
-    int taskIntervalUs;  // task interval in us
+    int taskIntervalUs;  // task interval in us - whole part
+    double taskIntervalFrac;  // task interval in us - fractional part
+    double taskTimeFrac;  // fractional us built up from the task interval
     int midiClockUpsample;  // upsample ratio
     // general clock state
     int desiredSource;  // 0 = external, 1 = internal
@@ -78,19 +98,34 @@ private:
     int extTickf;  // external tick received flag
     int64_t timeCount;  // running time count
     int64_t nextTickTime;  // time for next tick
+    float tickOffset;  // position of the current tick in the task interval - 0.0 to 1.0
     // internal clock state
     int32_t runTickCount;  // running tick count
     int32_t stopTickCount;  // stopped tick count
     int32_t intUsPerBeat;  // master tempo setting value
     int32_t intUsPerTick;  // number of us per tick (internal)
+    int32_t intUsPerTickRem;  // us per beat left over from intUsPerTick - spread over the beat
+    int32_t intTickRemCount;  // left over us built up - in 1/PPQ us
     int64_t intLastTickTime;  // time of last internal tick
     // external clock recovery state
     int32_t extIntervalHist[EXT_HIST_LEN];
     int32_t extIntervalCount;  // number of historical intervals measured
+    int32_t extIntervalEst;  // last interval estimate - 0 = none yet
+    int extLongCount;  // number of long intervals in a row
     int extSyncTimeout;  // countdown for invalidating clock
     int64_t extLastTickTime;  // time of the last tick received
     int32_t extRunTickCount;  // count of external ticks
     int extSyncTempoAverage;  // average tempo for display
+    // external sync loop filter
+    int extLoopBandwidth;  // loop bandwidth setting
+    float extLoopKp;  // proportional gain
+    float extLoopKi;  // integral gain
+    double extPeriod;  // loop integrator - us per external tick
+    int extLockCount;  // number of ticks in a row within the lock window
+    int64_t extLockStart;  // time when we started trying to lock
+    float extPhaseVar;  // filtered squared phase error while locked
+    float extInputDev;  // filtered interval deviation
+    MidiClockPllStats extStats;
     // tap tempo state
     int tapBeatf;  // tap tempo beat was received
     int64_t tapClockLastTap;  // last tap time
@@ -99,6 +134,9 @@ private:
     int64_t tapHist[TAP_HIST_LEN];
 
     // private methods
+    void handleExtTick(void);
+    int32_t getExtIntervalEstimate(int count);
+    void resetExtLoop(void);
     void resetPos(void);
     void changeRunState(int run);
 
@@ -107,6 +145,12 @@ public:
         SOURCE_EXTERNAL = 0,
         SOURCE_INTERNAL
     };
+    enum LoopBandwidth {
+        LOOP_BW_LOW = 0,  // slow lock - best jitter rejection
+        LOOP_BW_MEDIUM,
+        LOOP_BW_HIGH,  // fast lock and tempo tracking
+        LOOP_BW_NUM_SETTINGS
+    };
 
     // constructor
     MidiClockPll();
@@ -115,7 +159,8 @@ public:
     void registerHandler(MidiClockPllHandler *handler);
 
     // set the task interval in us to calculate tempo
-    void setTaskInterval(int taskIntervalUs);
+    // - the interval can be fractional - i.e. 44 samples at 44.1kHz
+    void setTaskInterval(double taskIntervalUs);
 
     // set the internal PPQ of the clock - i.e. 24 or 96
     void setInternalPpq(int ppq);
@@ -123,6 +168,16 @@ public:
     // run the timer task
     void timerTask(void);
 
+    // get the position of the tick being issued within the task interval
+    // - 0.0 = start of the interval, 1.0 = end of the interval
+    // - only valid during handler callbacks from timerTask() - 0.0 otherwise
+    // - the interval is the one that ended when timerTask() was called, so
+    //   delaying by one task interval puts the tick on the exact sample
+    float getTickOffset(void);
+
+    // get the current tick interval in us
+    int getUsPerTick(void);
+
     // get the MIDI clock source
     int getSource(void);
 
@@ -132,6 +187,15 @@ public:
     // check if the external clock is synced
     int isExtSynced(void);
 
+    // get the external sync loop bandwidth
+    int getLoopBandwidth(void);
+
+    // set the external sync loop bandwidth
+    void setLoopBandwidth(int bandwidth);
+
+    // get the external sync loop stats
+    void getExtSyncStats(MidiClockPllStats *stats);
+
     // get the clock tempo
     float getTempo(void);
 
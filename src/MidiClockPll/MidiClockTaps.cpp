@@ -0,0 +1,168 @@
+/*
+ * MIDI Clock Tap Distributor
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Kilpatrick Audio
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#include "MidiClockTaps.h"
+#include <math.h>
+
+// constructor
+MidiClockTaps::MidiClockTaps() {
+    int i;
+    ppq = 24;  // default
+    nextTick = 0;
+    for(i = 0; i < MAX_TAPS; i ++) {
+        taps[i].num = 0;
+        taps[i].den = 1;
+        taps[i].swing = 0.5f;
+        taps[i].phase = 0.0f;
+        taps[i].nextPulse = 0;
+        updateTap(i);
+    }
+}
+
+// set the clock PPQ - i.e. 24 or 96
+void MidiClockTaps::setPpq(int ppq) {
+    int i;
+    if(ppq < 1) {
+        return;
+    }
+    this->ppq = ppq;
+    for(i = 0; i < MAX_TAPS; i ++) {
+        updateTap(i);
+        alignTap(i, nextTick);
+    }
+}
+
+// set up a tap
+void MidiClockTaps::setTap(int tap, int num, int den, float swing, float phase) {
+    if(tap < 0 || tap >= MAX_TAPS || den < 1) {
+        return;
+    }
+    if(num < 0) {
+        num = 0;
+    }
+    if(swing < 0.5f) {
+        swing = 0.5f;
+    }
+    else if(swing > 0.75f) {
+        swing = 0.75f;
+    }
+    if(phase < 0.0f || phase >= 1.0f) {
+        phase = 0.0f;
+    }
+    if(num == taps[tap].num && den == taps[tap].den &&
+            swing == taps[tap].swing && phase == taps[tap].phase) {
+        return;
+    }
+    taps[tap].num = num;
+    taps[tap].den = den;
+    taps[tap].swing = swing;
+    taps[tap].phase = phase;
+    updateTap(tap);
+    alignTap(tap, nextTick);
+}
+
+// check if a tap is enabled
+int MidiClockTaps::isTapEnabled(int tap) {
+    if(tap < 0 || tap >= MAX_TAPS) {
+        return 0;
+    }
+    return taps[tap].num != 0;
+}
+
+// realign all taps to tick 0 - call on clock position reset
+void MidiClockTaps::reset(void) {
+    int i;
+    nextTick = 0;
+    for(i = 0; i < MAX_TAPS; i ++) {
+        alignTap(i, 0);
+    }
+}
+
+// work out the tap pulses for a clock tick
+int MidiClockTaps::processTick(uint32_t tickCount, MidiClockTapPulse *pulses) {
+    int i, j, count = 0;
+    double pos, tickStart, tickEnd;
+    // the tick count jumped - start from where the clock is now
+    if(tickCount != nextTick) {
+        for(i = 0; i < MAX_TAPS; i ++) {
+            alignTap(i, tickCount);
+        }
+    }
+    nextTick = tickCount + 1;
+    tickStart = (double)tickCount;
+    tickEnd = tickStart + 1.0;
+
+    for(i = 0; i < MAX_TAPS; i ++) {
+        if(taps[i].num == 0) {
+            continue;
+        }
+        // get all pulses for the tap that fall within this tick
+        while((pos = getPulsePos(i, taps[i].nextPulse)) < tickEnd) {
+            taps[i].nextPulse ++;
+            if(count == MAX_PULSES) {
+                continue;
+            }
+            // insert in time order
+            for(j = count; j > 0 && pulses[j - 1].offset > (float)(pos - tickStart); j --) {
+                pulses[j] = pulses[j - 1];
+            }
+            pulses[j].tap = i;
+            pulses[j].offset = (float)(pos - tickStart);
+            pulses[j].period = (float)taps[i].period;
+            pulses[j].minGap = (float)(taps[i].period - taps[i].swingTicks);
+            count ++;
+        }
+    }
+    return count;
+}
+
+//
+// private methods
+//
+// update the timing of a tap after the settings changed
+void MidiClockTaps::updateTap(int tap) {
+    Tap *t = &taps[tap];
+    if(t->num == 0) {
+        t->period = 0.0;
+        t->phaseTicks = 0.0;
+        t->swingTicks = 0.0;
+        return;
+    }
+    t->period = ((double)ppq * (double)t->num) / (double)t->den;
+    t->phaseTicks = (double)t->phase * t->period;
+    // the second pulse of each pair moves from 50% to 75% of the pair
+    t->swingTicks = ((double)t->swing - 0.5) * 2.0 * t->period;
+}
+
+// set the next pulse of a tap to the first one at or after a tick
+void MidiClockTaps::alignTap(int tap, uint32_t tick) {
+    double first;
+    uint64_t pulse = 0;
+    if(taps[tap].num == 0) {
+        taps[tap].nextPulse = 0;
+        return;
+    }
+    first = ceil(((double)tick - taps[tap].phaseTicks) / taps[tap].period) - 1.0;
+    if(first > 0.0) {
+        pulse = (uint64_t)first;
+    }
+    while(getPulsePos(tap, pulse) < (double)tick) {
+        pulse ++;
+    }
+    taps[tap].nextPulse = pulse;
+}
+
+// get the position of a tap pulse in ticks
+double MidiClockTaps::getPulsePos(int tap, uint64_t pulse) {
+    double pos = ((double)pulse * taps[tap].period) + taps[tap].phaseTicks;
+    if(pulse & 0x01) {
+        pos += taps[tap].swingTicks;
+    }
+    return pos;
+}
@@ -0,0 +1,77 @@
+/*
+ * MIDI Clock Tap Distributor
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Kilpatrick Audio
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#ifndef MIDI_CLOCK_TAPS_H
+#define MIDI_CLOCK_TAPS_H
+
+#include <stdint.h>
+
+// a pulse produced by a tap during a tick
+struct MidiClockTapPulse {
+    int tap;  // tap index
+    float offset;  // position within the tick - 0.0 to <1.0
+    float period;  // tap period in ticks
+    float minGap;  // shortest time between pulses of the tap in ticks - shortened by swing
+};
+
+// derives divided and multiplied clock taps from the PLL ticks
+// - all taps are worked out together once per tick
+// - multiplied taps land between ticks so each pulse has an offset
+// - has no Rack dependencies like the PLL
+class MidiClockTaps {
+public:
+    static constexpr int MAX_TAPS = 8;
+    static constexpr int MAX_PULSES = 64;  // max pulses returned for a tick
+
+private:
+    struct Tap {
+        int num;  // rate in quarter notes - numerator - 0 = off
+        int den;  // rate in quarter notes - denominator
+        float swing;  // 0.5 = straight - 0.75 = max
+        float phase;  // phase offset - 0.0 to <1.0 of the period
+        double period;  // period in ticks
+        double phaseTicks;  // phase offset in ticks
+        double swingTicks;  // odd pulse delay in ticks
+        uint64_t nextPulse;  // index of the next pulse
+    };
+    Tap taps[MAX_TAPS];
+    int ppq;  // clock ticks per quarter note
+    uint32_t nextTick;  // tick count expected on the next tick
+
+    // private methods
+    void updateTap(int tap);
+    void alignTap(int tap, uint32_t tick);
+    double getPulsePos(int tap, uint64_t pulse);
+
+public:
+    // constructor
+    MidiClockTaps();
+
+    // set the clock PPQ - i.e. 24 or 96
+    void setPpq(int ppq);
+
+    // set up a tap
+    // - the rate is num / den quarter notes - num = 0 turns the tap off
+    // - swing delays every second pulse - 0.5 = straight - 0.75 = max
+    // - phase delays all pulses by a fraction of the period - 0.0 to <1.0
+    void setTap(int tap, int num, int den, float swing, float phase);
+
+    // check if a tap is enabled
+    int isTapEnabled(int tap);
+
+    // realign all taps to tick 0 - call on clock position reset
+    void reset(void);
+
+    // work out the tap pulses for a clock tick
+    // - pulses are returned in time order
+    // returns the number of pulses
+    int processTick(uint32_t tickCount, MidiClockTapPulse *pulses);
+};
+
+#endif
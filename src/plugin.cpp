@@ -21,6 +21,9 @@
  *
  */
 #include "plugin.hpp"
+#ifdef KA_MIDI_LOOPBACK
+#include "utils/MidiLoopback.h"
+#endif
 
 Plugin* pluginInstance;
 
@@ -46,4 +49,7 @@ void init(Plugin* p) {
     p->addModel(modelMIDI_Clock);
     p->addModel(modelMIDI_CC_Note);
     p->addModel(modelMulti_Meter);
+#ifdef KA_MIDI_LOOPBACK
+    MidiLoopback::init();  // in-process MIDI driver for testing without hardware
+#endif
 }
@@ -11,40 +11,256 @@
 #define CV_MIDI_H
 
 #include <rack.hpp>
+#include "ExpanderMidi.h"
+#include "MenuHelper.h"
+#include "MidiCoalesce.h"
+#include "PUtils.h"
+#include "SpscQueue.h"
+
+#ifndef CVMIDI_QUEUE_LEN
+#define CVMIDI_QUEUE_LEN 8192  // message words per port - must be a power of 2
+#endif
+#ifndef CVMIDI_RT_QUEUE_LEN
+#define CVMIDI_RT_QUEUE_LEN 256  // clock / transport words per output port - must be a power of 2
+#endif
+
+// a queued message word and the sample it was queued on
+struct CVMidiWord {
+    int word;
+    uint32_t time;
+};
 
 // CV MIDI adapter
 struct CVMidi {
+public:
+    static constexpr int LATENCY_BUCKETS = 16;  // 0, 1, 2-3, 4-7 ... >= 16384 samples
+
 private:
     Port *port;  // port for sending or receiving
     int isInput;  // 1 = port is input, 0 = port is output
-    midi::InputQueue msgQueue;  // a queue to handle messages
+    SpscQueue<CVMidiWord, CVMIDI_QUEUE_LEN> msgQueue;  // a queue of encoded message words
+    SpscQueue<CVMidiWord, CVMIDI_RT_QUEUE_LEN> rtQueue;  // clock and transport words sent ahead of msgQueue
     int MIDI_LED_TIMEOUT = 1920;  // sample periods
     int ledTimeout;
+    int burstMode;  // 1 = pack multiple messages into poly lanes on output
+    int outputIdle;  // 1 = output is already set to the idle value
+    Module *expanderModule;  // module that owns the port - NULL = expander not used
+    ExpanderMidiMessage *expanderMsgs;  // left expander double buffer - inputs only
+    int expanderSend;  // 1 = send to the module on the right when the output is unpatched
+    int coalesceMode;  // 1 = replace queued controller values with newer ones on output
+    uint32_t coalesceCount;  // number of messages replaced by newer ones
+    MidiCoalesceTable coalesceTable;  // queued messages that can be replaced by newer ones
+    int sysexOpen;  // 1 = a SYSEX start was queued without its end
+    uint32_t sysexEndPos;  // queue position after the last queued SYSEX word
+    std::string name;  // port name for stats
+    uint32_t sampleCount;  // time base for latency stats
+    int rateTimer;  // sample periods counted for the rate window
+    int rateWindow;  // sample periods per rate window - 1 second
+    uint32_t rateCount;  // message words delivered in the current rate window
+    uint32_t msgRate;  // message words delivered in the last rate window
+    uint32_t latencyHist[LATENCY_BUCKETS];  // message words by time spent queued
 
 public:
+    static constexpr int BURST_MAX_LANES = PORT_MAX_CHANNELS;  // max messages per sample in burst mode
+
     // constructor
     CVMidi(Port *port, int isInput) {
         this->port = port;
         this->isInput = isInput;
         ledTimeout = 0;
+        burstMode = 0;
+        outputIdle = 0;
+        expanderModule = NULL;
+        expanderMsgs = NULL;
+        expanderSend = 0;
+        coalesceMode = 0;
+        coalesceCount = 0;
+        sysexOpen = 0;
+        sysexEndPos = 0;
+        sampleCount = 0;
+        rateWindow = 48000;
+        resetStats();
+    }
+
+    // destructor
+    ~CVMidi() {
+        if(expanderMsgs != NULL) {
+            expanderModule->leftExpander.producerMessage = NULL;
+            expanderModule->leftExpander.consumerMessage = NULL;
+            delete[] expanderMsgs;
+        }
+    }
+
+    // use the expander bus for adjacent modules
+    // - an input receives from the module on the left as well as the cable
+    // - an output can send to the module on the right - see setExpanderSend()
+    // - only one input per module can receive from the expander
+    void setExpanderModule(Module *module) {
+        if(expanderModule != NULL) {
+            return;
+        }
+        expanderModule = module;
+        if(isInput) {
+            expanderMsgs = new ExpanderMidiMessage[2];
+            module->leftExpander.producerMessage = &expanderMsgs[0];
+            module->leftExpander.consumerMessage = &expanderMsgs[1];
+        }
+    }
+
+    // get the expander send state
+    int getExpanderSend(void) {
+        return expanderSend;
+    }
+
+    // send messages to the module on the right when the output has no cable
+    void setExpanderSend(int enable) {
+        if(isInput || expanderModule == NULL) {
+            return;
+        }
+        expanderSend = (enable != 0);
+    }
+
+    // get the port name
+    std::string getName(void) {
+        return name;
+    }
+
+    // set the port name shown with the stats
+    void setName(std::string name) {
+        this->name = name;
     }
 
     // get an input message from a port
     // 0 for no message, 1 if message received
     int getInputMessage(midi::Message *msg) {
-        if(msgQueue.tryPop(msg, INT64_MAX) == true) {
+        int msgWord;
+        if(popWord(&msgWord)) {
+            decodeMessage(msgWord, msg);
             return 1;
         }
         return 0;
     }
 
     // send an output message to a port
+    // long SYSEX messages are split into 3 byte words and queued all at once
+    // clock and transport messages jump ahead of other queued messages
     // returns -1 on error
     int sendOutputMessage(const midi::Message& msg) {
-        msgQueue.onMessage(msg);
+        int i, numWords, msgWord;
+        if(msg.getSize() < 1) {
+            return -1;
+        }
+        if(isPriorityMessage(msg)) {
+            return pushWord(&rtQueue, encodeMessage(msg));
+        }
+        if(msg.getSize() <= 3) {
+            if(coalesceMessage(msg) == -1) {
+                return -1;
+            }
+            trackSysex(msg);
+            return 0;
+        }
+        // make sure the whole dump fits so it is never truncated
+        numWords = (msg.getSize() + 2) / 3;
+        if(numWords > (msgQueue.capacity() - msgQueue.size())) {
+            return -1;
+        }
+        for(i = 0; i < msg.getSize(); i += 3) {
+            msgWord = msg.bytes[i] << 16;
+            if((i + 1) < msg.getSize()) {
+                msgWord |= msg.bytes[i + 1] << 8;
+            }
+            if((i + 2) < msg.getSize()) {
+                msgWord |= msg.bytes[i + 2];
+            }
+            pushWord(&msgQueue, msgWord);
+        }
+        trackSysex(msg);
         return 0;
     }
 
+    // get the number of messages waiting in the queue
+    int getQueueSize(void) {
+        return msgQueue.size() + rtQueue.size();
+    }
+
+    // get the number of messages dropped because the queue was full
+    uint32_t getQueueOverflows(void) {
+        return msgQueue.getOverflowCount() + rtQueue.getOverflowCount();
+    }
+
+    // get the max number of messages that were waiting in the queue
+    uint32_t getQueueHighWater(void) {
+        return msgQueue.getHighWater();
+    }
+
+    // get the number of message words delivered in the last second
+    uint32_t getMessageRate(void) {
+        return msgRate;
+    }
+
+    // get the number of message words that waited in the queue for a latency bucket
+    // - bucket 0 = 0 samples, bucket n = 2^(n-1) to 2^n - 1 samples
+    uint32_t getLatencyCount(int bucket) {
+        if(bucket < 0 || bucket >= LATENCY_BUCKETS) {
+            return 0;
+        }
+        return latencyHist[bucket];
+    }
+
+    // reset the stats
+    void resetStats(void) {
+        msgQueue.resetStats();
+        rtQueue.resetStats();
+        coalesceCount = 0;
+        rateTimer = 0;
+        rateCount = 0;
+        msgRate = 0;
+        memset(latencyHist, 0, sizeof(latencyHist));
+    }
+
+    // save the stats to a JSON object under the port name
+    void statsToJson(json_t *rootJ) {
+        json_t *statsJ, *histJ;
+        int i;
+        statsJ = json_object();
+        json_object_set_new(statsJ, "rate", json_integer(msgRate));
+        json_object_set_new(statsJ, "queueSize", json_integer(getQueueSize()));
+        json_object_set_new(statsJ, "queuePeak", json_integer(getQueueHighWater()));
+        json_object_set_new(statsJ, "dropped", json_integer(getQueueOverflows()));
+        json_object_set_new(statsJ, "coalesced", json_integer(coalesceCount));
+        histJ = json_array();
+        for(i = 0; i < LATENCY_BUCKETS; i ++) {
+            json_array_append_new(histJ, json_integer(latencyHist[i]));
+        }
+        json_object_set_new(statsJ, "latency", histJ);
+        json_object_set_new(rootJ, name.c_str(), statsJ);
+    }
+
+    // save the stats for a list of ports to a "vmidiStats" object
+    static void statsListToJson(json_t *rootJ, const std::vector<CVMidi *>& ports) {
+        json_t *statsJ = json_object();
+        int i;
+        for(i = 0; i < (int)ports.size(); i ++) {
+            ports[i]->statsToJson(statsJ);
+        }
+        json_object_set_new(rootJ, "vmidiStats", statsJ);
+    }
+
+    // check if the port is idle - no cable, nothing queued and LED off
+    // a module can skip its processing if all of its ports are idle
+    int isIdle(void) {
+        if(port->isConnected() || ledTimeout || !msgQueue.isEmpty() ||
+                !rtQueue.isEmpty()) {
+            return 0;
+        }
+        // a module on the left might send over the expander
+        if(expanderMsgs != NULL && expanderModule->leftExpander.module != NULL) {
+            return 0;
+        }
+        return isInput || outputIdle;
+    }
+
     // get the state of the activity LED
     int getLedState(void) {
         if(ledTimeout) {
@@ -53,10 +269,47 @@ public:
         return 0;
     }
 
+    // get the coalesce mode state
+    int getCoalesceMode(void) {
+        return coalesceMode;
+    }
+
+    // set coalesce mode on an output - a continuous CC, pitch bend or channel pressure
+    // that is still queued is replaced when a newer value for the same control is sent
+    void setCoalesceMode(int enable) {
+        if(isInput) {
+            return;
+        }
+        coalesceMode = (enable != 0);
+    }
+
+    // get the number of messages that were replaced by newer ones
+    uint32_t getCoalesceCount(void) {
+        return coalesceCount;
+    }
+
+    // get the burst mode state
+    int getBurstMode(void) {
+        return burstMode;
+    }
+
+    // set burst mode on an output - up to BURST_MAX_LANES messages are sent per sample
+    // lane 0 always carries the oldest message so mono receivers still get valid data
+    void setBurstMode(int enable) {
+        if(isInput || (enable != 0) == (burstMode != 0)) {
+            return;
+        }
+        burstMode = (enable != 0);
+        if(!burstMode) {
+            port->setChannels(1);
+        }
+        outputIdle = 0;
+    }
+
     // process input and output messages - run at samplerate
     void process(void) {
-        int msgWord;
-        midi::Message msg;
+        int lane, numLanes, msgWord, i;
+        ExpanderMidiMessage *expMsg;
 
         //
         // float can hold a 24 bit int with no rounding error
@@ -65,83 +318,85 @@ public:
         //  - bits: 15-8: message byte 1 - 8 bits
         //  - bits: 7-0: message byte 2 - 8 bits
         //
+        // burst mode packs messages into poly lanes starting at lane 0
+        // and the first lane that is not negative ends the burst
+        //
+        // a word of 0 (SYSEX data) is sent as -0.0f so the sign bit
+        // is checked instead of comparing to 0.0f
+        //
         // input messages and send them to MIDI lib
         if(isInput) {
-            // port is connected and value is negative
-            if(port->getVoltage() < 0.0f) {
-                msgWord = roundf(-port->getVoltage());  // convert voltage to int
-                msg.setSize(3);
-                msg.bytes[0] = (msgWord >> 16) & 0xff;
-                msg.bytes[1] = (msgWord >> 8) & 0xff;
-                msg.bytes[2] = msgWord & 0xff;
-                // figure out the length
-                switch(msg.bytes[0] & 0xf0) {
-                    case 0x80:  // note off
-                    case 0x90:  // note on
-                    case 0xa0:  // poly pressure
-                    case 0xb0:  // control change
-                    case 0xe0:  // pitch bend
-                        msg.setSize(3);
-                        break;
-                    case 0xc0:  // program change
-                    case 0xd0:  // channel pressure
-                        msg.setSize(2);
-                        break;
-                    default:  // system messages or SYSEX
-                        switch(msg.bytes[0]) {
-                            case 0xf0:  // SYSEX start
-                                msg.setSize(3);  // almost certainly >=3 bytes
-                                break;
-                            case 0xf1:  // MTC Qframe
-                            case 0xf3:  // song select
-                                msg.setSize(2);
-                                break;
-                            case 0xf2:  // song position
-                                msg.setSize(3);
-                                break;
-                            case 0xf4:  // undefined
-                            case 0xf5:  // undefined
-                            case 0xf6:  // tune request
-                            case 0xf7:  // end of exclusive
-                            case 0xf8:  // timing clock
-                            case 0xf9:  // undefined
-                            case 0xfa:  // clock start
-                            case 0xfb:  // clock continue
-                            case 0xfc:  // clock stop
-                            case 0xfd:  // undefined
-                            case 0xfe:  // active sensing
-                            case 0xff:  // system reset
-                                msg.setSize(1);
-                                break;
-                            default:  // SYSEX continuation / end
-                                // SYSEX end on 2nd byte
-                                if(msg.bytes[1] == 0xf7) {
-                                    msg.setSize(2);
-                                }
-                                // sysex end on 3rd byte or other data
-                                else {
-                                    msg.setSize(3);
-                                }
-                                break;
-                        }
-                        break;
+            // messages from the module on the left over the expander
+            if(expanderMsgs != NULL) {
+                expMsg = (ExpanderMidiMessage *)expanderModule->leftExpander.consumerMessage;
+                if(expMsg->numWords) {
+                    for(i = 0; i < expMsg->numWords; i ++) {
+                        pushWord(&msgQueue, expMsg->words[i]);
+                    }
+                    expMsg->numWords = 0;
+                    ledTimeout = MIDI_LED_TIMEOUT;
                 }
-                sendOutputMessage(msg);
+            }
+            // nothing can arrive without a cable
+            if(!port->isConnected()) {
+                numLanes = 0;
+            }
+            else {
+                numLanes = port->getChannels();
+            }
+            for(lane = 0; lane < numLanes; lane ++) {
+                // value is negative
+                if(!std::signbit(port->getVoltage(lane))) {
+                    break;
+                }
+                pushWord(&msgQueue, roundf(-port->getVoltage(lane)));
+                ledTimeout = MIDI_LED_TIMEOUT;
+            }
+        }
+        // output messages to the module on the right over the expander
+        // - everything queued is sent at once up to the size of the message
+        else if(expanderSend && !port->isConnected() &&
+                (expMsg = ExpanderMidiMessage::getSendMessage(expanderModule)) != NULL) {
+            numLanes = 0;
+            while(numLanes < EXPANDER_MIDI_MAX_WORDS) {
+                // no more messages are ready
+                if(!popWord(&msgWord)) {
+                    break;
+                }
+                expMsg->words[numLanes] = msgWord;
+                numLanes ++;
+            }
+            if(numLanes) {
+                expMsg->numWords = numLanes;
+                expanderModule->rightExpander.module->leftExpander.requestMessageFlip();
                 ledTimeout = MIDI_LED_TIMEOUT;
             }
+            outputIdle = 0;
         }
         // output messages from MIDI lib to port
-        else {
-            // a message is ready
-            if(getInputMessage(&msg)) {
-                msgWord = (msg.bytes[0] & 0xff) << 16;
-                msgWord |= (msg.bytes[1] & 0xff) << 8;
-                msgWord |= msg.bytes[2] & 0xff;
-                port->setVoltage(-(float)msgWord);
+        // - once the idle value is set nothing is done until a message is queued
+        else if(!outputIdle || !msgQueue.isEmpty() || !rtQueue.isEmpty()) {
+            numLanes = 1;
+            if(burstMode) {
+                numLanes = BURST_MAX_LANES;
+            }
+            for(lane = 0; lane < numLanes; lane ++) {
+                // no more messages are ready
+                if(!popWord(&msgWord)) {
+                    break;
+                }
+                port->setVoltage(-(float)msgWord, lane);
                 ledTimeout = MIDI_LED_TIMEOUT;
             }
-            else {
+            // nothing sent
+            outputIdle = 0;
+            if(lane == 0) {
                 port->setVoltage(0.0f);
+                lane = 1;
+                outputIdle = 1;
+            }
+            if(burstMode) {
+                port->setChannels(lane);
             }
         }
 
@@ -149,7 +404,266 @@ public:
         if(ledTimeout) {
             ledTimeout --;
         }
+
+        // message rate
+        sampleCount ++;
+        rateTimer ++;
+        if(rateTimer >= rateWindow) {
+            msgRate = rateCount;
+            rateCount = 0;
+            rateTimer = 0;
+            rateWindow = (int)APP->engine->getSampleRate();
+        }
+    }
+
+private:
+    // queue a message word with the time it was queued
+    // returns -1 on error
+    template <typename Q>
+    int pushWord(Q *queue, int msgWord) {
+        CVMidiWord w;
+        w.word = msgWord;
+        w.time = sampleCount;
+        return queue->push(w);
+    }
+
+    // get the next message word - clock and transport go first
+    // returns 0 for no word, 1 if a word was popped
+    int popWord(int *msgWord) {
+        CVMidiWord w;
+        uint32_t latency;
+        int bucket;
+        if(!rtQueue.pop(&w) && !msgQueue.pop(&w)) {
+            return 0;
+        }
+        *msgWord = w.word;
+        // stats
+        rateCount ++;
+        latency = sampleCount - w.time;
+        bucket = 0;
+        while(latency && bucket < (LATENCY_BUCKETS - 1)) {
+            latency >>= 1;
+            bucket ++;
+        }
+        latencyHist[bucket] ++;
+        return 1;
+    }
+
+    // queue a message and replace an older value for the same control if still queued
+    // - other channel messages are kept in order - see MidiCoalesceTable
+    // returns -1 on error
+    int coalesceMessage(const midi::Message& msg) {
+        int msgWord, mask, status, data0;
+        CVMidiWord *queued;
+        uint32_t pos;
+        msgWord = encodeMessage(msg);
+        status = (msgWord >> 16) & 0xff;
+        data0 = (msgWord >> 8) & 0xff;
+        if(coalesceMode && coalesceTable.find(status, data0, &pos)) {
+            // replace the old value in place so it keeps its place in line
+            // - match status and CC number or just status for PB / CP
+            mask = ((status & 0xf0) == MIDI_CONTROL_CHANGE) ? 0xffff00 : 0xff0000;
+            queued = msgQueue.getQueued(pos);
+            if(queued != NULL && (queued->word & mask) == (msgWord & mask)) {
+                queued->word = msgWord;
+                coalesceCount ++;
+                return 0;
+            }
+        }
+        pos = msgQueue.getWritePos();
+        if(pushWord(&msgQueue, msgWord) == -1) {
+            return -1;
+        }
+        coalesceTable.queued(status, data0, pos);
+        return 0;
+    }
+
+    // check if a message should be sent in the priority lane
+    // - system realtime and song position so transport stays in order
+    // - song position would end a SYSEX dump so it waits behind a partly sent dump
+    int isPriorityMessage(const midi::Message& msg) {
+        if(isInput) {
+            return 0;
+        }
+        if(msg.bytes[0] == 0xf2) {
+            return !sysexOpen && msgQueue.getQueued(sysexEndPos - 1) == NULL;
+        }
+        return msg.bytes[0] >= 0xf8;
+    }
+
+    // keep track of SYSEX words in the message queue - after a message is queued
+    void trackSysex(const midi::Message& msg) {
+        int i;
+        for(i = 0; i < msg.getSize(); i ++) {
+            if(msg.bytes[i] == 0xf0) {
+                sysexOpen = 1;
+            }
+            else if(msg.bytes[i] == 0xf7) {
+                sysexOpen = 0;
+            }
+            else if(msg.bytes[i] & 0x80) {
+                sysexOpen = 0;  // any other status ends a dump
+                return;
+            }
+        }
+        sysexEndPos = msgQueue.getWritePos();
+    }
+
+    // encode a message into a message word - unused bytes are sent as 0
+    int encodeMessage(const midi::Message& msg) {
+        int msgWord;
+        msgWord = (msg.bytes[0] & 0xff) << 16;
+        if(msg.getSize() > 1) {
+            msgWord |= (msg.bytes[1] & 0xff) << 8;
+        }
+        if(msg.getSize() > 2) {
+            msgWord |= msg.bytes[2] & 0xff;
+        }
+        return msgWord;
+    }
+
+    // decode a message word into a message and figure out the length
+    void decodeMessage(int msgWord, midi::Message *msg) {
+        msg->setSize(3);
+        msg->bytes[0] = (msgWord >> 16) & 0xff;
+        msg->bytes[1] = (msgWord >> 8) & 0xff;
+        msg->bytes[2] = msgWord & 0xff;
+        // figure out the length
+        switch(msg->bytes[0] & 0xf0) {
+            case 0x80:  // note off
+            case 0x90:  // note on
+            case 0xa0:  // poly pressure
+            case 0xb0:  // control change
+            case 0xe0:  // pitch bend
+                msg->setSize(3);
+                break;
+            case 0xc0:  // program change
+            case 0xd0:  // channel pressure
+                msg->setSize(2);
+                break;
+            default:  // system messages or SYSEX
+                switch(msg->bytes[0]) {
+                    case 0xf0:  // SYSEX start
+                        msg->setSize(3);  // almost certainly >=3 bytes
+                        break;
+                    case 0xf1:  // MTC Qframe
+                    case 0xf3:  // song select
+                        msg->setSize(2);
+                        break;
+                    case 0xf2:  // song position
+                        msg->setSize(3);
+                        break;
+                    case 0xf4:  // undefined
+                    case 0xf5:  // undefined
+                    case 0xf6:  // tune request
+                    case 0xf7:  // end of exclusive
+                    case 0xf8:  // timing clock
+                    case 0xf9:  // undefined
+                    case 0xfa:  // clock start
+                    case 0xfb:  // clock continue
+                    case 0xfc:  // clock stop
+                    case 0xfd:  // undefined
+                    case 0xfe:  // active sensing
+                    case 0xff:  // system reset
+                        msg->setSize(1);
+                        break;
+                    default:  // SYSEX continuation / end
+                        // SYSEX end on 2nd byte
+                        if(msg->bytes[1] == 0xf7) {
+                            msg->setSize(2);
+                        }
+                        // sysex end on 3rd byte or other data
+                        else {
+                            msg->setSize(3);
+                        }
+                        break;
+                }
+                break;
+        }
     }
 };
 
+// vMIDI stats reset menu item
+struct CVMidiStatsResetMenuItem : MenuItem {
+    CVMidi *cvMidi;
+
+    // create a stats reset menu item
+    CVMidiStatsResetMenuItem(CVMidi *cvMidi) {
+        this->cvMidi = cvMidi;
+        this->text = "Reset Stats";
+    }
+
+    // the menu item was selected
+    void onAction(const event::Action &e) override {
+        cvMidi->resetStats();
+    }
+};
+
+// vMIDI port stats menu item - shows the stats for a port in a submenu
+struct CVMidiStatsMenuItem : MenuItem {
+    CVMidi *cvMidi;
+
+    // create a stats menu item
+    CVMidiStatsMenuItem(CVMidi *cvMidi) {
+        this->cvMidi = cvMidi;
+        this->text = cvMidi->getName();
+        this->rightText = putils::format("%u msg/s ", cvMidi->getMessageRate()) + RIGHT_ARROW;
+    }
+
+    // create the stats submenu
+    Menu *createChildMenu(void) override {
+        Menu *menu = new Menu;
+        int i;
+        menu->addChild(createMenuLabel(putils::format("Rate: %u msg/s", cvMidi->getMessageRate())));
+        menu->addChild(createMenuLabel(putils::format("Queue: %d (peak: %u)",
+            cvMidi->getQueueSize(), cvMidi->getQueueHighWater())));
+        menu->addChild(createMenuLabel(putils::format("Dropped: %u", cvMidi->getQueueOverflows())));
+        menu->addChild(createMenuLabel(putils::format("Coalesced: %u", cvMidi->getCoalesceCount())));
+        menu->addChild(createMenuLabel("Time Queued (samples):"));
+        for(i = 0; i < CVMidi::LATENCY_BUCKETS; i ++) {
+            if(cvMidi->getLatencyCount(i) == 0) {
+                continue;
+            }
+            if(i < 2) {
+                menu->addChild(createMenuLabel(putils::format("  %d: %u", i, cvMidi->getLatencyCount(i))));
+            }
+            else if(i == (CVMidi::LATENCY_BUCKETS - 1)) {
+                menu->addChild(createMenuLabel(putils::format("  %d+: %u", 1 << (i - 1), cvMidi->getLatencyCount(i))));
+            }
+            else {
+                menu->addChild(createMenuLabel(putils::format("  %d-%d: %u", 1 << (i - 1), (1 << i) - 1,
+                    cvMidi->getLatencyCount(i))));
+            }
+        }
+        menu->addChild(new CVMidiStatsResetMenuItem(cvMidi));
+        return menu;
+    }
+};
+
+// add the vMIDI output settings to a menu
+inline void menuHelperAddVmidiOutputs(Menu *menu, Param *burstParam, Param *coalesceParam,
+        Param *expanderParam) {
+    menuHelperAddSpacer(menu);
+    menuHelperAddLabel(menu, "vMIDI Outputs");
+    menuHelperAddItem(menu, new MenuHelperParamToggleItem("Burst Mode (16 msgs / sample)",
+        burstParam));
+    menuHelperAddItem(menu, new MenuHelperParamToggleItem("Coalesce Queued CC / Bend / Pressure",
+        coalesceParam));
+    menuHelperAddItem(menu, new MenuHelperParamToggleItem("Send to Right Module (Expander)",
+        expanderParam));
+}
+
+// add the vMIDI port stats to a menu
+inline void menuHelperAddVmidiStats(Menu *menu, const std::vector<CVMidi *>& ports,
+        Param *statsJsonParam) {
+    int i;
+    menuHelperAddSpacer(menu);
+    menuHelperAddLabel(menu, "vMIDI Stats");
+    for(i = 0; i < (int)ports.size(); i ++) {
+        menuHelperAddItem(menu, new CVMidiStatsMenuItem(ports[i]));
+    }
+    menuHelperAddItem(menu, new MenuHelperParamToggleItem("Save Stats in Patch",
+        statsJsonParam));
+}
+
 #endif
@@ -0,0 +1,52 @@
+/*
+ * vMIDI Over the Expander Bus
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Andrew Kilpatrick
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#ifndef EXPANDER_MIDI_H
+#define EXPANDER_MIDI_H
+
+#include <rack.hpp>
+
+#define EXPANDER_MIDI_MAX_WORDS 512  // max message words sent per sample
+#define EXPANDER_MIDI_MAGIC 0x764d4944  // "vMID"
+
+// a batch of vMIDI message words sent to the module on the right
+// - the receiving module owns a pair of these as its left expander messages
+// - words are encoded the same as on a vMIDI cable
+struct ExpanderMidiMessage {
+    uint32_t magic;  // set to EXPANDER_MIDI_MAGIC by the receiver
+    int numWords;  // number of valid words - cleared by the receiver once read
+    int words[EXPANDER_MIDI_MAX_WORDS];
+
+    // constructor
+    ExpanderMidiMessage() {
+        magic = EXPANDER_MIDI_MAGIC;
+        numWords = 0;
+    }
+
+    // get the message to fill in for the module on the right of a module
+    // returns NULL if the module on the right does not receive vMIDI
+    static ExpanderMidiMessage *getSendMessage(Module *module) {
+        Module *right = module->rightExpander.module;
+        ExpanderMidiMessage *msg;
+        if(right == NULL || right->model == NULL || module->model == NULL) {
+            return NULL;
+        }
+        // only trust expander messages from our own modules
+        if(right->model->plugin != module->model->plugin) {
+            return NULL;
+        }
+        msg = (ExpanderMidiMessage *)right->leftExpander.producerMessage;
+        if(msg == NULL || msg->magic != EXPANDER_MIDI_MAGIC) {
+            return NULL;
+        }
+        return msg;
+    }
+};
+
+#endif
@@ -24,6 +24,36 @@ void MenuHelperUrlItem::onAction(const event::Action& e) {
 	t.detach();
 }
 
+// create a param toggle menu item
+MenuHelperParamToggleItem::MenuHelperParamToggleItem(std::string text, Param *param) {
+    this->text = text;
+    this->param = param;
+    this->rightText = CHECKMARK(param->getValue() > 0.5f);
+}
+
+// the menu item was selected
+void MenuHelperParamToggleItem::onAction(const event::Action& e) {
+    if(param->getValue() > 0.5f) {
+        param->setValue(0.0f);
+    }
+    else {
+        param->setValue(1.0f);
+    }
+}
+
+// create a param value menu item
+MenuHelperParamValueItem::MenuHelperParamValueItem(std::string text, Param *param, float value) {
+    this->text = text;
+    this->param = param;
+    this->value = value;
+    this->rightText = CHECKMARK(param->getValue() == value);
+}
+
+// the menu item was selected
+void MenuHelperParamValueItem::onAction(const event::Action& e) {
+    param->setValue(value);
+}
+
 // add a spacer to a menu
 void menuHelperAddSpacer(Menu *menu) {
     menu->addChild(new MenuLabel());
@@ -23,6 +23,29 @@ struct MenuHelperUrlItem : MenuItem {
 	void onAction(const event::Action& e) override;
 };
 
+// param toggle menu item - flips a param that holds an on / off setting
+struct MenuHelperParamToggleItem : MenuItem {
+    Param *param;
+
+    // create a param toggle menu item
+    MenuHelperParamToggleItem(std::string text, Param *param);
+
+    // the menu item was selected
+    void onAction(const event::Action& e) override;
+};
+
+// param value menu item - sets a param to one of a list of values
+struct MenuHelperParamValueItem : MenuItem {
+    Param *param;
+    float value;
+
+    // create a param value menu item
+    MenuHelperParamValueItem(std::string text, Param *param, float value);
+
+    // the menu item was selected
+    void onAction(const event::Action& e) override;
+};
+
 // add a spacer to a menu
 void menuHelperAddSpacer(Menu *menu);
 
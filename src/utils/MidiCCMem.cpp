@@ -8,6 +8,7 @@
  *
  */
 #include "MidiCCMem.h"
+#include <string.h>
 
 // constructor
 MidiCCMem::MidiCCMem() {
@@ -22,24 +23,12 @@ void MidiCCMem::setTimeout(int timeout) {
 
 // process timeouts
 void MidiCCMem::process() {
-    std::vector<MidiCCHist>::iterator iter;
-    int i;
-    // check each channel list
-    for(i = 0; i < MIDI_NUM_CHANNELS; i ++) {
-        // time out messages for channel
-        iter = repeatHist[i].begin();
-        while(iter != repeatHist[i].end()) {
-            if(iter->timeout > 0) {
-                iter->timeout --;
-                // timed out
-                if(iter->timeout == 0) {
-                    iter = repeatHist[i].erase(iter);
-                    continue;
-                }
-            }
-            ++iter;
-        }
-    }
+    tick ++;
+}
+
+// advance the timeouts by a number of process ticks - i.e. after being idle
+void MidiCCMem::advance(uint32_t ticks) {
+    tick += ticks;
 }
 
 // handle a CC message
@@ -47,39 +36,30 @@ void MidiCCMem::process() {
 //  - 1 = CC already known with this value
 //  - 0 = CC not known or different value / message type
 int MidiCCMem::handleCC(const midi::Message& msg) {
-    MidiCCHist hist;
-    int chan;
-    std::vector<MidiCCHist>::iterator iter;
+    int chan, cc, isKnown;
     if((msg.bytes[0] & 0xf0) != MIDI_CONTROL_CHANGE) {
         return 0;
     }
     chan = msg.bytes[0] & 0x0f;
-    // see if we already have this CC
-    for(iter = repeatHist[chan].begin(); iter != repeatHist[chan].end(); iter ++) {
-        // CC matches matches for this channel
-        if(iter->msg.bytes[1] == msg.bytes[1]) {
-            // value matches
-            if(iter->msg.bytes[2] == msg.bytes[2]) {
-                iter->timeout = timeout;  // reset timeout
-                return 1;  // already know this value
-            }
-            // value doesn't match
-            iter->msg = msg;  // update stored message
-            iter->timeout = timeout;  // reset timeout
-            return 0;
-        }
+    cc = msg.bytes[1] & 0x7f;
+    // see if we already have this CC and it hasn't timed out
+    isKnown = known[chan][cc];
+    if(isKnown && timeout > 0 && (tick - touched[chan][cc]) >= (uint32_t)timeout) {
+        isKnown = 0;
     }
-    // CC not found in list
-    hist.msg = msg;
-    hist.timeout = timeout;
-    repeatHist[chan].push_back(hist);
+    touched[chan][cc] = tick;  // reset timeout
+    known[chan][cc] = 1;
+    // value matches
+    if(isKnown && values[chan][cc] == msg.bytes[2]) {
+        return 1;  // already know this value
+    }
+    // CC not known or value doesn't match
+    values[chan][cc] = msg.bytes[2];  // update stored value
     return 0;
 }
 
 // reset all history
 void MidiCCMem::reset() {
-    int i;
-    for(i = 0; i < MIDI_NUM_CHANNELS; i ++) {
-        repeatHist[i].clear();
-    }
+    memset(known, 0, sizeof(known));
+    tick = 0;
 }
@@ -13,20 +13,16 @@
 #include "../plugin.hpp"
 #include "MidiProtocol.h"
 
-struct MidiCCHist {
-    midi::Message msg;
-    int timeout;
-
-    MidiCCHist() {
-        msg.setSize(0);
-        timeout = 0;
-    }
-};
-
 class MidiCCMem {
 private:
-    std::vector<MidiCCHist> repeatHist[MIDI_NUM_CHANNELS];
-    int timeout;  // the timeout to use for messages
+    // flat table of the last value for every CC on every channel
+    // - entries expire lazily by comparing their tick with the current tick
+    //   so nothing needs to be walked or removed when they time out
+    uint8_t values[MIDI_NUM_CHANNELS][128];
+    uint8_t known[MIDI_NUM_CHANNELS][128];  // 1 = value is valid
+    uint32_t touched[MIDI_NUM_CHANNELS][128];  // tick when the value was last seen
+    uint32_t tick;  // number of process ticks
+    int timeout;  // the timeout to use for messages - 0 = never time out
     #define TIMEOUT_DEFAULT 1000
 
 public:
@@ -39,6 +35,9 @@ public:
     // process timeouts
     void process();
 
+    // advance the timeouts by a number of process ticks - i.e. after being idle
+    void advance(uint32_t ticks);
+
     // handle a CC message
     // returns:
     //  - 1 = CC already known with this value
@@ -0,0 +1,117 @@
+/*
+ * Kilpatrick Audio MIDI Clock Transport
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Andrew Kilpatrick
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#include "MidiClockTransport.h"
+
+MidiClockTransport MidiClockTransport::buses[MidiClockTransport::NUM_BUSES];
+
+// constructor
+MidiClockTransport::MidiClockTransport() {
+    publisher = NULL;
+    seq = 0;
+    running = 0;
+    tickPos = 0;
+    ppq = 24;
+    tempo = 120.0f;
+    tickFrame = 0;
+    nextTickFrame = 0;
+    resetCount = 0;
+}
+
+// get a transport bus - returns NULL if the bus is invalid
+MidiClockTransport *MidiClockTransport::getBus(int bus) {
+    if(bus < 0 || bus >= NUM_BUSES) {
+        return NULL;
+    }
+    return &buses[bus];
+}
+
+// claim the bus for publishing - only one publisher is allowed
+int MidiClockTransport::claim(void *publisher) {
+    void *expected = NULL;
+    if(this->publisher.load() == publisher) {
+        return 0;
+    }
+    if(!this->publisher.compare_exchange_strong(expected, publisher)) {
+        return -1;
+    }
+    return 0;
+}
+
+// release the bus if it is held by this publisher
+void MidiClockTransport::release(void *publisher) {
+    void *expected = publisher;
+    if(this->publisher.compare_exchange_strong(expected, NULL)) {
+        running.store(0, std::memory_order_relaxed);
+    }
+}
+
+// check if the bus has a publisher
+int MidiClockTransport::isClaimed(void) {
+    return publisher.load() != NULL;
+}
+
+// check if the bus is held by another publisher
+int MidiClockTransport::isClaimedByOther(void *publisher) {
+    void *current = this->publisher.load();
+    return current != NULL && current != publisher;
+}
+
+// publish the clock state - publisher only
+void MidiClockTransport::publish(const MidiClockTransportState& state) {
+    uint32_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    running.store(state.running, std::memory_order_relaxed);
+    tickPos.store(state.tickPos, std::memory_order_relaxed);
+    ppq.store(state.ppq, std::memory_order_relaxed);
+    tempo.store(state.tempo, std::memory_order_relaxed);
+    tickFrame.store(state.tickFrame, std::memory_order_relaxed);
+    nextTickFrame.store(state.nextTickFrame, std::memory_order_relaxed);
+    resetCount.store(state.resetCount, std::memory_order_relaxed);
+    seq.store(s + 2, std::memory_order_release);
+}
+
+// read the clock state - any thread
+int MidiClockTransport::read(MidiClockTransportState *state) {
+    uint32_t s1, s2;
+    if(publisher.load(std::memory_order_relaxed) == NULL) {
+        return 0;
+    }
+    do {
+        s1 = seq.load(std::memory_order_acquire);
+        state->running = running.load(std::memory_order_relaxed);
+        state->tickPos = tickPos.load(std::memory_order_relaxed);
+        state->ppq = ppq.load(std::memory_order_relaxed);
+        state->tempo = tempo.load(std::memory_order_relaxed);
+        state->tickFrame = tickFrame.load(std::memory_order_relaxed);
+        state->nextTickFrame = nextTickFrame.load(std::memory_order_relaxed);
+        state->resetCount = resetCount.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        s2 = seq.load(std::memory_order_relaxed);
+    } while((s1 & 0x01) || s1 != s2);
+    return 1;
+}
+
+// get the fractional phase between the last and the next tick at a frame
+float MidiClockTransport::getTickPhase(const MidiClockTransportState& state, int64_t frame) {
+    float phase;
+    if(state.nextTickFrame <= state.tickFrame) {
+        return 0.0f;
+    }
+    phase = (float)(frame - state.tickFrame) /
+        (float)(state.nextTickFrame - state.tickFrame);
+    if(phase < 0.0f) {
+        return 0.0f;
+    }
+    if(phase >= 1.0f) {
+        return 0.999999f;
+    }
+    return phase;
+}
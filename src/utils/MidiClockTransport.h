@@ -0,0 +1,80 @@
+/*
+ * Kilpatrick Audio MIDI Clock Transport
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Andrew Kilpatrick
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#ifndef MIDI_CLOCK_TRANSPORT_H
+#define MIDI_CLOCK_TRANSPORT_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// a snapshot of the clock state
+struct MidiClockTransportState {
+    int running;  // 0 = stopped, 1 = running
+    uint32_t tickPos;  // number of ticks since the last reset
+    int ppq;  // ticks per quarter note
+    float tempo;  // BPM
+    int64_t tickFrame;  // engine frame the last tick went out on
+    int64_t nextTickFrame;  // engine frame the next tick is expected on
+    uint32_t resetCount;  // counts up each time the position is reset
+};
+
+// a plugin-wide clock transport that one clock publishes and any module reads
+// - the state is kept in atomics behind a sequence counter so neither
+//   side ever locks - readers retry if they overlap with a publish
+// - frames are engine frames so readers can compare them with args.frame
+class MidiClockTransport {
+public:
+    static constexpr int NUM_BUSES = 4;
+
+    // get a transport bus - returns NULL if the bus is invalid
+    static MidiClockTransport *getBus(int bus);
+
+    // claim the bus for publishing - only one publisher is allowed
+    // returns -1 if another publisher has the bus
+    int claim(void *publisher);
+
+    // release the bus if it is held by this publisher
+    void release(void *publisher);
+
+    // check if the bus has a publisher
+    int isClaimed(void);
+
+    // check if the bus is held by another publisher
+    int isClaimedByOther(void *publisher);
+
+    // publish the clock state - publisher only
+    void publish(const MidiClockTransportState& state);
+
+    // read the clock state - any thread
+    // returns 0 if there is no publisher, 1 if the state was read
+    int read(MidiClockTransportState *state);
+
+    // get the fractional phase between the last and the next tick at a frame
+    // returns 0.0 to <1.0
+    static float getTickPhase(const MidiClockTransportState& state, int64_t frame);
+
+private:
+    std::atomic<void *> publisher;  // NULL = no publisher
+    std::atomic<uint32_t> seq;  // odd while a publish is in progress
+    std::atomic<int> running;
+    std::atomic<uint32_t> tickPos;
+    std::atomic<int> ppq;
+    std::atomic<float> tempo;
+    std::atomic<int64_t> tickFrame;
+    std::atomic<int64_t> nextTickFrame;
+    std::atomic<uint32_t> resetCount;
+
+    // constructor
+    MidiClockTransport();
+
+    static MidiClockTransport buses[NUM_BUSES];
+};
+
+#endif
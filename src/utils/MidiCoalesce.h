@@ -0,0 +1,124 @@
+/*
+ * MIDI Controller Coalescing Table
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Andrew Kilpatrick
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#ifndef MIDI_COALESCE_H
+#define MIDI_COALESCE_H
+
+#include "MidiProtocol.h"
+#include <stdint.h>
+#include <string.h>
+
+// keeps track of queued controller messages that can be replaced by newer values
+// - used by the vMIDI outputs and the hardware output shaper
+// - only continuous controllers, pitch bend and channel pressure are coalesced
+// - any other channel message that is queued on a channel is a barrier - a newer
+//   value is never merged into one that was queued before the barrier
+class MidiCoalesceTable {
+public:
+    static constexpr int SLOT_PB = 128;  // slot for pitch bend
+    static constexpr int SLOT_CP = 129;  // slot for channel pressure
+    static constexpr int NUM_SLOTS = 130;
+
+private:
+    uint32_t pos[MIDI_NUM_CHANNELS][NUM_SLOTS];  // queue position of the last message for each CC / PB / CP
+    uint32_t gen[MIDI_NUM_CHANNELS][NUM_SLOTS];  // barrier count when the last message was queued
+    uint32_t barrierCount[MIDI_NUM_CHANNELS];  // barriers queued on each channel
+
+public:
+    // constructor
+    MidiCoalesceTable() {
+        reset();
+    }
+
+    // forget all queued messages
+    void reset(void) {
+        memset(pos, 0, sizeof(pos));
+        memset(gen, 0, sizeof(gen));
+        memset(barrierCount, 0, sizeof(barrierCount));
+    }
+
+    // check if a controller number carries a continuous value
+    // - bank select, data entry, RPN / NRPN, switches and channel mode messages
+    //   depend on the order they are sent in so they can't be merged
+    static int isCoalescableCC(int cc) {
+        switch(cc) {
+            case MIDI_CONTROLLER_BANK_MSB:
+            case MIDI_CONTROLLER_DATA_ENTRY_MSB:
+            case MIDI_CONTROLLER_BANK_LSB:
+            case MIDI_CONTROLLER_DATA_ENTRY_LSB:
+                return 0;
+            default:
+                break;
+        }
+        if(cc >= MIDI_CONTROLLER_DAMPER_PEDAL && cc <= MIDI_CONTROLLER_HOLD2) {
+            return 0;
+        }
+        if(cc >= MIDI_CONTROLLER_DATA_INCREMENT && cc <= MIDI_CONTROLLER_RPN_PARAM_NUM_MSB) {
+            return 0;
+        }
+        if(cc >= MIDI_CONTROLLER_ALL_SOUNDS_OFF) {
+            return 0;
+        }
+        return 1;
+    }
+
+    // get the slot for a message
+    // returns the slot or -1 if the message can't be coalesced
+    static int getSlot(int status, int data0) {
+        switch(status & 0xf0) {
+            case MIDI_CONTROL_CHANGE:
+                if(!isCoalescableCC(data0 & 0x7f)) {
+                    return -1;
+                }
+                return data0 & 0x7f;
+            case MIDI_PITCH_BEND:
+                return SLOT_PB;
+            case MIDI_CHANNEL_PRESSURE:
+                return SLOT_CP;
+            default:
+                return -1;
+        }
+    }
+
+    // check if a message can be coalesced
+    static int isCoalescable(int status, int data0) {
+        return getSlot(status, data0) != -1;
+    }
+
+    // find the queue position of a message that a new message can replace
+    // - the caller must still check that the message at the position is queued
+    // returns 1 if a position was found, 0 if the message should be queued
+    int find(int status, int data0, uint32_t *queuePos) {
+        int chan = status & 0x0f;
+        int slot = getSlot(status, data0);
+        if(slot == -1 || gen[chan][slot] != barrierCount[chan]) {
+            return 0;
+        }
+        *queuePos = pos[chan][slot];
+        return 1;
+    }
+
+    // record a message that was queued at a queue position
+    void queued(int status, int data0, uint32_t queuePos) {
+        int chan = status & 0x0f;
+        int slot;
+        if(status < MIDI_NOTE_OFF || status >= MIDI_SYSEX_START) {
+            return;  // system messages don't belong to a channel
+        }
+        slot = getSlot(status, data0);
+        if(slot == -1) {
+            barrierCount[chan] ++;
+            return;
+        }
+        pos[chan][slot] = queuePos;
+        gen[chan][slot] = barrierCount[chan];
+    }
+};
+
+#endif
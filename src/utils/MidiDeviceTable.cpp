@@ -0,0 +1,108 @@
+/*
+ * Kilpatrick Audio MIDI Device Table
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Andrew Kilpatrick
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#include "MidiDeviceTable.h"
+#include <algorithm>
+
+std::vector<MidiDeviceTable::Entry> MidiDeviceTable::devices;
+std::mutex MidiDeviceTable::devicesLock;
+std::vector<MidiDeviceTableHandler *> MidiDeviceTable::handlers;
+std::mutex MidiDeviceTable::handlersLock;
+std::atomic<uint32_t> MidiDeviceTable::generation(0);
+double MidiDeviceTable::scanDue = 0.0;
+std::atomic<int> MidiDeviceTable::scanRequest(0);
+
+// add a handler - the first scan happens on the next UI step
+void MidiDeviceTable::addHandler(MidiDeviceTableHandler *handler) {
+    std::lock_guard<std::mutex> guard(handlersLock);
+    handlers.push_back(handler);
+    scanRequest = 1;  // scan right away so the new handler gets a callback
+}
+
+// remove a handler
+// - once this returns the handler will not be called again
+void MidiDeviceTable::removeHandler(MidiDeviceTableHandler *handler) {
+    std::lock_guard<std::mutex> guard(handlersLock);
+    handlers.erase(std::remove(handlers.begin(), handlers.end(), handler),
+        handlers.end());
+}
+
+// scan the devices if a scan is due - UI thread only
+void MidiDeviceTable::step(void) {
+    uint32_t gen;
+    double now = system::getTime();
+    int request = scanRequest.exchange(0);
+    if(now < scanDue && !request) {
+        return;
+    }
+    scanDue = now + (MIDI_DEVICE_TABLE_SCAN_MS / 1000.0);
+    std::lock_guard<std::mutex> guard(handlersLock);
+    // nobody needs the devices
+    if(handlers.size() == 0) {
+        return;
+    }
+    scan();
+    gen = generation.load(std::memory_order_acquire);
+    // handlers can't be removed while they are being called
+    for(MidiDeviceTableHandler *handler : handlers) {
+        handler->deviceTableScanned(gen);
+    }
+}
+
+// get the generation - changes every time the device list changes
+uint32_t MidiDeviceTable::getGeneration(void) {
+    return generation.load(std::memory_order_acquire);
+}
+
+// find a device by name - names are compared up to matchLen chars
+// - call from the UI thread - not the audio thread
+// returns the device ID or -1 if the device was not found
+int MidiDeviceTable::findDevice(int driverId, int isInput, std::string name, int matchLen) {
+    std::lock_guard<std::mutex> guard(devicesLock);
+    std::string devName;
+    name.resize(matchLen);
+    for(const Entry& entry : devices) {
+        if(entry.driverId != driverId || entry.isInput != isInput) {
+            continue;
+        }
+        devName = entry.name;
+        devName.resize(matchLen);
+        if(devName.compare(name) == 0) {
+            return entry.deviceId;
+        }
+    }
+    return -1;
+}
+
+//
+// private methods
+//
+// enumerate devices and bump the generation if anything changed
+void MidiDeviceTable::scan(void) {
+    std::vector<Entry> found;
+    midi::Driver *driver;
+    for(int driverId : midi::getDriverIds()) {
+        driver = midi::getDriver(driverId);
+        if(driver == NULL) {
+            continue;
+        }
+        for(int deviceId : driver->getInputDeviceIds()) {
+            found.push_back({driverId, 1, deviceId, driver->getInputDeviceName(deviceId)});
+        }
+        for(int deviceId : driver->getOutputDeviceIds()) {
+            found.push_back({driverId, 0, deviceId, driver->getOutputDeviceName(deviceId)});
+        }
+    }
+    std::lock_guard<std::mutex> guard(devicesLock);
+    if(found == devices) {
+        return;
+    }
+    devices = found;
+    generation.fetch_add(1, std::memory_order_release);
+}
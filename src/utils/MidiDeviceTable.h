@@ -0,0 +1,78 @@
+/*
+ * Kilpatrick Audio MIDI Device Table
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Andrew Kilpatrick
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#ifndef MIDI_DEVICE_TABLE_H
+#define MIDI_DEVICE_TABLE_H
+
+#include "../plugin.hpp"
+#include <atomic>
+#include <mutex>
+
+// a callback handler for device table scans
+struct MidiDeviceTableHandler {
+    // called on the UI thread after every scan
+    // - generation changes whenever the device list changes
+    virtual void deviceTableScanned(uint32_t generation) { }
+};
+
+// cached list of MIDI devices shared by the whole plugin
+// - devices are enumerated on the UI thread so the audio thread never
+//   has to walk the drivers to find a device
+// - the drivers are not thread safe so they are only walked from the
+//   UI thread where Rack uses them too
+class MidiDeviceTable {
+public:
+    // add a handler - the first scan happens on the next UI step
+    static void addHandler(MidiDeviceTableHandler *handler);
+
+    // remove a handler
+    // - once this returns the handler will not be called again
+    static void removeHandler(MidiDeviceTableHandler *handler);
+
+    // scan the devices if a scan is due - UI thread only
+    // - call from the widget step() of modules that have handlers
+    // - many widgets can call this - it only scans once per interval
+    static void step(void);
+
+    // get the generation - changes every time the device list changes
+    static uint32_t getGeneration(void);
+
+    // find a device by name - names are compared up to matchLen chars
+    // - call from the UI thread - not the audio thread
+    // returns the device ID or -1 if the device was not found
+    static int findDevice(int driverId, int isInput, std::string name, int matchLen);
+
+private:
+    // a device entry
+    struct Entry {
+        int driverId;
+        int isInput;
+        int deviceId;
+        std::string name;
+
+        // check if entries are the same
+        bool operator==(const Entry& other) const {
+            return driverId == other.driverId && isInput == other.isInput &&
+                deviceId == other.deviceId && name == other.name;
+        }
+    };
+    #define MIDI_DEVICE_TABLE_SCAN_MS 250  // scan interval
+    static std::vector<Entry> devices;
+    static std::mutex devicesLock;  // protects devices
+    static std::vector<MidiDeviceTableHandler *> handlers;
+    static std::mutex handlersLock;  // protects handlers
+    static std::atomic<uint32_t> generation;
+    static double scanDue;  // system time of the next scan - 0.0 = scan now - UI thread only
+    static std::atomic<int> scanRequest;  // set to scan on the next step
+
+    // private methods
+    static void scan(void);
+};
+
+#endif
@@ -11,6 +11,7 @@
 #include <string>
 #include "MidiProtocol.h"
 #include "PLog.h"
+#include "PUtils.h"
 #define MIDI_HELPER_HANDLE_RTMIDI  // uncomment to handle RtMidi exceptions
 
 // create a driver chooser menu item
@@ -43,22 +44,527 @@ void MidiHelperDeviceMenuItem::onAction(const event::Action &e) {
     handler->deviceSetSelected(slot, isInput, deviceId);
 }
 
+// clear the stats
+void MidiHelperJitter::reset(void) {
+    count = 0;
+    min = 0;
+    max = 0;
+    sum = 0;
+}
+
+// add a value
+void MidiHelperJitter::add(int64_t val) {
+    if(count == 0 || val < min) {
+        min = val;
+    }
+    if(count == 0 || val > max) {
+        max = val;
+    }
+    sum += val;
+    count ++;
+}
+
+// get the average value - returns 0 if there were no values
+double MidiHelperJitter::getAverage(void) {
+    if(count == 0) {
+        return 0.0;
+    }
+    return (double)sum / (double)count;
+}
+
+// create an output rate menu item
+MidiHelperOutputRateMenuItem::MidiHelperOutputRateMenuItem(std::string name, Param *param, int rate) {
+    this->text = name;
+    this->param = param;
+    this->rate = rate;
+    this->rightText = CHECKMARK((int)param->getValue() == rate);
+}
+
+// the menu item was selected
+void MidiHelperOutputRateMenuItem::onAction(const event::Action &e) {
+    param->setValue(rate);
+}
+
+// create an output stats menu item
+MidiHelperOutputStatsMenuItem::MidiHelperOutputStatsMenuItem(MidiHelper *helper, int slot) {
+    this->helper = helper;
+    this->slot = slot;
+    this->text = "Output Stats - Slot " + std::to_string(slot + 1);
+    this->rightText = RIGHT_ARROW;
+}
+
+// create the stats submenu
+Menu *MidiHelperOutputStatsMenuItem::createChildMenu(void) {
+    Menu *menu = new Menu;
+    MidiHelperOutputStats stats;
+    if(helper->getOutputStats(slot, &stats) == -1) {
+        return menu;
+    }
+    menu->addChild(createMenuLabel(putils::format("Queued (ms): avg: %.1f - max: %.1f",
+        stats.latencyAvg, stats.latencyMax)));
+    menu->addChild(createMenuLabel(putils::format("Coalesced: %u", stats.coalesced)));
+    menu->addChild(createMenuLabel(putils::format("Dropped: %u (SYSEX: %u)",
+        stats.dropped, stats.sysexDropped)));
+    menu->addChild(new MidiHelperOutputResetMenuItem(helper, slot));
+    return menu;
+}
+
+// create an output stats reset menu item
+MidiHelperOutputResetMenuItem::MidiHelperOutputResetMenuItem(MidiHelper *helper, int slot) {
+    this->helper = helper;
+    this->slot = slot;
+    this->text = "Reset Stats";
+}
+
+// the menu item was selected
+void MidiHelperOutputResetMenuItem::onAction(const event::Action &e) {
+    helper->resetOutputStats(slot);
+}
+
+// create a jitter stats menu item
+MidiHelperJitterStatsMenuItem::MidiHelperJitterStatsMenuItem(MidiHelper *helper, int slot) {
+    this->helper = helper;
+    this->slot = slot;
+    this->text = "Input Jitter - Slot " + std::to_string(slot + 1);
+    this->rightText = RIGHT_ARROW;
+}
+
+// create the stats submenu
+Menu *MidiHelperJitterStatsMenuItem::createChildMenu(void) {
+    Menu *menu = new Menu;
+    MidiHelperJitter emit, lead;
+    uint32_t dropped, sysexDropped;
+    float usPerFrame = 1000000.0f / APP->engine->getSampleRate();
+    if(helper->getJitterStats(slot, &emit, &lead) == -1) {
+        return menu;
+    }
+    menu->addChild(createMenuLabel(putils::format("Messages: %u", emit.count)));
+    menu->addChild(createMenuLabel(putils::format("Late (us): min: %.0f - avg: %.1f - max: %.0f",
+        emit.min * usPerFrame, emit.getAverage() * usPerFrame, emit.max * usPerFrame)));
+    menu->addChild(createMenuLabel(putils::format("Lead (us): min: %.0f - avg: %.1f - max: %.0f",
+        lead.min * usPerFrame, lead.getAverage() * usPerFrame, lead.max * usPerFrame)));
+    menu->addChild(createMenuLabel(putils::format("Jitter (us): %.0f",
+        (emit.max - emit.min) * usPerFrame)));
+    if(helper->getInputDropCounts(slot, &dropped, &sysexDropped) == 0) {
+        menu->addChild(createMenuLabel(putils::format("Dropped: %u (SYSEX: %u)",
+            dropped, sysexDropped)));
+    }
+    menu->addChild(new MidiHelperJitterResetMenuItem(helper, slot));
+    return menu;
+}
+
+// create a jitter stats reset menu item
+MidiHelperJitterResetMenuItem::MidiHelperJitterResetMenuItem(MidiHelper *helper, int slot) {
+    this->helper = helper;
+    this->slot = slot;
+    this->text = "Reset Stats";
+}
+
+// the menu item was selected
+void MidiHelperJitterResetMenuItem::onAction(const event::Action &e) {
+    helper->resetJitterStats(slot);
+}
+
+// constructor
+MidiHelperInput::MidiHelperInput() : sysexPool(MIDI_HELPER_SYSEX_BUFS) {
+    driverId = -1;
+    deviceId = -1;
+    hubPort = NULL;
+    reset();
+    activeSensing = 0;
+    dropCount = 0;
+    jitterMode = 0;
+    jitterReset = 0;
+}
+
+// destructor
+MidiHelperInput::~MidiHelperInput() {
+    setDeviceId(-1);  // unsubscribe from the hub before the ring goes away
+    clear();
+}
+
+// set the driver - closes the current device
+void MidiHelperInput::setDriverId(int driverId) {
+    std::vector<int> driverIds;
+    setDeviceId(-1);
+    // use the first driver if the one asked for doesn't exist
+    if(midi::getDriver(driverId) == NULL) {
+        driverIds = midi::getDriverIds();
+        driverId = -1;
+        if(driverIds.size() > 0) {
+            driverId = driverIds[0];
+        }
+    }
+    this->driverId = driverId;
+}
+
+// set the device - opens the device through the hub or closes it with -1
+void MidiHelperInput::setDeviceId(int deviceId) {
+    if(hubPort != NULL) {
+        MidiPortHub::unsubscribeInput(hubPort, this);
+        hubPort = NULL;
+    }
+    this->deviceId = -1;
+    if(deviceId == -1 || driverId == -1) {
+        return;
+    }
+    hubPort = MidiPortHub::subscribeInput(driverId, deviceId, this);
+    if(hubPort != NULL) {
+        this->deviceId = deviceId;
+    }
+}
+
+// close the device and go back to the default driver
+void MidiHelperInput::reset(void) {
+    setDriverId(-1);
+}
+
+// get the device IDs for the current driver
+std::vector<int> MidiHelperInput::getDeviceIds(void) {
+    midi::Driver *driver = midi::getDriver(driverId);
+    if(driver == NULL) {
+        return {};
+    }
+    return driver->getInputDeviceIds();
+}
+
+// get the name of a device for the current driver
+std::string MidiHelperInput::getDeviceName(int deviceId) {
+    midi::Driver *driver = midi::getDriver(driverId);
+    if(driver == NULL || deviceId == -1) {
+        return "";
+    }
+    return driver->getInputDeviceName(deviceId);
+}
+
+// handle a message from the driver - receive thread only
+void MidiHelperInput::handleMessage(const midi::Message& msg) {
+    RxMessage rx;
+    int len = msg.getSize();
+    if(len < 1) {
+        return;
+    }
+    // inspect the message for active sensing and steal it
+    if(msg.bytes[0] == MIDI_ACTIVE_SENSING) {
+        activeSensing.store(1, std::memory_order_release);
+        return;
+    }
+    // timestamp on arrival if the driver didn't
+    // - delay by a block so messages that arrive during a block keep their spacing
+    rx.arrival = APP->engine->getFrame();
+    rx.frame = msg.getFrame();
+    if(rx.frame < 0) {
+        rx.frame = rx.arrival + APP->engine->getBlockFrames();
+    }
+    rx.len = len;
+    rx.sysex = NULL;
+    if(len > 3) {
+        // SYSEX dumps arrive whole so they go in a pool buffer
+        if(len > MidiSysexPool::BUF_LEN) {
+            dropCount.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        rx.sysex = sysexPool.acquire();
+        if(rx.sysex == NULL) {
+            dropCount.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        memcpy(rx.sysex, msg.bytes.data(), len);
+    }
+    else {
+        memcpy(rx.bytes, msg.bytes.data(), len);
+    }
+    if(rxQueue.push(rx) == -1) {
+        if(rx.sysex != NULL) {
+            sysexPool.release(rx.sysex);
+        }
+        dropCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// get the next received message that is due by frame - audio thread only
+// returns 0 for no message, 1 if a message was popped
+int MidiHelperInput::popMessage(midi::Message *msg, int64_t frame) {
+    RxMessage rx;
+    RxMessage *next = rxQueue.peek();
+    if(next == NULL) {
+        return 0;
+    }
+    // leave it queued until it's due unless the stamp is bogus
+    if(next->frame > frame && (next->frame - frame) <= MIDI_HELPER_MAX_LEAD) {
+        return 0;
+    }
+    rxQueue.pop(&rx);
+    if(jitterReset.exchange(0)) {
+        emitJitter.reset();
+        leadJitter.reset();
+    }
+    if(jitterMode && frame != INT64_MAX) {
+        emitJitter.add(frame - rx.frame);
+        leadJitter.add(rx.frame - rx.arrival);
+    }
+    // copy into the storage the message already has so the audio thread never allocates
+    if(rx.sysex != NULL) {
+        if((int)msg->bytes.capacity() < rx.len) {
+            sysexPool.release(rx.sysex);
+            dropCount.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        msg->bytes.resize(rx.len);
+        memcpy(msg->bytes.data(), rx.sysex, rx.len);
+        sysexPool.release(rx.sysex);
+    }
+    else {
+        msg->bytes.resize(rx.len);
+        memcpy(msg->bytes.data(), rx.bytes, rx.len);
+    }
+    msg->setFrame(rx.frame);
+    return 1;
+}
+
+// check and clear the active sensing flag - audio thread only
+// returns 1 if active sensing was received since the last call
+int MidiHelperInput::takeActiveSensing(void) {
+    if(activeSensing.load(std::memory_order_relaxed) == 0) {
+        return 0;
+    }
+    return activeSensing.exchange(0, std::memory_order_acquire);
+}
+
+// drop all received messages - audio thread only
+void MidiHelperInput::clear(void) {
+    RxMessage rx;
+    while(rxQueue.pop(&rx)) {
+        if(rx.sysex != NULL) {
+            sysexPool.release(rx.sysex);
+        }
+    }
+}
+
+// constructor
+MidiHelperOutput::MidiHelperOutput() : sysexPool(MIDI_HELPER_SYSEX_BUFS) {
+    dropCount = 0;
+    byteRate = 0;
+    coalesceMode = 0;
+    busyUntil = 0.0;
+    coalesceCount = 0;
+    latencyCount = 0;
+    latencySumUs = 0;
+    latencyMaxUs = 0;
+    statsReset = 0;
+}
+
+// destructor
+MidiHelperOutput::~MidiHelperOutput() {
+    clear();
+}
+
+// queue a message to be sent at a time - audio thread only
+// returns -1 if the message was dropped
+int MidiHelperOutput::queueMessage(const midi::Message& msg, double due) {
+    TxMessage tx;
+    int len = msg.getSize();
+    if(len < 1) {
+        return -1;
+    }
+    tx.due = due;
+    tx.len = len;
+    tx.sysex = NULL;
+    if(len > 3) {
+        // SYSEX dumps go in a pool buffer
+        if(len > MidiSysexPool::BUF_LEN) {
+            dropCount.fetch_add(1, std::memory_order_relaxed);
+            return -1;
+        }
+        tx.sysex = sysexPool.acquire();
+        if(tx.sysex == NULL) {
+            dropCount.fetch_add(1, std::memory_order_relaxed);
+            return -1;
+        }
+        memcpy(tx.sysex, msg.bytes.data(), len);
+    }
+    else {
+        memcpy(tx.bytes, msg.bytes.data(), len);
+    }
+    if(txQueue.push(tx) == -1) {
+        if(tx.sysex != NULL) {
+            sysexPool.release(tx.sysex);
+        }
+        dropCount.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+    return 0;
+}
+
+// send messages that are due by now - send thread only
+// returns the due time of the next message or 0.0 if none are queued
+double MidiHelperOutput::sendDue(double now, midi::Message *msg) {
+    TxMessage tx;
+    TxMessage *next;
+    uint32_t latencyUs;
+    int rate = byteRate.load(std::memory_order_relaxed);
+    int len;
+
+    if(statsReset.exchange(0)) {
+        coalesceCount = 0;
+        latencyCount = 0;
+        latencySumUs = 0;
+        latencyMaxUs = 0;
+    }
+
+    // move messages that are due to the stage
+    while((next = txQueue.peek()) != NULL && next->due <= now) {
+        if(stageMessage(*next) == -1) {
+            break;  // stage is full - leave it in the ring
+        }
+        txQueue.pop(&tx);
+    }
+
+    // send as much as the byte budget allows - realtime messages go first
+    if(busyUntil < now) {
+        busyUntil = now;
+    }
+    while(rate == 0 || busyUntil <= now) {
+        if(!rtStage.pop(&tx) && !stage.pop(&tx)) {
+            break;
+        }
+        len = sendStaged(tx, msg);
+        if(rate > 0) {
+            busyUntil += (double)len / (double)rate;
+            // track how long messages waited for the budget
+            latencyUs = (uint32_t)((now - tx.due) * 1000000.0);
+            latencyCount.fetch_add(1, std::memory_order_relaxed);
+            latencySumUs.fetch_add(latencyUs, std::memory_order_relaxed);
+            if(latencyUs > latencyMaxUs.load(std::memory_order_relaxed)) {
+                latencyMaxUs.store(latencyUs, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // figure out when we need to run next
+    if(!rtStage.isEmpty() || !stage.isEmpty()) {
+        if(next != NULL && next->due > now && next->due < busyUntil) {
+            return next->due;
+        }
+        return busyUntil;
+    }
+    if(next != NULL) {
+        return next->due;
+    }
+    return 0.0;
+}
+
+// drop all queued messages - send thread only
+void MidiHelperOutput::clear(void) {
+    TxMessage tx;
+    while(txQueue.pop(&tx) || rtStage.pop(&tx) || stage.pop(&tx)) {
+        if(tx.sysex != NULL) {
+            sysexPool.release(tx.sysex);
+        }
+    }
+}
+
+// put a message on the stage to wait for the byte budget
+// returns -1 if the stage is full
+int MidiHelperOutput::stageMessage(const TxMessage& tx) {
+    TxMessage *queued;
+    uint32_t pos;
+    int data0;
+    // realtime messages jump the line
+    if(tx.len == 1 && tx.bytes[0] >= 0xf8) {
+        return rtStage.push(tx);
+    }
+    if(stage.size() >= stage.capacity()) {
+        return -1;
+    }
+    if(tx.sysex != NULL) {
+        return stage.push(tx);
+    }
+    // replace the old value in place so it keeps its place in line
+    // - other channel messages are kept in order - see MidiCoalesceTable
+    data0 = (tx.len > 1) ? tx.bytes[1] : 0;
+    if(coalesceMode.load(std::memory_order_relaxed) && tx.len > 1 &&
+            coalesceTable.find(tx.bytes[0], data0, &pos)) {
+        queued = stage.getQueued(pos);
+        if(queued != NULL && queued->sysex == NULL && queued->bytes[0] == tx.bytes[0] &&
+                ((tx.bytes[0] & 0xf0) != MIDI_CONTROL_CHANGE || queued->bytes[1] == tx.bytes[1])) {
+            memcpy(queued->bytes, tx.bytes, 3);
+            coalesceCount.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+    }
+    coalesceTable.queued(tx.bytes[0], data0, stage.getWritePos());
+    return stage.push(tx);
+}
+
+// send a staged message to the driver
+// returns the number of bytes sent on the wire
+int MidiHelperOutput::sendStaged(const TxMessage& tx, midi::Message *msg) {
+    const uint8_t *data = tx.bytes;
+    int len = tx.len;
+    if(tx.sysex != NULL) {
+        data = tx.sysex;
+    }
+    // Rack drivers take whole messages so status bytes are always sent
+    msg->bytes.assign(data, data + len);
+    if(deviceId != -1) {
+        sendMessage(*msg);
+    }
+    if(tx.sysex != NULL) {
+        sysexPool.release(tx.sysex);
+    }
+    return len;
+}
+
 // create a new MIDI helper (use 1 per module)
 MidiHelper::MidiHelper(int numInputSlots, int numOutputSlots, int autoKeepalive) {
     int slot;
     combinedMode = 0;
     for(slot = 0; slot < numInputSlots; slot ++) {
-        inputs.push_back(*(new midi::InputQueue()));
+        inputs.push_back(new MidiHelperInput());
         inputNames.push_back("");
         onlineTimeouts.push_back(0);
+        pendingInputIds.push_back(-1);
     }
     for(slot = 0; slot < numOutputSlots; slot ++) {
-        outputs.push_back(*(new midi::Output()));
+        outputs.push_back(new MidiHelperOutput());
         outputNames.push_back("");
+        pendingOutputIds.push_back(-1);
     }
     taskTimer.setDivision((int)(APP->engine->getSampleRate() / MIDI_TASK_RATE));
     deviceNameMatchLen = 64;
     this->autoKeepalive = autoKeepalive;
+    pendingCount = 0;
+    appliedCount = 0;
+    scannedGen = 0;
+    resolveRequest = 1;
+    MidiDeviceTable::addHandler(this);
+    sendRunning = 0;
+    sendIdle = 0;
+    if(outputs.size() > 0) {
+        sendRunning = 1;
+        sendThread = std::thread(&MidiHelper::sendLoop, this);
+    }
+}
+
+// destructor
+MidiHelper::~MidiHelper() {
+    int slot;
+    MidiDeviceTable::removeHandler(this);
+    if(sendRunning) {
+        {
+            std::lock_guard<std::mutex> guard(sendLock);
+            sendRunning = 0;
+        }
+        sendWake.notify_all();
+        sendThread.join();
+    }
+    for(slot = 0; slot < (int)inputs.size(); slot ++) {
+        delete inputs[slot];
+    }
+    for(slot = 0; slot < (int)outputs.size(); slot ++) {
+        delete outputs[slot];
+    }
 }
 
 // handle task for reconnect, etc.
@@ -72,31 +578,44 @@ void MidiHelper::process(void) {
                 // if devices timed out remove it
                 if(autoKeepalive && !onlineTimeouts[slot]) {
 //                    DEBUG("clearing devices so they will be reattached");
-                    if((int)inputs.size() > slot && inputs[slot].deviceId != -1) {
+                    if((int)inputs.size() > slot && inputs[slot]->deviceId != -1) {
 //                        DEBUG("clearing input slot: %d", slot);
-                        inputs[slot].setDeviceId(-1);
+                        inputs[slot]->setDeviceId(-1);
                     }
-                    if((int)outputs.size() > slot && outputs[slot].deviceId != -1) {
+                    if((int)outputs.size() > slot && outputs[slot]->deviceId != -1) {
 //                        DEBUG("clearing output slot: %d", slot);
-                        outputs[slot].setDeviceId(-1);
+                        outputs[slot]->setDeviceId(-1);
                     }
+                    resolveRequest = 1;
                 }
             }
         }
 
-        // check if we need to connect devices
+        // check if the device scan found devices we need to connect
+        if(pendingCount.load(std::memory_order_acquire) == appliedCount) {
+            return;
+        }
+        // try again on the next tick if the names are being changed
+        if(!nameLock.try_lock()) {
+            return;
+        }
+        appliedCount = pendingCount.load(std::memory_order_relaxed);
         for(slot = 0; slot < (int)inputs.size(); slot ++) {
-            if(inputNames[slot].length() > 0 && inputs[slot].deviceId == -1) {
-//                DEBUG("trying to restore input - slot: %d - name: %s", slot, inputNames[slot].c_str());
-                openInputByName(slot, inputNames[slot]);
+            if(pendingInputIds[slot] != -1 && inputs[slot]->deviceId == -1) {
+//                DEBUG("restoring input - slot: %d - name: %s", slot, inputNames[slot].c_str());
+                inputs[slot]->setDeviceId(pendingInputIds[slot]);
             }
+            pendingInputIds[slot] = -1;
         }
         for(slot = 0; slot < (int)outputs.size(); slot ++) {
-            if(outputNames[slot].length() > 0 && outputs[slot].deviceId == -1) {
-//                DEBUG("trying to restore output - slot: %d - name: %s", slot, outputNames[slot].c_str());
-                openOutputByName(slot, outputNames[slot]);
+            if(pendingOutputIds[slot] != -1 && outputs[slot]->deviceId == -1) {
+//                DEBUG("restoring output - slot: %d - name: %s", slot, outputNames[slot].c_str());
+                outputs[slot]->setDeviceId(pendingOutputIds[slot]);
+                outputs[slot]->setChannel(-1);  // make sure channel doesn't get overriden by MIDI backend
             }
+            pendingOutputIds[slot] = -1;
         }
+        nameLock.unlock();
     }
 }
 
@@ -104,6 +623,7 @@ void MidiHelper::process(void) {
 void MidiHelper::dataToJson(json_t *rootJ) {
     int slot;
     char tempstr[256];
+    std::lock_guard<std::mutex> guard(nameLock);
     // driver ID
     json_object_set_new(rootJ, "midiDriver", json_integer(driverGetSelected()));
 
@@ -131,8 +651,6 @@ void MidiHelper::dataFromJson(json_t *rootJ) {
     int slot;
     char tempstr[256];
     json_t *midiJ = NULL;
-    midi::InputQueue input;
-    midi::Output output;
 
     // driver ID
     midiJ = json_object_get(rootJ, "midiDriver");
@@ -140,6 +658,8 @@ void MidiHelper::dataFromJson(json_t *rootJ) {
         driverSetSelected(json_integer_value(midiJ));
     }
 
+    std::lock_guard<std::mutex> guard(nameLock);
+
     // inputs
     for(slot = 0; slot < (int)inputs.size(); slot ++) {
         sprintf(tempstr, "midiIn%d", slot);
@@ -159,6 +679,7 @@ void MidiHelper::dataFromJson(json_t *rootJ) {
 //            DEBUG("recalling output - slot: %d - name: %s", slot, outputNames[slot].c_str());
         }
     }
+    resolveRequest = 1;
 }
 
 // set combined in/out mode to open pairs at once
@@ -182,18 +703,18 @@ std::string MidiHelper::getDeviceName(int slot, int isInput) {
         if(slot < 0 || slot >= (int)inputs.size()) {
             return "No Device";
         }
-        if(inputs[slot].deviceId == -1) {
+        if(inputs[slot]->deviceId == -1) {
             return "No Device";
         }
-        return inputs[slot].getDeviceName(inputs[slot].deviceId);
+        return inputs[slot]->getDeviceName(inputs[slot]->deviceId);
     }
     if(slot < 0 || slot >= (int)outputs.size()) {
         return "No Device";
     }
-    if(outputs[slot].deviceId == -1) {
+    if(outputs[slot]->deviceId == -1) {
         return "No Device";
     }
-    return outputs[slot].getDeviceName(outputs[slot].deviceId);
+    return outputs[slot]->getDeviceName(outputs[slot]->deviceId);
 }
 
 //
@@ -234,7 +755,7 @@ void MidiHelper::populateInputMenu(Menu *menu, std::string prefixFilter, int slo
         1, -1, slot, (MidiHelperDeviceHandler *)this));
 
     // add found devices
-    for(int deviceId : inputs[slot].getDeviceIds()) {
+    for(int deviceId : inputs[slot]->getDeviceIds()) {
         std::string devName = getInputDeviceName(slot, deviceId);
         std::string s2 = devName;
         transform(s2.begin(), s2.end(), s2.begin(), [](unsigned char c){ return toupper(c); });
@@ -260,7 +781,7 @@ void MidiHelper::populateOutputMenu(Menu *menu, std::string prefixFilter, int sl
         0, -1, slot, (MidiHelperDeviceHandler *)this));
 
     // add found devices
-    for(int deviceId : outputs[slot].getDeviceIds()) {
+    for(int deviceId : outputs[slot]->getDeviceIds()) {
         std::string devName = getOutputDeviceName(slot, deviceId);
         std::string s2 = devName;
         transform(s2.begin(), s2.end(), s2.begin(), [](unsigned char c){ return toupper(c); });
@@ -283,7 +804,7 @@ int MidiHelper::isAssigned(int isInput, int slot) {
         if(slot < 0 || slot >= (int)inputs.size()) {
             return 0;
         }
-        if(inputs[slot].driverId != -1 && inputs[slot].deviceId != -1) {
+        if(inputs[slot]->driverId != -1 && inputs[slot]->deviceId != -1) {
             return 1;
         }
         return 0;
@@ -291,7 +812,7 @@ int MidiHelper::isAssigned(int isInput, int slot) {
     if(slot < 0 || slot >= (int)outputs.size()) {
         return 0;
     }
-    if(outputs[slot].driverId != -1 && outputs[slot].deviceId != -1) {
+    if(outputs[slot]->driverId != -1 && outputs[slot]->deviceId != -1) {
         return 1;
     }
     return 0;
@@ -310,23 +831,100 @@ int MidiHelper::isDetected(int slot) {
 
 // get an input message from a port
 // returns -1 on error, 0 for no message, 1 if message received
-int MidiHelper::getInputMessage(int slot, midi::Message *msg) {
+int MidiHelper::getInputMessage(int slot, midi::Message *msg, int64_t frame) {
     if(slot < 0 || slot >= (int)inputs.size()) {
         return -1;
     }
-    // drain out the entire queue
-    while(inputs[slot].tryPop(msg, INT64_MAX)) {
-        if(msg->getSize() < 1) {
-            continue;  // try again
-        }
-        // inspect the message for active sensing and steal it
-        if(msg->bytes[0] == MIDI_ACTIVE_SENSING) {
-            onlineTimeouts[slot] = ONLINE_TIMEOUT;
-            continue;  // try again
-        }
-        // return 1 saying the caller has a message they can use
-        return 1;
+    // active sensing is stolen by the receive thread
+    if(inputs[slot]->takeActiveSensing()) {
+        onlineTimeouts[slot] = ONLINE_TIMEOUT;
+    }
+    return inputs[slot]->popMessage(msg, frame);
+}
+
+// set the output byte rate - 0 = unlimited
+void MidiHelper::setOutputRate(int bytesPerSec) {
+    int slot;
+    for(slot = 0; slot < (int)outputs.size(); slot ++) {
+        outputs[slot]->byteRate = bytesPerSec;
+    }
+}
+
+// set output controller coalescing - 0 = off, 1 = on
+void MidiHelper::setOutputCoalesce(int enable) {
+    int slot;
+    for(slot = 0; slot < (int)outputs.size(); slot ++) {
+        outputs[slot]->coalesceMode = (enable != 0);
+    }
+}
+
+// get the output shaper stats for a port - returns -1 on error
+int MidiHelper::getOutputStats(int slot, MidiHelperOutputStats *stats) {
+    uint32_t count;
+    if(slot < 0 || slot >= (int)outputs.size()) {
+        return -1;
+    }
+    count = outputs[slot]->latencyCount;
+    stats->latencyAvg = 0.0f;
+    if(count > 0) {
+        stats->latencyAvg = (float)outputs[slot]->latencySumUs / (float)count / 1000.0f;
+    }
+    stats->latencyMax = (float)outputs[slot]->latencyMaxUs / 1000.0f;
+    stats->coalesced = outputs[slot]->coalesceCount;
+    stats->dropped = outputs[slot]->dropCount;
+    stats->sysexDropped = outputs[slot]->sysexPool.getDropCount();
+    return 0;
+}
+
+// reset the output shaper stats for a port
+void MidiHelper::resetOutputStats(int slot) {
+    if(slot < 0 || slot >= (int)outputs.size()) {
+        return;
+    }
+    outputs[slot]->dropCount = 0;
+    outputs[slot]->sysexPool.resetDropCount();
+    outputs[slot]->statsReset = 1;
+    wakeSendThread();
+}
+
+// set input jitter measurement mode - 0 = off, 1 = on
+void MidiHelper::setJitterMode(int enable) {
+    int slot;
+    for(slot = 0; slot < (int)inputs.size(); slot ++) {
+        inputs[slot]->jitterMode = (enable != 0);
     }
+}
+
+// get the input jitter stats for a port
+// - emit is how late messages were handled vs. their timestamp
+// - lead is how far ahead of their timestamp messages arrived
+// returns -1 on error
+int MidiHelper::getJitterStats(int slot, MidiHelperJitter *emit, MidiHelperJitter *lead) {
+    if(slot < 0 || slot >= (int)inputs.size()) {
+        return -1;
+    }
+    *emit = inputs[slot]->emitJitter;
+    *lead = inputs[slot]->leadJitter;
+    return 0;
+}
+
+// reset the input jitter stats for a port
+void MidiHelper::resetJitterStats(int slot) {
+    if(slot < 0 || slot >= (int)inputs.size()) {
+        return;
+    }
+    inputs[slot]->jitterReset = 1;
+    inputs[slot]->dropCount = 0;
+    inputs[slot]->sysexPool.resetDropCount();
+}
+
+// get the number of messages dropped by an input port - returns -1 on error
+int MidiHelper::getInputDropCounts(int slot, uint32_t *dropped, uint32_t *sysexDropped) {
+    if(slot < 0 || slot >= (int)inputs.size()) {
+        return -1;
+    }
+    *dropped = inputs[slot]->dropCount;
+    *sysexDropped = inputs[slot]->sysexPool.getDropCount();
     return 0;
 }
 
@@ -336,24 +934,44 @@ int MidiHelper::sendOutputMessage(int slot, const midi::Message& msg) {
     if(slot < 0 || slot >= (int)outputs.size()) {
         return -1;
     }
-    if(outputs[slot].deviceId == -1) {
+    if(outputs[slot]->deviceId == -1) {
         return -1;
     }
-    outputs[slot].sendMessage(msg);
+    double due = system::getTime();
+    if(msg.getFrame() >= 0) {
+        due = frameToSendTime(msg.getFrame());
+    }
+    if(outputs[slot]->queueMessage(msg, due) == -1) {
+        return -1;
+    }
+    wakeSendThread();
+    // the send thread might be waiting for a later message
+    if(outputs[slot]->txQueue.size() == 1) {
+        sendWake.notify_one();
+    }
     return 0;
 }
 
+// get the system time to send a message stamped with a frame - audio thread only
+double MidiHelper::frameToSendTime(int64_t frame) {
+    // the engine runs a block ahead of real time so messages are delayed
+    // by one block to keep their spacing within the block
+    return APP->engine->getBlockTime() + (double)(frame - APP->engine->getBlockFrame() +
+        APP->engine->getBlockFrames()) * APP->engine->getSampleTime();
+}
+
 // reset ports - returns -1 on error
 int MidiHelper::resetPorts(void) {
     int slot;
     for(slot = 0; slot < (int)inputs.size(); slot ++) {
-        if(inputs[slot].deviceId != -1) {
-            inputs[slot].reset();
+        if(inputs[slot]->deviceId != -1) {
+            inputs[slot]->reset();
+            inputs[slot]->clear();
         }
     }
     for(slot = 0; slot < (int)outputs.size(); slot ++) {
-        if(outputs[slot].deviceId != -1) {
-            outputs[slot].reset();
+        if(outputs[slot]->deviceId != -1) {
+            outputs[slot]->reset();
         }
     }
     return 0;
@@ -368,15 +986,14 @@ int MidiHelper::sendNoteOn(int slot, int chan, int note, int vel) {
     if(slot < 0 || slot >= (int)outputs.size()) {
         return -1;
     }
-    if(outputs[slot].deviceId == -1) {
+    if(outputs[slot]->deviceId == -1) {
         return -1;
     }
 	msg.setStatus(MIDI_NOTE_ON >> 4);
     msg.setChannel(chan);
 	msg.setNote(note);
 	msg.setValue(vel);
-    outputs[slot].sendMessage(msg);
-    return 0;
+    return sendOutputMessage(slot, msg);
 }
 
 // send a note off - returns -1 on error
@@ -385,15 +1002,14 @@ int MidiHelper::sendNoteOff(int slot, int chan, int note) {
     if(slot < 0 || slot >= (int)outputs.size()) {
         return -1;
     }
-    if(outputs[slot].deviceId == -1) {
+    if(outputs[slot]->deviceId == -1) {
         return -1;
     }
 	msg.setStatus(MIDI_NOTE_OFF >> 4);
     msg.setChannel(chan);
 	msg.setNote(note);
 	msg.setValue(0);
-    outputs[slot].sendMessage(msg);
-    return 0;
+    return sendOutputMessage(slot, msg);
 }
 
 // send a CC - returns -1 on error
@@ -402,15 +1018,14 @@ int MidiHelper::sendCC(int slot, int chan, int cc, int val) {
     if(slot < 0 || slot >= (int)outputs.size()) {
         return -1;
     }
-    if(outputs[slot].deviceId == -1) {
+    if(outputs[slot]->deviceId == -1) {
         return -1;
     }
 	msg.setStatus(MIDI_CONTROL_CHANGE >> 4);
     msg.setChannel(chan);
 	msg.setNote(cc);
 	msg.setValue(val);
-    outputs[slot].sendMessage(msg);
-    return 0;
+    return sendOutputMessage(slot, msg);
 }
 
 //
@@ -419,9 +1034,9 @@ int MidiHelper::sendCC(int slot, int chan, int cc, int val) {
 // get the current driver that is active
 int MidiHelper::driverGetSelected(void) {
     if(inputs.size() > 0) {
-        return inputs[0].driverId;
+        return inputs[0]->driverId;
     }
-    return outputs[0].driverId;
+    return outputs[0]->driverId;
 }
 
 // handle the driver being chosen
@@ -429,12 +1044,13 @@ void MidiHelper::driverSetSelected(int driverId) {
     int slot;
     // inputs
     for(slot = 0; slot < (int)inputs.size(); slot ++) {
-        inputs[slot].setDriverId(driverId);
+        inputs[slot]->setDriverId(driverId);
     }
     // outputs
     for(slot = 0; slot < (int)outputs.size(); slot ++) {
-        outputs[slot].setDriverId(driverId);
+        outputs[slot]->setDriverId(driverId);
     }
+    resolveRequest = 1;
 }
 
 // check if the current device is open
@@ -443,7 +1059,7 @@ int MidiHelper::deviceIsOpen(int isInput, int slot, int deviceId) {
         if(slot < 0 || slot >= (int)inputs.size()) {
             return 0;
         }
-        if(inputs[slot].deviceId == deviceId) {
+        if(inputs[slot]->deviceId == deviceId) {
             return 1;
         }
     }
@@ -451,7 +1067,7 @@ int MidiHelper::deviceIsOpen(int isInput, int slot, int deviceId) {
         if(slot < 0 || slot >= (int)outputs.size()) {
             return -1;
         }
-        if(outputs[slot].deviceId == deviceId) {
+        if(outputs[slot]->deviceId == deviceId) {
             return 1;
         }
     }
@@ -460,6 +1076,7 @@ int MidiHelper::deviceIsOpen(int isInput, int slot, int deviceId) {
 
 // handle the device being chosen
 void MidiHelper::deviceSetSelected(int slot, int isInput, int deviceId) {
+    std::lock_guard<std::mutex> guard(nameLock);
     if(combinedMode) {
         openInput(slot, deviceId);  // uses device ID from menu
         if(deviceId == -1) {
@@ -478,6 +1095,89 @@ void MidiHelper::deviceSetSelected(int slot, int isInput, int deviceId) {
     }
 }
 
+// find missing devices after a device table scan - UI thread only
+void MidiHelper::deviceTableScanned(uint32_t generation) {
+    int slot, found = 0;
+    int request = resolveRequest.exchange(0);
+    // nothing to do until the device list changes
+    if(generation == scannedGen && !request) {
+        return;
+    }
+    scannedGen = generation;
+    std::lock_guard<std::mutex> guard(nameLock);
+    for(slot = 0; slot < (int)inputs.size(); slot ++) {
+        if(inputNames[slot].length() > 0 && inputs[slot]->deviceId == -1) {
+            pendingInputIds[slot] = MidiDeviceTable::findDevice(inputs[slot]->driverId, 1,
+                inputNames[slot], deviceNameMatchLen);
+            if(pendingInputIds[slot] != -1) {
+                found = 1;
+            }
+        }
+    }
+    for(slot = 0; slot < (int)outputs.size(); slot ++) {
+        if(outputNames[slot].length() > 0 && outputs[slot]->deviceId == -1) {
+            pendingOutputIds[slot] = MidiDeviceTable::findDevice(outputs[slot]->driverId, 0,
+                outputNames[slot], deviceNameMatchLen);
+            if(pendingOutputIds[slot] != -1) {
+                found = 1;
+            }
+        }
+    }
+    // let the audio thread know there are devices to connect
+    if(found) {
+        pendingCount.fetch_add(1, std::memory_order_release);
+    }
+}
+
+// send thread
+void MidiHelper::sendLoop(void) {
+    midi::Message msg;
+    double now, due, next;
+    int slot;
+    std::unique_lock<std::mutex> lock(sendLock);
+    while(sendRunning) {
+        lock.unlock();
+        now = system::getTime();
+        next = 0.0;
+        for(slot = 0; slot < (int)outputs.size(); slot ++) {
+            due = outputs[slot]->sendDue(now, &msg);
+            if(due > 0.0 && (next == 0.0 || due < next)) {
+                next = due;
+            }
+        }
+        lock.lock();
+        // wait until the next message is due
+        if(next > 0.0) {
+            sendWake.wait_for(lock, std::chrono::duration<double>(next - now));
+            continue;
+        }
+        // nothing is queued - sleep until a message is queued
+        sendIdle = 1;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for(slot = 0; slot < (int)outputs.size(); slot ++) {
+            if(!outputs[slot]->txQueue.isEmpty()) {
+                sendIdle = 0;
+                break;
+            }
+        }
+        sendWake.wait(lock, [this] { return !sendIdle || !sendRunning; });
+    }
+}
+
+// wake the send thread if it is waiting with nothing queued
+// - only takes the lock if the thread is idle
+void MidiHelper::wakeSendThread(void) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!sendIdle.load(std::memory_order_relaxed)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(sendLock);
+        sendIdle = 0;
+    }
+    sendWake.notify_one();
+}
+
 //
 // helpers
 //
@@ -515,7 +1215,8 @@ int MidiHelper::isChannelMessage(const midi::Message& msg) {
     if(msg.getSize() < 2) {
         return 0;
     }
-    if((msg.bytes[0] & 0xf0) < 0xf0) {
+    // SYSEX data chunks start with a data byte
+    if((msg.bytes[0] & 0x80) && (msg.bytes[0] & 0xf0) < 0xf0) {
         return 1;
     }
     return 0;
@@ -622,7 +1323,13 @@ int MidiHelper::isSysexMessage(const midi::Message& msg) {
     if(msg.getSize() < 1) {
         return 0;
     }
+    // check for the end first so a whole dump isn't taken as a start
     if(msg.bytes[0] == 0xf0) {
+        for(i = 1; i < msg.getSize(); i ++) {
+            if(msg.bytes[i] == 0xf7) {
+                return 4;
+            }
+        }
         return 1;
     }
     allLow = 1;
@@ -645,22 +1352,21 @@ int MidiHelper::isSysexMessage(const midi::Message& msg) {
 //
 // open an input
 void MidiHelper::openInput(int slot, int deviceId) {
-    inputs[slot].setDeviceId(deviceId);
-    if(inputs[slot].deviceId == -1) {
+    inputs[slot]->setDeviceId(deviceId);
+    if(inputs[slot]->deviceId == -1) {
         inputNames[slot] = "";
         onlineTimeouts[slot] = 4;  // make it timeout soon
     }
     else {
-        inputs[slot].setChannel(-1);
         inputNames[slot] = getInputDeviceName(slot, deviceId);
     }
 }
 
 // open an output
 void MidiHelper::openOutput(int slot, int deviceId) {
-    outputs[slot].setDeviceId(deviceId);
-    outputs[slot].setChannel(-1);  // make sure channel doesn't get overriden by MIDI backend
-    if(outputs[slot].deviceId == -1) {
+    outputs[slot]->setDeviceId(deviceId);
+    outputs[slot]->setChannel(-1);  // make sure channel doesn't get overriden by MIDI backend
+    if(outputs[slot]->deviceId == -1) {
         outputNames[slot] = "";
     }
     else {
@@ -668,44 +1374,25 @@ void MidiHelper::openOutput(int slot, int deviceId) {
     }
 }
 
-// open an input by name
-void MidiHelper::openInputByName(int slot, std::string name) {
-    int i;
-    midi::Input sys;
-    std::vector<int> devIds = sys.getDeviceIds();
-    name.resize(deviceNameMatchLen);
-    for(i = 0; i < (int)devIds.size(); i ++) {
-        if(getInputDeviceName(slot, devIds[i]).compare(name) == 0) {
-            openInput(slot, devIds[i]);
-            return;
-        }
-    }
-}
-
 // open an output by name
 void MidiHelper::openOutputByName(int slot, std::string name) {
-    int i;
-    midi::Output sys;
-    std::vector<int> devIds = sys.getDeviceIds();
-    name.resize(deviceNameMatchLen);
-    for(i = 0; i < (int)devIds.size(); i ++) {
-        if(getOutputDeviceName(slot, devIds[i]).compare(name) == 0) {
-            openOutput(slot, devIds[i]);
-            return;
-        }
+    int deviceId = MidiDeviceTable::findDevice(outputs[slot]->driverId, 0,
+        name, deviceNameMatchLen);
+    if(deviceId != -1) {
+        openOutput(slot, deviceId);
     }
 }
 
 // get the input device name maybe truncated
 std::string MidiHelper::getInputDeviceName(int slot, int deviceId) {
-    std::string devName = inputs[slot].getDeviceName(deviceId);
+    std::string devName = inputs[slot]->getDeviceName(deviceId);
     devName.resize(deviceNameMatchLen);
     return devName;
 }
 
 // get the output device name maybe truncated
 std::string MidiHelper::getOutputDeviceName(int slot, int deviceId) {
-    std::string devName = outputs[slot].getDeviceName(deviceId);
+    std::string devName = outputs[slot]->getDeviceName(deviceId);
     devName.resize(deviceNameMatchLen);
     return devName;
 }
@@ -12,6 +12,15 @@
 
 #include "../plugin.hpp"
 #include "MenuHelper.h"
+#include "MidiCoalesce.h"
+#include "MidiDeviceTable.h"
+#include "MidiPortHub.h"
+#include "MidiSysex.h"
+#include "SpscQueue.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 // a callback handler for choosing MIDI driver
 struct MidiHelperDriverHandler {
@@ -59,11 +68,224 @@ struct MidiHelperDeviceMenuItem : MenuItem {
     void onAction(const event::Action &e) override;
 };
 
-class MidiHelper : MidiHelperDriverHandler, MidiHelperDeviceHandler {
+// timing stats for received messages - all values in frames
+struct MidiHelperJitter {
+    uint32_t count;
+    int64_t min;
+    int64_t max;
+    int64_t sum;
+
+    // constructor
+    MidiHelperJitter() { reset(); }
+
+    // clear the stats
+    void reset(void);
+
+    // add a value
+    void add(int64_t val);
+
+    // get the average value - returns 0 if there were no values
+    double getAverage(void);
+};
+
+// a hardware MIDI input that hands messages to the audio thread
+// - the device is opened through the port hub so it is shared with other modules
+// - handleMessage() is called on the driver's receive thread
+// - messages are timestamped on arrival and passed through a lock-free ring
+//   so the audio thread never touches the driver locks
+struct MidiHelperInput {
+    int driverId;
+    int deviceId;  // -1 = no device
+    MidiPortHubInput *hubPort;  // shared port - NULL if no device is open
+    // a received message - kept POD so the ring never allocates
+    struct RxMessage {
+        int64_t frame;  // engine frame the message should be handled on
+        int64_t arrival;  // engine frame when the message arrived
+        int len;  // message length in bytes
+        uint8_t bytes[3];  // short message data
+        uint8_t *sysex;  // pool buffer for longer messages - NULL otherwise
+    };
+    #define MIDI_HELPER_RX_QUEUE_LEN 1024
+    SpscQueue<RxMessage, MIDI_HELPER_RX_QUEUE_LEN> rxQueue;
+    #define MIDI_HELPER_SYSEX_BUFS 4  // SYSEX dumps a port can hold at once
+    MidiSysexPool sysexPool;  // buffers for SYSEX dumps in the ring
+    std::atomic<int> activeSensing;  // set by the receive thread on active sensing
+    std::atomic<uint32_t> dropCount;  // messages dropped because the ring or pool was full
+    #define MIDI_HELPER_MAX_LEAD 16384  // stamps further ahead than this are not waited for
+    int jitterMode;  // 1 = measure timing of popped messages
+    MidiHelperJitter emitJitter;  // how late messages were popped vs. their stamp
+    MidiHelperJitter leadJitter;  // how far ahead of their stamp messages arrived
+    std::atomic<int> jitterReset;  // set to have the audio thread clear the stats
+
+    // constructor
+    MidiHelperInput();
+
+    // destructor
+    ~MidiHelperInput();
+
+    // set the driver - closes the current device
+    void setDriverId(int driverId);
+
+    // set the device - opens the device through the hub or closes it with -1
+    void setDeviceId(int deviceId);
+
+    // close the device and go back to the default driver
+    void reset(void);
+
+    // get the device IDs for the current driver
+    std::vector<int> getDeviceIds(void);
+
+    // get the name of a device for the current driver
+    std::string getDeviceName(int deviceId);
+
+    // handle a message from the driver - receive thread only
+    void handleMessage(const midi::Message& msg);
+
+    // get the next received message that is due by frame - audio thread only
+    // - SYSEX dumps are copied into the capacity already reserved in msg
+    //   so reserve MidiSysexPool::BUF_LEN up front - dumps that don't fit are dropped
+    // returns 0 for no message, 1 if a message was popped
+    int popMessage(midi::Message *msg, int64_t frame);
+
+    // check and clear the active sensing flag - audio thread only
+    // returns 1 if active sensing was received since the last call
+    int takeActiveSensing(void);
+
+    // drop all received messages - audio thread only
+    void clear(void);
+};
+
+// output shaper stats for an output
+struct MidiHelperOutputStats {
+    float latencyAvg;  // average time messages waited for the byte budget (ms)
+    float latencyMax;  // max time messages waited for the byte budget (ms)
+    uint32_t coalesced;  // controller messages replaced by newer values
+    uint32_t dropped;  // messages dropped because the ring or pool was full
+    uint32_t sysexDropped;  // SYSEX dumps dropped because all port buffers were in use
+};
+
+// a hardware MIDI output that sends messages at a scheduled time
+// - the audio thread queues messages in a lock-free ring
+// - the MidiHelper send thread sends them to the driver when they are due
+// - the send thread can shape the output to fit a byte rate like DIN MIDI
+//   with realtime messages going first and controller streams coalesced
+struct MidiHelperOutput : midi::Output {
+    // a message to send - kept POD so the ring never allocates
+    struct TxMessage {
+        double due;  // system time when the message should be sent
+        int len;  // message length in bytes
+        uint8_t bytes[3];  // short message data
+        uint8_t *sysex;  // pool buffer for longer messages - NULL otherwise
+    };
+    #define MIDI_HELPER_TX_QUEUE_LEN 1024
+    SpscQueue<TxMessage, MIDI_HELPER_TX_QUEUE_LEN> txQueue;
+    MidiSysexPool sysexPool;  // buffers for SYSEX dumps in the ring and on the stage
+    std::atomic<uint32_t> dropCount;  // messages dropped because the ring or pool was full
+    // shaper settings - set from any thread
+    std::atomic<int> byteRate;  // bytes per second - 0 = unlimited
+    std::atomic<int> coalesceMode;  // 1 = replace waiting controller values with newer ones
+    // shaper state - send thread only
+    #define MIDI_HELPER_STAGE_LEN 1024
+    SpscQueue<TxMessage, MIDI_HELPER_STAGE_LEN> rtStage;  // realtime messages waiting to go out
+    SpscQueue<TxMessage, MIDI_HELPER_STAGE_LEN> stage;  // other messages waiting to go out
+    MidiCoalesceTable coalesceTable;  // staged messages that can be replaced by newer ones
+    double busyUntil;  // system time when the last byte sent will be finished
+    // shaper stats - written by the send thread
+    std::atomic<uint32_t> coalesceCount;
+    std::atomic<uint32_t> latencyCount;
+    std::atomic<uint64_t> latencySumUs;
+    std::atomic<uint32_t> latencyMaxUs;
+    std::atomic<int> statsReset;  // set to have the send thread clear the stats
+
+    // constructor
+    MidiHelperOutput();
+
+    // destructor
+    ~MidiHelperOutput();
+
+    // queue a message to be sent at a time - audio thread only
+    // returns -1 if the message was dropped
+    int queueMessage(const midi::Message& msg, double due);
+
+    // send messages that are due by now - send thread only
+    // returns the due time of the next message or 0.0 if none are queued
+    double sendDue(double now, midi::Message *msg);
+
+    // drop all queued messages - send thread only
+    void clear(void);
+
+    // private methods
+    int stageMessage(const TxMessage& tx);
+    int sendStaged(const TxMessage& tx, midi::Message *msg);
+};
+
+class MidiHelper;
+
+// jitter stats menu item - shows the stats for an input in a submenu
+struct MidiHelperJitterStatsMenuItem : MenuItem {
+    MidiHelper *helper;
+    int slot;
+
+    // create a jitter stats menu item
+    MidiHelperJitterStatsMenuItem(MidiHelper *helper, int slot);
+
+    // create the stats submenu
+    Menu *createChildMenu(void) override;
+};
+
+// jitter stats reset menu item
+struct MidiHelperJitterResetMenuItem : MenuItem {
+    MidiHelper *helper;
+    int slot;
+
+    // create a jitter stats reset menu item
+    MidiHelperJitterResetMenuItem(MidiHelper *helper, int slot);
+
+    // the menu item was selected
+    void onAction(const event::Action &e) override;
+};
+
+// output rate menu item
+struct MidiHelperOutputRateMenuItem : MenuItem {
+    Param *param;
+    int rate;
+
+    // create an output rate menu item
+    MidiHelperOutputRateMenuItem(std::string name, Param *param, int rate);
+
+    // the menu item was selected
+    void onAction(const event::Action &e) override;
+};
+
+// output shaper stats menu item - shows the stats for an output in a submenu
+struct MidiHelperOutputStatsMenuItem : MenuItem {
+    MidiHelper *helper;
+    int slot;
+
+    // create an output stats menu item
+    MidiHelperOutputStatsMenuItem(MidiHelper *helper, int slot);
+
+    // create the stats submenu
+    Menu *createChildMenu(void) override;
+};
+
+// output shaper stats reset menu item
+struct MidiHelperOutputResetMenuItem : MenuItem {
+    MidiHelper *helper;
+    int slot;
+
+    // create an output stats reset menu item
+    MidiHelperOutputResetMenuItem(MidiHelper *helper, int slot);
+
+    // the menu item was selected
+    void onAction(const event::Action &e) override;
+};
+
+class MidiHelper : MidiHelperDriverHandler, MidiHelperDeviceHandler, MidiDeviceTableHandler {
 private:
     int combinedMode;
-    std::vector<midi::InputQueue> inputs;
-    std::vector<midi::Output> outputs;
+    std::vector<MidiHelperInput *> inputs;
+    std::vector<MidiHelperOutput *> outputs;
     std::vector<std::string> inputNames;  // expected device names
     std::vector<std::string> outputNames;  // expected device names
     dsp::ClockDivider taskTimer;
@@ -72,21 +294,34 @@ private:
     std::vector<int> onlineTimeouts;
     int deviceNameMatchLen;
     int autoKeepalive;  // 1 = reconnect in/out pairs if input times out
+    std::mutex nameLock;  // protects device names and pending reconnects
+    std::vector<int> pendingInputIds;  // device found by the device scan - -1 = none
+    std::vector<int> pendingOutputIds;  // device found by the device scan - -1 = none
+    std::atomic<uint32_t> pendingCount;  // bumped by the device scan when devices are found
+    uint32_t appliedCount;  // pending count last handled by the audio thread
+    uint32_t scannedGen;  // device table generation last checked by the device scan
+    std::atomic<int> resolveRequest;  // 1 = look for missing devices on the next scan
+    std::thread sendThread;  // sends scheduled output messages
+    std::mutex sendLock;  // used by the send thread to wait
+    std::condition_variable sendWake;  // wakes the send thread when messages are queued
+    std::atomic<int> sendRunning;  // 1 = send thread should keep running
+    std::atomic<int> sendIdle;  // 1 = send thread is waiting with nothing queued
 
     // private methods
     void openInput(int slot, int deviceId);
     void openOutput(int slot, int deviceId);
-    void openInputByName(int slot, std::string name);
     void openOutputByName(int slot, std::string name);
     std::string getInputDeviceName(int slot, int deviceId);
     std::string getOutputDeviceName(int slot, int deviceId);
+    void sendLoop(void);
+    void wakeSendThread(void);
 
 public:
     // create a new MIDI helper (use 1 per module)
     MidiHelper(int numInputSlots, int numOutputSlots, int autoKeepalive);
 
     // destructor
-    virtual ~MidiHelper() = default;
+    virtual ~MidiHelper();
 
     // handle task for reconnect, etc.
     void process(void);
@@ -129,13 +364,46 @@ public:
     int isDetected(int slot);
 
     // get an input message from a port
+    // - messages stamped after frame are left queued until they are due
     // returns -1 on error, 0 for no message, 1 if message received
-    int getInputMessage(int slot, midi::Message *msg);
+    int getInputMessage(int slot, midi::Message *msg, int64_t frame = INT64_MAX);
+
+    // set input jitter measurement mode - 0 = off, 1 = on
+    void setJitterMode(int enable);
+
+    // get the input jitter stats for a port
+    // - emit is how late messages were handled vs. their timestamp
+    // - lead is how far ahead of their timestamp messages arrived
+    // returns -1 on error
+    int getJitterStats(int slot, MidiHelperJitter *emit, MidiHelperJitter *lead);
+
+    // reset the input jitter stats for a port
+    void resetJitterStats(int slot);
+
+    // get the number of messages dropped by an input port - returns -1 on error
+    int getInputDropCounts(int slot, uint32_t *dropped, uint32_t *sysexDropped);
 
     // send an output message to a port
+    // - messages with a frame are sent one engine block later at the
+    //   time matching their frame - messages without a frame go right away
     // returns -1 on error
     int sendOutputMessage(int slot, const midi::Message& msg);
 
+    // get the system time to send a message stamped with a frame - audio thread only
+    static double frameToSendTime(int64_t frame);
+
+    // set the output byte rate - 0 = unlimited
+    void setOutputRate(int bytesPerSec);
+
+    // set output controller coalescing - 0 = off, 1 = on
+    void setOutputCoalesce(int enable);
+
+    // get the output shaper stats for a port - returns -1 on error
+    int getOutputStats(int slot, MidiHelperOutputStats *stats);
+
+    // reset the output shaper stats for a port
+    void resetOutputStats(int slot);
+
     // reset ports - returns -1 on error
     int resetPorts(void);
 
@@ -166,6 +434,9 @@ public:
     // handle the device being chosen
     void deviceSetSelected(int slot, int isInput, int deviceId) override;
 
+    // find missing devices after a device table scan - UI thread only
+    void deviceTableScanned(uint32_t generation) override;
+
     //
     // helpers
     //
@@ -220,6 +491,7 @@ public:
     //  1 - SYSEX start
     //  2 - SYSEX continuation
     //  3 - SYSEX end
+    //  4 - complete SYSEX message (start and end)
     static int isSysexMessage(const midi::Message& msg);
 };
 
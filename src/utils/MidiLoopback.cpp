@@ -0,0 +1,417 @@
+/*
+ * Kilpatrick Audio MIDI Loopback Driver
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Andrew Kilpatrick
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#include "MidiLoopback.h"
+#include "MidiPortHub.h"
+#include "MidiProtocol.h"
+#include "PUtils.h"
+#include <atomic>
+#include <chrono>
+
+#define MIDI_LOOPBACK_SENSE_TIME 0.3  // active sensing interval (s)
+
+struct MidiLoopbackDriver;
+static MidiLoopbackDriver *loopbackDriver = NULL;
+
+// a message waiting to be delivered
+struct MidiLoopbackEntry {
+    double due;  // system time to deliver the message
+    midi::Message msg;
+};
+
+// loopback input device
+struct MidiLoopbackInputDevice : midi::InputDevice {
+    int port;
+
+    // get the device name
+    std::string getName(void) override {
+        return "Loopback " + std::to_string(port + 1);
+    }
+};
+
+// loopback output device
+struct MidiLoopbackOutputDevice : midi::OutputDevice {
+    int port;
+
+    // get the device name
+    std::string getName(void) override {
+        return "Loopback " + std::to_string(port + 1);
+    }
+
+    // send a message - queued for the delivery thread
+    void sendMessage(const midi::Message& msg) override;
+};
+
+// loopback driver
+struct MidiLoopbackDriver : midi::Driver {
+    MidiLoopbackInputDevice inputDevices[MidiLoopback::NUM_PORTS];
+    MidiLoopbackOutputDevice outputDevices[MidiLoopback::NUM_PORTS];
+    std::atomic<int> present[MidiLoopback::NUM_PORTS];
+    std::atomic<uint32_t> delivered[MidiLoopback::NUM_PORTS];
+    std::atomic<int> activeSensing;
+    std::atomic<double> jitter;
+    std::atomic<double> latency;
+    std::mutex lock;  // protects queues, lastDue and rand
+    std::condition_variable wake;
+    std::deque<MidiLoopbackEntry> queues[MidiLoopback::NUM_PORTS];
+    double lastDue[MidiLoopback::NUM_PORTS];  // keeps messages in order on each port
+    std::minstd_rand rand;
+    std::thread deliveryThread;
+    int running;  // 1 = delivery thread should keep running - protected by lock
+
+    // constructor
+    MidiLoopbackDriver() {
+        int port;
+        for(port = 0; port < MidiLoopback::NUM_PORTS; port ++) {
+            inputDevices[port].port = port;
+            outputDevices[port].port = port;
+            present[port] = 1;
+            delivered[port] = 0;
+            lastDue[port] = 0.0;
+        }
+        activeSensing = 0;
+        jitter = 0.0;
+        latency = 0.0;
+        running = 1;
+        deliveryThread = std::thread(&MidiLoopbackDriver::deliveryLoop, this);
+    }
+
+    // destructor - Rack deletes drivers on shutdown
+    ~MidiLoopbackDriver() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            running = 0;
+        }
+        wake.notify_all();
+        deliveryThread.join();
+        if(loopbackDriver == this) {
+            loopbackDriver = NULL;
+        }
+    }
+
+    // get the driver name
+    std::string getName(void) override {
+        return "Loopback";
+    }
+
+    // get the input device IDs that are present
+    std::vector<int> getInputDeviceIds(void) override {
+        return getPresentPorts();
+    }
+
+    // get the input device name
+    std::string getInputDeviceName(int deviceId) override {
+        if(!isValid(deviceId)) {
+            return "";
+        }
+        return inputDevices[deviceId].getName();
+    }
+
+    // subscribe to an input
+    midi::InputDevice *subscribeInput(int deviceId, midi::Input *input) override {
+        if(!isValid(deviceId) || !present[deviceId]) {
+            return NULL;
+        }
+        inputDevices[deviceId].subscribe(input);
+        return &inputDevices[deviceId];
+    }
+
+    // unsubscribe from an input
+    void unsubscribeInput(int deviceId, midi::Input *input) override {
+        if(!isValid(deviceId)) {
+            return;
+        }
+        inputDevices[deviceId].unsubscribe(input);
+    }
+
+    // get the output device IDs that are present
+    std::vector<int> getOutputDeviceIds(void) override {
+        return getPresentPorts();
+    }
+
+    // get the output device name
+    std::string getOutputDeviceName(int deviceId) override {
+        if(!isValid(deviceId)) {
+            return "";
+        }
+        return outputDevices[deviceId].getName();
+    }
+
+    // subscribe to an output
+    midi::OutputDevice *subscribeOutput(int deviceId, midi::Output *output) override {
+        if(!isValid(deviceId) || !present[deviceId]) {
+            return NULL;
+        }
+        outputDevices[deviceId].subscribe(output);
+        return &outputDevices[deviceId];
+    }
+
+    // unsubscribe from an output
+    void unsubscribeOutput(int deviceId, midi::Output *output) override {
+        if(!isValid(deviceId)) {
+            return;
+        }
+        outputDevices[deviceId].unsubscribe(output);
+    }
+
+    // check if a device ID is valid
+    int isValid(int deviceId) {
+        return deviceId >= 0 && deviceId < MidiLoopback::NUM_PORTS;
+    }
+
+    // get the ports that are present
+    std::vector<int> getPresentPorts(void) {
+        std::vector<int> ports;
+        int port;
+        for(port = 0; port < MidiLoopback::NUM_PORTS; port ++) {
+            if(present[port]) {
+                ports.push_back(port);
+            }
+        }
+        return ports;
+    }
+
+    // queue a message to be delivered on a port
+    void queueMessage(int port, const midi::Message& msg) {
+        MidiLoopbackEntry entry;
+        double now = system::getTime();
+        if(!present[port]) {
+            return;  // sent to an unplugged device
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        entry.due = now + latency + jitter * ((double)rand() / (double)rand.max());
+        // jitter can't reorder messages
+        if(entry.due < lastDue[port]) {
+            entry.due = lastDue[port];
+        }
+        lastDue[port] = entry.due;
+        entry.msg = msg;
+        entry.msg.setFrame(-1);  // receivers stamp on arrival like hardware
+        queues[port].push_back(entry);
+        wake.notify_one();
+    }
+
+    // delivery thread
+    void deliveryLoop(void) {
+        midi::Message sense;
+        double now, next, nextSense = 0.0;
+        int port;
+        sense.bytes.resize(1);
+        sense.bytes[0] = MIDI_ACTIVE_SENSING;
+        std::unique_lock<std::mutex> guard(lock);
+        while(running) {
+            now = system::getTime();
+            next = now + MIDI_LOOPBACK_SENSE_TIME;
+            for(port = 0; port < MidiLoopback::NUM_PORTS; port ++) {
+                while(!queues[port].empty() && queues[port].front().due <= now) {
+                    MidiLoopbackEntry entry = queues[port].front();
+                    queues[port].pop_front();
+                    guard.unlock();
+                    if(present[port]) {
+                        inputDevices[port].onMessage(entry.msg);
+                        delivered[port] ++;
+                    }
+                    guard.lock();
+                }
+                if(!queues[port].empty() && queues[port].front().due < next) {
+                    next = queues[port].front().due;
+                }
+            }
+            // active sensing
+            if(now >= nextSense) {
+                nextSense = now + MIDI_LOOPBACK_SENSE_TIME;
+                if(activeSensing) {
+                    guard.unlock();
+                    for(port = 0; port < MidiLoopback::NUM_PORTS; port ++) {
+                        if(present[port]) {
+                            inputDevices[port].onMessage(sense);
+                        }
+                    }
+                    guard.lock();
+                }
+            }
+            if(nextSense < next) {
+                next = nextSense;
+            }
+            wake.wait_for(guard, std::chrono::duration<double>(next - now));
+        }
+    }
+};
+
+// send a message - queued for the delivery thread
+void MidiLoopbackOutputDevice::sendMessage(const midi::Message& msg) {
+    loopbackDriver->queueMessage(port, msg);
+}
+
+// register the driver with Rack - call once from plugin init
+void MidiLoopback::init(void) {
+    if(loopbackDriver != NULL) {
+        return;
+    }
+    loopbackDriver = new MidiLoopbackDriver();
+    midi::addDriver(MIDI_LOOPBACK_DRIVER_ID, loopbackDriver);
+}
+
+// make a port appear or disappear - 0 = gone, 1 = present
+void MidiLoopback::setPortPresent(int port, int present) {
+    if(loopbackDriver == NULL || !loopbackDriver->isValid(port)) {
+        return;
+    }
+    loopbackDriver->present[port] = (present != 0);
+    if(!present) {
+        std::lock_guard<std::mutex> guard(loopbackDriver->lock);
+        loopbackDriver->queues[port].clear();  // in flight messages are lost
+    }
+}
+
+// check if a port is present
+int MidiLoopback::isPortPresent(int port) {
+    if(loopbackDriver == NULL || !loopbackDriver->isValid(port)) {
+        return 0;
+    }
+    return loopbackDriver->present[port];
+}
+
+// enable injected active sensing on present ports - 0 = off, 1 = on
+void MidiLoopback::setActiveSensing(int enable) {
+    if(loopbackDriver == NULL) {
+        return;
+    }
+    loopbackDriver->activeSensing = (enable != 0);
+}
+
+// check if injected active sensing is on
+int MidiLoopback::getActiveSensing(void) {
+    if(loopbackDriver == NULL) {
+        return 0;
+    }
+    return loopbackDriver->activeSensing;
+}
+
+// set the max random delay added to delivered messages (s)
+void MidiLoopback::setJitter(double jitter) {
+    if(loopbackDriver == NULL) {
+        return;
+    }
+    loopbackDriver->jitter = jitter;
+}
+
+// get the max random delay added to delivered messages (s)
+double MidiLoopback::getJitter(void) {
+    if(loopbackDriver == NULL) {
+        return 0.0;
+    }
+    return loopbackDriver->jitter;
+}
+
+// set the fixed delay added to delivered messages (s)
+void MidiLoopback::setLatency(double latency) {
+    if(loopbackDriver == NULL) {
+        return;
+    }
+    loopbackDriver->latency = latency;
+}
+
+// get the fixed delay added to delivered messages (s)
+double MidiLoopback::getLatency(void) {
+    if(loopbackDriver == NULL) {
+        return 0.0;
+    }
+    return loopbackDriver->latency;
+}
+
+// get the number of messages delivered on a port
+uint32_t MidiLoopback::getDeliveredCount(int port) {
+    if(loopbackDriver == NULL || !loopbackDriver->isValid(port)) {
+        return 0;
+    }
+    return loopbackDriver->delivered[port];
+}
+
+// create a loopback test menu item
+MidiLoopbackMenuItem::MidiLoopbackMenuItem() {
+    this->text = "Loopback Driver Test";
+    this->rightText = RIGHT_ARROW;
+}
+
+// create the loopback submenu
+Menu *MidiLoopbackMenuItem::createChildMenu(void) {
+    Menu *menu = new Menu;
+    const double jitters[] = {0.0, 0.001, 0.005, 0.02};
+    const double latencies[] = {0.0, 0.005, 0.05};
+    int i;
+    menu->addChild(createMenuLabel("Ports Present"));
+    for(i = 0; i < MidiLoopback::NUM_PORTS; i ++) {
+        menu->addChild(new MidiLoopbackPortMenuItem(i));
+    }
+    // modules on the same input should share one open port
+    menu->addChild(createMenuLabel(putils::format("Open Hardware Inputs: %d",
+        MidiPortHub::getNumInputs())));
+    menu->addChild(new MenuLabel());
+    menu->addChild(new MidiLoopbackSenseMenuItem());
+    menu->addChild(new MenuLabel());
+    menu->addChild(createMenuLabel("Delivery Jitter"));
+    for(i = 0; i < (int)(sizeof(jitters) / sizeof(double)); i ++) {
+        menu->addChild(new MidiLoopbackDelayMenuItem(1, jitters[i]));
+    }
+    menu->addChild(new MenuLabel());
+    menu->addChild(createMenuLabel("Delivery Latency"));
+    for(i = 0; i < (int)(sizeof(latencies) / sizeof(double)); i ++) {
+        menu->addChild(new MidiLoopbackDelayMenuItem(0, latencies[i]));
+    }
+    return menu;
+}
+
+// create a loopback port menu item
+MidiLoopbackPortMenuItem::MidiLoopbackPortMenuItem(int port) {
+    this->port = port;
+    this->text = putils::format("Loopback %d - delivered: %u", port + 1,
+        MidiLoopback::getDeliveredCount(port));
+    this->rightText = CHECKMARK(MidiLoopback::isPortPresent(port));
+}
+
+// the menu item was selected
+void MidiLoopbackPortMenuItem::onAction(const event::Action &e) {
+    MidiLoopback::setPortPresent(port, !MidiLoopback::isPortPresent(port));
+}
+
+// create a loopback active sensing menu item
+MidiLoopbackSenseMenuItem::MidiLoopbackSenseMenuItem() {
+    this->text = "Inject Active Sensing";
+    this->rightText = CHECKMARK(MidiLoopback::getActiveSensing());
+}
+
+// the menu item was selected
+void MidiLoopbackSenseMenuItem::onAction(const event::Action &e) {
+    MidiLoopback::setActiveSensing(!MidiLoopback::getActiveSensing());
+}
+
+// create a loopback delay menu item
+MidiLoopbackDelayMenuItem::MidiLoopbackDelayMenuItem(int isJitter, double delay) {
+    double current = isJitter ? MidiLoopback::getJitter() : MidiLoopback::getLatency();
+    this->isJitter = isJitter;
+    this->delay = delay;
+    if(delay == 0.0) {
+        this->text = "Off";
+    }
+    else {
+        this->text = putils::format("%.0f ms", delay * 1000.0);
+    }
+    this->rightText = CHECKMARK(current == delay);
+}
+
+// the menu item was selected
+void MidiLoopbackDelayMenuItem::onAction(const event::Action &e) {
+    if(isJitter) {
+        MidiLoopback::setJitter(delay);
+    }
+    else {
+        MidiLoopback::setLatency(delay);
+    }
+}
@@ -0,0 +1,102 @@
+/*
+ * Kilpatrick Audio MIDI Loopback Driver
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Andrew Kilpatrick
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#ifndef MIDI_LOOPBACK_H
+#define MIDI_LOOPBACK_H
+
+#include "../plugin.hpp"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+
+// in-process MIDI driver for testing without hardware
+// - messages sent to output port N come back on input port N
+// - ports can be made to appear and disappear like unplugged devices
+// - active sensing can be injected and delivery can be jittered
+// - only registered if the plugin is built with KA_MIDI_LOOPBACK defined
+class MidiLoopback {
+public:
+    #define MIDI_LOOPBACK_DRIVER_ID 0x4b41  // "KA"
+    static constexpr int NUM_PORTS = 4;
+
+    // register the driver with Rack - call once from plugin init
+    static void init(void);
+
+    // make a port appear or disappear - 0 = gone, 1 = present
+    static void setPortPresent(int port, int present);
+
+    // check if a port is present
+    static int isPortPresent(int port);
+
+    // enable injected active sensing on present ports - 0 = off, 1 = on
+    static void setActiveSensing(int enable);
+
+    // check if injected active sensing is on
+    static int getActiveSensing(void);
+
+    // set the max random delay added to delivered messages (s)
+    static void setJitter(double jitter);
+
+    // get the max random delay added to delivered messages (s)
+    static double getJitter(void);
+
+    // set the fixed delay added to delivered messages (s)
+    static void setLatency(double latency);
+
+    // get the fixed delay added to delivered messages (s)
+    static double getLatency(void);
+
+    // get the number of messages delivered on a port
+    static uint32_t getDeliveredCount(int port);
+};
+
+// loopback test menu item - controls the loopback driver from a module menu
+struct MidiLoopbackMenuItem : MenuItem {
+    // create a loopback test menu item
+    MidiLoopbackMenuItem();
+
+    // create the loopback submenu
+    Menu *createChildMenu(void) override;
+};
+
+// loopback port menu item - plugs or unplugs a port
+struct MidiLoopbackPortMenuItem : MenuItem {
+    int port;
+
+    // create a loopback port menu item
+    MidiLoopbackPortMenuItem(int port);
+
+    // the menu item was selected
+    void onAction(const event::Action &e) override;
+};
+
+// loopback active sensing menu item
+struct MidiLoopbackSenseMenuItem : MenuItem {
+    // create a loopback active sensing menu item
+    MidiLoopbackSenseMenuItem();
+
+    // the menu item was selected
+    void onAction(const event::Action &e) override;
+};
+
+// loopback delay menu item - sets the jitter or latency
+struct MidiLoopbackDelayMenuItem : MenuItem {
+    int isJitter;  // 1 = jitter, 0 = latency
+    double delay;  // delay (s)
+
+    // create a loopback delay menu item
+    MidiLoopbackDelayMenuItem(int isJitter, double delay);
+
+    // the menu item was selected
+    void onAction(const event::Action &e) override;
+};
+
+#endif
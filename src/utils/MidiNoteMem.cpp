@@ -11,12 +11,14 @@
 
 // constructor
 MidiNoteMem::MidiNoteMem() {
+    clear();
 }
 
-// add a note
+// add a note - note off messages remove the note
 void MidiNoteMem::addNote(const midi::Message& msg) {
     int noteOff = 0;
-    std::vector<midi::Message>::iterator iter;
+    int chan, note;
+    uint64_t bit;
 
     switch(msg.bytes[0] & 0xf0) {
         case MIDI_NOTE_ON:
@@ -31,46 +33,78 @@ void MidiNoteMem::addNote(const midi::Message& msg) {
             return;
     }
 
-    iter = activeNotes.begin();
-    while(iter != activeNotes.end()) {
-        // found note with same number
-        if(iter->bytes[1] == msg.bytes[1]) {
-            // remove note
-            if(noteOff) {
-                activeNotes.erase(iter);
-                continue;
-            }
-            // update note
-            else {
-                iter->bytes[2] = msg.bytes[2];
-                return;
-            }
-        }
-        ++iter;
-    }
+    chan = msg.bytes[0] & 0x0f;
+    note = msg.bytes[1] & 0x7f;
+    bit = 1ULL << (note & 0x3f);
+    // remove note
     if(noteOff) {
+        if(!(active[chan][note >> 6] & bit)) {
+            return;
+        }
+        active[chan][note >> 6] &= ~bit;
+        numNotes --;
+        if(active[chan][0] == 0 && active[chan][1] == 0) {
+            activeChans &= ~(1 << chan);
+        }
         return;
     }
-    // add note
-    activeNotes.push_back(msg);
+    // add or update note
+    if(!(active[chan][note >> 6] & bit)) {
+        active[chan][note >> 6] |= bit;
+        activeChans |= (1 << chan);
+        numNotes ++;
+    }
+    velocity[chan][note] = msg.bytes[2];
 }
 
 // get the number of currently active notes
 int MidiNoteMem::getNumNotes(void) {
-    return activeNotes.size();
+    return numNotes;
 }
 
-// get a note - returns a note of size 0 on error
-midi::Message MidiNoteMem::getNote(int index) {
-    midi::Message msg;
-    if(index < 0 || index >= (int)activeNotes.size()) {
-        msg.setSize(0);
-        return msg;
+// check if a note is active
+// returns the note velocity or 0 if the note is not active
+int MidiNoteMem::getVelocity(int chan, int note) {
+    if(chan < 0 || chan >= MIDI_NUM_CHANNELS || note < 0 || note > 127) {
+        return 0;
+    }
+    if(!(active[chan][note >> 6] & (1ULL << (note & 0x3f)))) {
+        return 0;
     }
-    return activeNotes[index];
+    return velocity[chan][note];
+}
+
+// get a note off for the next active note and forget the note
+// - call until it returns 0 to turn off all notes
+// returns 1 if a note off was written to msg, 0 if no notes are active
+int MidiNoteMem::popNoteOff(midi::Message *msg) {
+    int chan, word, note;
+    if(activeChans == 0) {
+        return 0;
+    }
+    // only set bits are visited
+    chan = __builtin_ctz(activeChans);
+    word = (active[chan][0] != 0) ? 0 : 1;
+    note = (word << 6) | __builtin_ctzll(active[chan][word]);
+    active[chan][word] &= active[chan][word] - 1;  // clear lowest bit
+    numNotes --;
+    if(active[chan][0] == 0 && active[chan][1] == 0) {
+        activeChans &= ~(1 << chan);
+    }
+    msg->setSize(3);
+    msg->bytes[0] = MIDI_NOTE_OFF | chan;
+    msg->bytes[1] = note;
+    msg->bytes[2] = 0;
+    return 1;
 }
 
 // clear the note list
 void MidiNoteMem::clear(void) {
-    activeNotes.clear();
+    int chan;
+    for(chan = 0; chan < MIDI_NUM_CHANNELS; chan ++) {
+        active[chan][0] = 0;
+        active[chan][1] = 0;
+    }
+    activeChans = 0;
+    numNotes = 0;
 }
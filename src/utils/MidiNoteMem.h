@@ -13,22 +13,34 @@
 #include "../plugin.hpp"
 #include "MidiProtocol.h"
 
+// keeps track of active notes on all channels
+// - notes are kept in a bitset per channel so updates are O(1)
+// - nothing is allocated so it can be used on the audio thread
 class MidiNoteMem {
 private:
-    std::vector<midi::Message> activeNotes;
+    uint64_t active[MIDI_NUM_CHANNELS][2];  // 1 bit per note
+    uint8_t velocity[MIDI_NUM_CHANNELS][128];  // velocity of active notes
+    uint16_t activeChans;  // 1 bit per channel with active notes
+    int numNotes;  // number of active notes
 
 public:
     // constructor
     MidiNoteMem();
 
-    // add a note
+    // add a note - note off messages remove the note
     void addNote(const midi::Message& msg);
 
     // get the number of currently active notes
     int getNumNotes(void);
 
-    // get a note - returns a note of size 0 on error
-    midi::Message getNote(int index);
+    // check if a note is active
+    // returns the note velocity or 0 if the note is not active
+    int getVelocity(int chan, int note);
+
+    // get a note off for the next active note and forget the note
+    // - call until it returns 0 to turn off all notes
+    // returns 1 if a note off was written to msg, 0 if no notes are active
+    int popNoteOff(midi::Message *msg);
 
     // clear the note list
     void clear(void);
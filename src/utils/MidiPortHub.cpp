@@ -0,0 +1,82 @@
+/*
+ * Kilpatrick Audio MIDI Port Hub
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Andrew Kilpatrick
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#include "MidiPortHub.h"
+#include "MidiHelper.h"
+#include <algorithm>
+
+std::mutex MidiPortHub::lock;
+std::vector<MidiPortHubInput *> MidiPortHub::inputs;
+
+// handle a message from the driver - receive thread only
+void MidiPortHubInput::onMessage(const midi::Message& msg) {
+    std::lock_guard<std::mutex> guard(subscribersLock);
+    for(MidiHelperInput *subscriber : subscribers) {
+        subscriber->handleMessage(msg);
+    }
+}
+
+// subscribe to a hardware input - opens the port for the first subscriber
+// returns the port or NULL if the device could not be opened
+MidiPortHubInput *MidiPortHub::subscribeInput(int driverId, int deviceId,
+        MidiHelperInput *subscriber) {
+    MidiPortHubInput *port = NULL;
+    std::lock_guard<std::mutex> guard(lock);
+    for(MidiPortHubInput *input : inputs) {
+        if(input->driverId == driverId && input->deviceId == deviceId) {
+            port = input;
+            break;
+        }
+    }
+    // open the device
+    if(port == NULL) {
+        port = new MidiPortHubInput();
+        port->refCount = 0;
+        port->setDriverId(driverId);
+        port->setDeviceId(deviceId);
+        if(port->driverId != driverId || port->deviceId != deviceId) {
+            delete port;
+            return NULL;
+        }
+        port->setChannel(-1);  // subscribers get all channels
+        inputs.push_back(port);
+    }
+    port->refCount ++;
+    std::lock_guard<std::mutex> subGuard(port->subscribersLock);
+    port->subscribers.push_back(subscriber);
+    return port;
+}
+
+// unsubscribe from a hardware input - closes the port after the last subscriber
+// - once this returns the subscriber will not be called again
+void MidiPortHub::unsubscribeInput(MidiPortHubInput *port, MidiHelperInput *subscriber) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        {
+            std::lock_guard<std::mutex> subGuard(port->subscribersLock);
+            port->subscribers.erase(std::remove(port->subscribers.begin(),
+                port->subscribers.end(), subscriber), port->subscribers.end());
+        }
+        port->refCount --;
+        if(port->refCount > 0) {
+            return;
+        }
+        inputs.erase(std::remove(inputs.begin(), inputs.end(), port), inputs.end());
+    }
+    // close the device outside the hub lock since the driver holds its
+    // own lock while it calls onMessage()
+    port->setDeviceId(-1);
+    delete port;
+}
+
+// get the number of hardware inputs that are open
+int MidiPortHub::getNumInputs(void) {
+    std::lock_guard<std::mutex> guard(lock);
+    return (int)inputs.size();
+}
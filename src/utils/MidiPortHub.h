@@ -0,0 +1,52 @@
+/*
+ * Kilpatrick Audio MIDI Port Hub
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Andrew Kilpatrick
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#ifndef MIDI_PORT_HUB_H
+#define MIDI_PORT_HUB_H
+
+#include "../plugin.hpp"
+#include <mutex>
+
+struct MidiHelperInput;
+
+// a hardware MIDI input opened once by the hub
+// - onMessage() is called on the driver's receive thread and hands
+//   each message to every subscriber's ring
+struct MidiPortHubInput : midi::Input {
+    int refCount;  // number of subscribers - protected by the hub lock
+    std::mutex subscribersLock;  // protects subscribers
+    std::vector<MidiHelperInput *> subscribers;
+
+    // handle a message from the driver - receive thread only
+    void onMessage(const midi::Message& msg) override;
+};
+
+// shares hardware MIDI ports between all modules in the plugin
+// - each device is opened once no matter how many modules use it
+// - ports are closed when the last subscriber goes away
+class MidiPortHub {
+public:
+    // subscribe to a hardware input - opens the port for the first subscriber
+    // returns the port or NULL if the device could not be opened
+    static MidiPortHubInput *subscribeInput(int driverId, int deviceId,
+        MidiHelperInput *subscriber);
+
+    // unsubscribe from a hardware input - closes the port after the last subscriber
+    // - once this returns the subscriber will not be called again
+    static void unsubscribeInput(MidiPortHubInput *port, MidiHelperInput *subscriber);
+
+    // get the number of hardware inputs that are open
+    static int getNumInputs(void);
+
+private:
+    static std::mutex lock;  // protects inputs and port ref counts
+    static std::vector<MidiPortHubInput *> inputs;
+};
+
+#endif
@@ -9,16 +9,17 @@
  */
 #include "MidiRepeater.h"
 #include "MidiHelper.h"
+#include "MidiProtocol.h"
 
 // constructor
 MidiRepeater::MidiRepeater() {
-    hist.resize(128);
     mode = RepeaterMode::MODE_OFF;
     setSendInterval(REPEAT_SEND_INTERVAL);
     setHistTimeout(REPEAT_HIST_TIMEOUT);
     setCheckInterval(REPEAT_CHECK_INTERVAL);
     sender = NULL;
     index = 0;
+    outMsg.setSize(3);
     reset();
 }
 
@@ -31,10 +32,12 @@ void MidiRepeater::registerSender(MidiRepeaterSender *sender, int index) {
 // reset the internal state
 void MidiRepeater::reset(void) {
     int i;
-    repeatCheck = 0;
-    for(i = 0; i < 128; i ++) {
-        hist[i].timeout = 0;
+    for(i = 0; i < NUM_SLOTS; i ++) {
+        activePos[i] = -1;
     }
+    numActive = 0;
+    cursor = 0;
+    tick = 0;
     setMode(MODE_OFF);
 }
 
@@ -64,46 +67,41 @@ void MidiRepeater::setHistTimeout(int timeout) {
 // set the check interval in task runs
 void MidiRepeater::setCheckInterval(int interval) {
     checkInterval = interval;
+    if(checkInterval < 1) {
+        checkInterval = 1;
+    }
 }
 
 // process an incoming message and send if necessary
 // only CCs are processed - other messages are dropped
 void MidiRepeater::handleMessage(const midi::Message& msg) {
-    midi::Message outMsg;
+    int slot;
     if(!MidiHelper::isControlChangeMessage(msg)) {
         return;
     }
+    slot = ((msg.bytes[0] & 0x0f) << 7) | (msg.bytes[1] & 0x7f);
     switch(mode) {
         case RepeaterMode::MODE_OFF:
             // if we have a message in timeout skip the echo
-            if(hist[msg.bytes[1]].msg.bytes[0] == msg.bytes[0] &&
-                    hist[msg.bytes[1]].msg.bytes[2] == msg.bytes[2] &&
-                    hist[msg.bytes[1]].timeout > 0) {
-                hist[msg.bytes[1]].timeout = histTimeout;
+            if(activePos[slot] != -1 && values[slot] == msg.bytes[2]) {
+                activate(slot, histTimeout);
                 return;
             }
             else {
-                hist[msg.bytes[1]].msg = msg;  // store message
-                hist[msg.bytes[1]].timeout = histTimeout;
-                MidiHelper::copyMessage(&outMsg, msg);
-                if(sender != NULL) {
-                    sender->sendMessage(outMsg, index);
-                }
+                values[slot] = msg.bytes[2];  // store message
+                activate(slot, histTimeout);
+                sendSlot(slot);
             }
             break;
         case RepeaterMode::MODE_GEN:  // pass through and remember
-            hist[msg.bytes[1]].msg = msg;  // store message
-            hist[msg.bytes[1]].timeout = sendInterval;  // reset send interval
-            MidiHelper::copyMessage(&outMsg, msg);
-            if(sender != NULL) {
-                sender->sendMessage(outMsg, index);
-            }
+            values[slot] = msg.bytes[2];  // store message
+            activate(slot, sendInterval);  // reset send interval
+            sendSlot(slot);
             break;
         case RepeaterMode::MODE_ON:  // pass any repeats through unchanged
         default:
-            MidiHelper::copyMessage(&outMsg, msg);
             if(sender != NULL) {
-                sender->sendMessage(outMsg, index);
+                sender->sendMessage(msg, index);
             }
             break;
     }
@@ -111,35 +109,79 @@ void MidiRepeater::handleMessage(const midi::Message& msg) {
 
 // run the task timer and send if necessary
 void MidiRepeater::taskTimer(void) {
-    int cc;
-    if(repeatCheck == checkInterval) {
-        for(cc = 0; cc < 128; cc ++) {
-            if(hist[cc].timeout == 0) {
-                continue;
-            }
-            switch(mode) {
-                case RepeaterMode::MODE_OFF:  // time out repeat blocking
-                    hist[cc].timeout -= checkInterval;
-                    if(hist[cc].timeout <= 0) {
-                        hist[cc].timeout = 0;
-                    }
-                    break;
-                case RepeaterMode::MODE_GEN:
-                    hist[cc].timeout -= checkInterval;
-                    if(hist[cc].timeout <= 0) {
-                        if(sender != NULL) {
-                            sender->sendMessage(hist[cc].msg, index);
-                        }
-                        hist[cc].timeout = sendInterval;
-                    }
-                    break;
-                case RepeaterMode::MODE_ON:
-                default:
-                    // no action
-                    break;
-            }
+    int slot, visits, sends = 0;
+    tick ++;
+    if(mode == RepeaterMode::MODE_ON || numActive == 0) {
+        return;  // no action
+    }
+    // check enough slots each run that every slot is seen once per check interval
+    visits = (numActive + checkInterval - 1) / checkInterval;
+    while(visits > 0 && numActive > 0) {
+        visits --;
+        if(cursor >= numActive) {
+            cursor = 0;
+        }
+        slot = activeList[cursor];
+        if((int32_t)(due[slot] - tick) > 0) {
+            cursor ++;
+            continue;
+        }
+        switch(mode) {
+            case RepeaterMode::MODE_OFF:  // time out repeat blocking
+                deactivate(slot);  // the last slot moves to the cursor
+                break;
+            case RepeaterMode::MODE_GEN:
+                // spread repeats out instead of sending a burst
+                if(sends >= REPEAT_MAX_SENDS) {
+                    return;
+                }
+                sendSlot(slot);
+                sends ++;
+                due[slot] = tick + sendInterval;
+                cursor ++;
+                break;
         }
-        repeatCheck = 0;
     }
-    repeatCheck ++;
+}
+
+// advance the timeouts by a number of task runs - i.e. after being idle
+void MidiRepeater::advance(uint32_t ticks) {
+    tick += ticks;
+}
+
+//
+// private methods
+//
+// add a slot to the active set or reset its timeout
+void MidiRepeater::activate(int slot, int timeout) {
+    due[slot] = tick + timeout;
+    if(activePos[slot] != -1) {
+        return;
+    }
+    activePos[slot] = numActive;
+    activeList[numActive] = slot;
+    numActive ++;
+}
+
+// remove a slot from the active set
+void MidiRepeater::deactivate(int slot) {
+    int pos = activePos[slot];
+    if(pos == -1) {
+        return;
+    }
+    numActive --;
+    activeList[pos] = activeList[numActive];
+    activePos[activeList[pos]] = pos;
+    activePos[slot] = -1;
+}
+
+// send the stored value for a slot
+void MidiRepeater::sendSlot(int slot) {
+    if(sender == NULL) {
+        return;
+    }
+    outMsg.bytes[0] = MIDI_CONTROL_CHANGE | (slot >> 7);
+    outMsg.bytes[1] = slot & 0x7f;
+    outMsg.bytes[2] = values[slot];
+    sender->sendMessage(outMsg, index);
 }
@@ -19,23 +19,24 @@ struct MidiRepeaterSender {
     virtual void sendMessage(const midi::Message& msg, int index) { }
 };
 
-// repeater event history
-struct MidiRepeaterHist {
-    midi::Message msg;
-    int timeout;
-
-    MidiRepeaterHist() {
-        msg.setSize(0);
-        timeout = 0;
-    }
-};
-
 // MIDI repeater handler
+// - history is kept for every CC on every channel
+// - only controllers that are live are kept in the active set so the
+//   task cost scales with the number of live controllers
+// - the active set is checked a slice at a time so repeats are spread
+//   out over the check interval instead of being sent in a burst
 class MidiRepeater {
 private:
-    std::vector<MidiRepeaterHist> hist;
+    static constexpr int NUM_SLOTS = 16 * 128;  // one slot per CC per channel
+    uint8_t values[NUM_SLOTS];  // last value for each slot
+    uint32_t due[NUM_SLOTS];  // tick when the slot needs attention
+    uint16_t activeList[NUM_SLOTS];  // slots that are live
+    int16_t activePos[NUM_SLOTS];  // position of slot in the active list - -1 = not live
+    int numActive;  // number of live slots
+    int cursor;  // next position in the active list to check
+    uint32_t tick;  // number of task runs
+    midi::Message outMsg;  // message used for sending repeats
     int mode;
-    int repeatCheck;
     int sendInterval;
     int histTimeout;
     int checkInterval;
@@ -45,6 +46,12 @@ private:
     #define REPEAT_SEND_INTERVAL (RT_TASK_RATE * 0.5f)  // 0.5s
     #define REPEAT_HIST_TIMEOUT (RT_TASK_RATE * 2.0f)  // 2.0s
     #define REPEAT_CHECK_INTERVAL (RT_TASK_RATE * 0.1f)  // 0.1s
+    #define REPEAT_MAX_SENDS 4  // max repeats sent per task run
+
+    // private methods
+    void activate(int slot, int timeout);
+    void deactivate(int slot);
+    void sendSlot(int slot);
 
 public:
     // repeater mode
@@ -85,6 +92,10 @@ public:
 
     // run the task timer and send if necessary
     void taskTimer(void);
+
+    // advance the timeouts by a number of task runs - i.e. after being idle
+    // - anything that came due is handled by the next taskTimer() runs
+    void advance(uint32_t ticks);
 };
 
 #endif
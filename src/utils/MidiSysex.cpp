@@ -0,0 +1,181 @@
+/*
+ * Kilpatrick Audio MIDI SYSEX Reassembly
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Andrew Kilpatrick
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#include "MidiSysex.h"
+#include "MidiProtocol.h"
+#include <string.h>
+
+// constructor
+MidiSysexPool::MidiSysexPool(int numBufs) {
+    int i;
+    this->numBufs = numBufs;
+    bufs = new uint8_t[numBufs * BUF_LEN];
+    inUse = new std::atomic<int>[numBufs];
+    for(i = 0; i < numBufs; i ++) {
+        inUse[i] = 0;
+    }
+    dropCount = 0;
+}
+
+// destructor
+MidiSysexPool::~MidiSysexPool() {
+    delete[] bufs;
+    delete[] inUse;
+}
+
+// get a free buffer - returns NULL and counts a drop if all buffers are in use
+uint8_t *MidiSysexPool::acquire(void) {
+    int i, expected;
+    for(i = 0; i < numBufs; i ++) {
+        expected = 0;
+        if(inUse[i].compare_exchange_strong(expected, 1)) {
+            return &bufs[i * BUF_LEN];
+        }
+    }
+    dropCount.fetch_add(1, std::memory_order_relaxed);
+    return NULL;
+}
+
+// return a buffer to the pool
+void MidiSysexPool::release(uint8_t *buf) {
+    int i;
+    for(i = 0; i < numBufs; i ++) {
+        if(&bufs[i * BUF_LEN] == buf) {
+            inUse[i].store(0, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+// get the number of dumps dropped because all buffers were in use
+uint32_t MidiSysexPool::getDropCount(void) {
+    return dropCount.load(std::memory_order_relaxed);
+}
+
+// reset the drop count
+void MidiSysexPool::resetDropCount(void) {
+    dropCount = 0;
+}
+
+// constructor
+MidiSysexAssembler::MidiSysexAssembler() : pool(1) {
+    buf = NULL;
+    len = 0;
+    complete = 0;
+    dropCount = 0;
+}
+
+// destructor
+MidiSysexAssembler::~MidiSysexAssembler() {
+    reset();
+}
+
+// handle an incoming message
+// returns:
+//  - 0 = not part of a SYSEX dump - the caller should handle the message
+//  - 1 = message was consumed as part of a dump
+//  - 2 = message was consumed and a complete dump is ready
+int MidiSysexAssembler::handleMessage(const midi::Message& msg) {
+    int i;
+    if(msg.getSize() < 1) {
+        return 0;
+    }
+    // realtime messages are allowed in the middle of a dump
+    if(msg.bytes[0] >= MIDI_TIMING_TICK) {
+        return 0;
+    }
+    // start a new dump
+    if(msg.bytes[0] == MIDI_SYSEX_START) {
+        reset();
+        buf = pool.acquire();
+        if(buf == NULL) {
+            dropCount ++;
+        }
+    }
+    // any other status byte ends a dump that is in progress
+    else if(msg.bytes[0] & 0x80 && msg.bytes[0] != MIDI_SYSEX_END) {
+        if(buf != NULL && !complete) {
+            abort();
+        }
+        return 0;
+    }
+    // continuation data with no dump in progress is dropped
+    if(buf == NULL || complete) {
+        return 1;
+    }
+    for(i = 0; i < msg.getSize(); i ++) {
+        if(len >= MidiSysexPool::BUF_LEN) {
+            abort();
+            return 1;
+        }
+        buf[len] = msg.bytes[i];
+        len ++;
+        if(msg.bytes[i] == MIDI_SYSEX_END) {
+            complete = 1;
+            return 2;
+        }
+    }
+    return 1;
+}
+
+// check if a dump is in progress
+int MidiSysexAssembler::isActive(void) {
+    return (buf != NULL && !complete);
+}
+
+// get the completed dump - returns NULL if no dump is ready
+const uint8_t *MidiSysexAssembler::getData(void) {
+    if(!complete) {
+        return NULL;
+    }
+    return buf;
+}
+
+// get the length of the completed dump
+int MidiSysexAssembler::getLen(void) {
+    if(!complete) {
+        return 0;
+    }
+    return len;
+}
+
+// copy the completed dump into a message that has enough capacity reserved
+// returns -1 on error
+int MidiSysexAssembler::copyToMessage(midi::Message *msg) {
+    if(!complete) {
+        return -1;
+    }
+    msg->setSize(len);
+    memcpy(msg->bytes.data(), buf, len);
+    return 0;
+}
+
+// get the number of dumps that were dropped
+uint32_t MidiSysexAssembler::getDropCount(void) {
+    return dropCount;
+}
+
+// free the completed dump or abandon the current dump
+void MidiSysexAssembler::reset(void) {
+    if(buf != NULL) {
+        pool.release(buf);
+    }
+    buf = NULL;
+    len = 0;
+    complete = 0;
+}
+
+//
+// private methods
+//
+// abandon the current dump and count it
+void MidiSysexAssembler::abort(void) {
+    dropCount ++;
+    reset();
+}
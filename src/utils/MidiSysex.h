@@ -0,0 +1,95 @@
+/*
+ * Kilpatrick Audio MIDI SYSEX Reassembly
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Andrew Kilpatrick
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#ifndef MIDI_SYSEX_H
+#define MIDI_SYSEX_H
+
+#include "../plugin.hpp"
+#include <atomic>
+
+// pool of SYSEX buffers owned by a port
+// - buffers are allocated once so no allocation happens per dump
+// - each port has its own pool so a busy port can't starve the others
+// - one thread may acquire while another releases
+class MidiSysexPool {
+public:
+    static constexpr int BUF_LEN = 65536;  // max dump length including 0xf0 and 0xf7
+
+    // constructor
+    MidiSysexPool(int numBufs);
+
+    // destructor
+    ~MidiSysexPool();
+
+    // get a free buffer - returns NULL and counts a drop if all buffers are in use
+    uint8_t *acquire(void);
+
+    // return a buffer to the pool
+    void release(uint8_t *buf);
+
+    // get the number of dumps dropped because all buffers were in use
+    uint32_t getDropCount(void);
+
+    // reset the drop count
+    void resetDropCount(void);
+
+private:
+    int numBufs;
+    uint8_t *bufs;  // numBufs * BUF_LEN bytes
+    std::atomic<int> *inUse;
+    std::atomic<uint32_t> dropCount;
+};
+
+// reassemble SYSEX dumps from vMIDI message words
+class MidiSysexAssembler {
+private:
+    MidiSysexPool pool;  // one dump is reassembled at a time
+    uint8_t *buf;  // buffer from the pool - NULL if no dump is in progress
+    int len;  // bytes received
+    int complete;  // 1 = dump is complete and ready to read
+    uint32_t dropCount;  // number of dumps dropped
+
+    // private methods
+    void abort(void);
+
+public:
+    // constructor
+    MidiSysexAssembler();
+
+    // destructor
+    ~MidiSysexAssembler();
+
+    // handle an incoming message
+    // returns:
+    //  - 0 = not part of a SYSEX dump - the caller should handle the message
+    //  - 1 = message was consumed as part of a dump
+    //  - 2 = message was consumed and a complete dump is ready
+    int handleMessage(const midi::Message& msg);
+
+    // check if a dump is in progress
+    int isActive(void);
+
+    // get the completed dump - returns NULL if no dump is ready
+    const uint8_t *getData(void);
+
+    // get the length of the completed dump
+    int getLen(void);
+
+    // copy the completed dump into a message that has enough capacity reserved
+    // returns -1 on error
+    int copyToMessage(midi::Message *msg);
+
+    // get the number of dumps that were dropped
+    uint32_t getDropCount(void);
+
+    // free the completed dump or abandon the current dump
+    void reset(void);
+};
+
+#endif
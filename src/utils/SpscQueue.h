@@ -0,0 +1,132 @@
+/*
+ * Lock-free Single Producer / Single Consumer Queue
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Andrew Kilpatrick
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ */
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stdint.h>
+
+// fixed capacity ring buffer - never allocates or locks
+// - one thread may push and one thread may pop at the same time
+// - SIZE must be a power of 2
+template <typename T, int SIZE>
+class SpscQueue {
+private:
+    static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+    static constexpr uint32_t MASK = SIZE - 1;
+    T buf[SIZE];
+    std::atomic<uint32_t> writePos;  // only written by the producer
+    std::atomic<uint32_t> readPos;  // only written by the consumer
+    std::atomic<uint32_t> overflowCount;  // number of items dropped because the queue was full
+    std::atomic<uint32_t> highWater;  // max number of items that were queued
+
+public:
+    // constructor
+    SpscQueue() {
+        writePos = 0;
+        readPos = 0;
+        resetStats();
+    }
+
+    // push an item onto the queue - producer only
+    // returns -1 if the queue is full and the item was dropped
+    int push(const T& item) {
+        uint32_t wp = writePos.load(std::memory_order_relaxed);
+        uint32_t used = wp - readPos.load(std::memory_order_acquire);
+        if(used >= (uint32_t)SIZE) {
+            overflowCount.store(overflowCount.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+            return -1;
+        }
+        buf[wp & MASK] = item;
+        writePos.store(wp + 1, std::memory_order_release);
+        if(used + 1 > highWater.load(std::memory_order_relaxed)) {
+            highWater.store(used + 1, std::memory_order_relaxed);
+        }
+        return 0;
+    }
+
+    // pop an item from the queue - consumer only
+    // returns 0 for no item, 1 if an item was popped
+    int pop(T *item) {
+        uint32_t rp = readPos.load(std::memory_order_relaxed);
+        if(rp == writePos.load(std::memory_order_acquire)) {
+            return 0;
+        }
+        *item = buf[rp & MASK];
+        readPos.store(rp + 1, std::memory_order_release);
+        return 1;
+    }
+
+    // get a pointer to the next item without removing it - consumer only
+    // returns NULL if the queue is empty
+    T *peek(void) {
+        uint32_t rp = readPos.load(std::memory_order_relaxed);
+        if(rp == writePos.load(std::memory_order_acquire)) {
+            return NULL;
+        }
+        return &buf[rp & MASK];
+    }
+
+    // get the position that the next item will be pushed to - producer only
+    uint32_t getWritePos(void) {
+        return writePos.load(std::memory_order_relaxed);
+    }
+
+    // get a pointer to an item that was pushed to pos and is still queued
+    // - the item may only be changed if the consumer runs on the same thread
+    // returns NULL if the item was already popped
+    T *getQueued(uint32_t pos) {
+        uint32_t rp = readPos.load(std::memory_order_acquire);
+        if((pos - rp) >= (writePos.load(std::memory_order_relaxed) - rp)) {
+            return NULL;
+        }
+        return &buf[pos & MASK];
+    }
+
+    // get the number of items in the queue
+    int size(void) {
+        return (int)(writePos.load(std::memory_order_acquire) -
+            readPos.load(std::memory_order_acquire));
+    }
+
+    // check if the queue is empty
+    int isEmpty(void) {
+        return size() == 0;
+    }
+
+    // get the capacity of the queue
+    static constexpr int capacity(void) {
+        return SIZE;
+    }
+
+    // get the number of items dropped because the queue was full
+    uint32_t getOverflowCount(void) {
+        return overflowCount.load(std::memory_order_relaxed);
+    }
+
+    // get the max number of items that were queued
+    uint32_t getHighWater(void) {
+        return highWater.load(std::memory_order_relaxed);
+    }
+
+    // reset the overflow and high water counters
+    void resetStats(void) {
+        overflowCount = 0;
+        highWater = 0;
+    }
+
+    // drop all queued items - consumer only
+    void clear(void) {
+        readPos.store(writePos.load(std::memory_order_acquire), std::memory_order_release);
+    }
+};
+
+#endif
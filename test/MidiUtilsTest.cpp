@@ -0,0 +1,594 @@
+/*
+ * MIDI Utility Tests and Benchmarks
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Kilpatrick Audio
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ * Checks the audio thread MIDI utilities on the host and times the ones
+ * that have to scale with the number of live controllers. Build and run
+ * with: make -C test run
+ *
+ */
+#include "../src/utils/SpscQueue.h"
+#include "../src/utils/MidiCoalesce.h"
+#include "../src/utils/MidiCCMem.h"
+#include "../src/utils/MidiRepeater.h"
+#include "../src/utils/MidiNoteMem.h"
+#include "../src/utils/MidiSysex.h"
+#include "../src/Midi2Note/Midi2Note.h"
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+static int testCount = 0;
+static int failCount = 0;
+
+// check a condition and report where it failed
+#define CHECK(cond) do { \
+        testCount ++; \
+        if(!(cond)) { \
+            failCount ++; \
+            printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while(0)
+
+// get a monotonic time in ns
+static double nowNs(void) {
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// make a 3 byte message
+static midi::Message makeMsg(int status, int data0, int data1) {
+    midi::Message msg;
+    msg.setSize(3);
+    msg.bytes[0] = status;
+    msg.bytes[1] = data0;
+    msg.bytes[2] = data1;
+    return msg;
+}
+
+// make a 1 byte message
+static midi::Message makeMsg1(int status) {
+    midi::Message msg;
+    msg.setSize(1);
+    msg.bytes[0] = status;
+    return msg;
+}
+
+//
+// SpscQueue
+//
+static void testSpscQueue(void) {
+    SpscQueue<int, 8> q;
+    int i, val, ok;
+    uint32_t pos;
+
+    printf("SpscQueue\n");
+    // fill and overflow
+    for(i = 0; i < 8; i ++) {
+        CHECK(q.push(i) == 0);
+    }
+    CHECK(q.push(8) == -1);
+    CHECK(q.size() == 8);
+    CHECK(q.getOverflowCount() == 1);
+    CHECK(q.getHighWater() == 8);
+    // FIFO order
+    for(i = 0; i < 8; i ++) {
+        CHECK(q.pop(&val) == 1 && val == i);
+    }
+    CHECK(q.pop(&val) == 0);
+    CHECK(q.peek() == NULL);
+    // queued items can be found by position until they are popped
+    pos = q.getWritePos();
+    q.push(100);
+    q.push(101);
+    CHECK(q.getQueued(pos) != NULL && *q.getQueued(pos) == 100);
+    *q.getQueued(pos + 1) = 201;
+    CHECK(q.getQueued(pos + 2) == NULL);
+    q.pop(&val);
+    CHECK(val == 100);
+    CHECK(q.getQueued(pos) == NULL);
+    CHECK(q.pop(&val) == 1 && val == 201);
+    // clear drops everything
+    q.push(1);
+    q.clear();
+    CHECK(q.isEmpty());
+
+    // one producer and one consumer thread
+    static SpscQueue<uint32_t, 1024> tq;
+    const uint32_t numItems = 2000000;
+    std::thread producer([&]() {
+        uint32_t n = 0;
+        while(n < numItems) {
+            if(tq.push(n) == 0) {
+                n ++;
+            }
+        }
+    });
+    uint32_t expect = 0, got;
+    ok = 1;
+    while(expect < numItems) {
+        if(tq.pop(&got)) {
+            if(got != expect) {
+                ok = 0;
+            }
+            expect ++;
+        }
+    }
+    producer.join();
+    CHECK(ok);
+
+    // single thread push / pop cost
+    SpscQueue<midi::Message, 1024> mq;
+    midi::Message msg = makeMsg(MIDI_CONTROL_CHANGE, 1, 64), out;
+    const int rounds = 2000;
+    double start = nowNs();
+    for(i = 0; i < rounds; i ++) {
+        while(mq.push(msg) == 0) {
+        }
+        while(mq.pop(&out)) {
+        }
+    }
+    double ns = (nowNs() - start) / ((double)rounds * mq.capacity());
+    printf("  push + pop: %.1f ns per message\n", ns);
+}
+
+//
+// MidiCoalesceTable
+//
+static void testMidiCoalesce(void) {
+    MidiCoalesceTable table;
+    uint32_t pos;
+
+    printf("MidiCoalesceTable\n");
+    // only continuous controllers, pitch bend and channel pressure
+    CHECK(MidiCoalesceTable::isCoalescable(MIDI_CONTROL_CHANGE, 1));
+    CHECK(MidiCoalesceTable::isCoalescable(MIDI_PITCH_BEND | 3, 0));
+    CHECK(MidiCoalesceTable::isCoalescable(MIDI_CHANNEL_PRESSURE, 0));
+    CHECK(!MidiCoalesceTable::isCoalescable(MIDI_CONTROL_CHANGE, MIDI_CONTROLLER_BANK_MSB));
+    CHECK(!MidiCoalesceTable::isCoalescable(MIDI_CONTROL_CHANGE, MIDI_CONTROLLER_DATA_ENTRY_LSB));
+    CHECK(!MidiCoalesceTable::isCoalescable(MIDI_CONTROL_CHANGE, MIDI_CONTROLLER_DAMPER_PEDAL));
+    CHECK(!MidiCoalesceTable::isCoalescable(MIDI_CONTROL_CHANGE, MIDI_CONTROLLER_RPN_PARAM_NUM_MSB));
+    CHECK(!MidiCoalesceTable::isCoalescable(MIDI_CONTROL_CHANGE, MIDI_CONTROLLER_ALL_SOUNDS_OFF));
+    CHECK(!MidiCoalesceTable::isCoalescable(MIDI_NOTE_ON, 60));
+    // a queued value can be found
+    table.queued(MIDI_CONTROL_CHANGE, 7, 10);
+    CHECK(table.find(MIDI_CONTROL_CHANGE, 7, &pos) == 1 && pos == 10);
+    CHECK(table.find(MIDI_CONTROL_CHANGE | 1, 7, &pos) == 0 || pos != 10);
+    // system messages aren't a barrier
+    table.queued(MIDI_TIMING_TICK, 0, 11);
+    CHECK(table.find(MIDI_CONTROL_CHANGE, 7, &pos) == 1 && pos == 10);
+    // a note on the same channel is a barrier - other channels aren't affected
+    table.queued(MIDI_CONTROL_CHANGE | 1, 7, 12);
+    table.queued(MIDI_NOTE_ON, 60, 13);
+    CHECK(table.find(MIDI_CONTROL_CHANGE, 7, &pos) == 0);
+    CHECK(table.find(MIDI_CONTROL_CHANGE | 1, 7, &pos) == 1 && pos == 12);
+    // values after the barrier can be coalesced again
+    table.queued(MIDI_CONTROL_CHANGE, 7, 14);
+    CHECK(table.find(MIDI_CONTROL_CHANGE, 7, &pos) == 1 && pos == 14);
+    // positions that were never queued are left for the caller to reject
+    table.reset();
+    CHECK(table.find(MIDI_CONTROL_CHANGE, 7, &pos) == 0 || pos != 14);
+}
+
+//
+// MidiCCMem
+//
+static void testMidiCCMem(void) {
+    MidiCCMem mem;
+    int i, j, chan, cc, round, rounds, numCCs, dupes;
+    const int liveCounts[3] = {16, 128, 2048};
+
+    printf("MidiCCMem\n");
+    mem.setTimeout(10);
+    CHECK(mem.handleCC(makeMsg(MIDI_CONTROL_CHANGE, 1, 64)) == 0);
+    CHECK(mem.handleCC(makeMsg(MIDI_CONTROL_CHANGE, 1, 64)) == 1);
+    CHECK(mem.handleCC(makeMsg(MIDI_CONTROL_CHANGE | 1, 1, 64)) == 0);
+    CHECK(mem.handleCC(makeMsg(MIDI_CONTROL_CHANGE, 1, 65)) == 0);
+    CHECK(mem.handleCC(makeMsg(MIDI_NOTE_ON, 1, 65)) == 0);
+    // each repeat resets the timeout
+    for(i = 0; i < 9; i ++) {
+        mem.process();
+    }
+    CHECK(mem.handleCC(makeMsg(MIDI_CONTROL_CHANGE, 1, 65)) == 1);
+    mem.advance(10);
+    CHECK(mem.handleCC(makeMsg(MIDI_CONTROL_CHANGE, 1, 65)) == 0);
+    // no timeout
+    mem.setTimeout(0);
+    mem.advance(1000000);
+    CHECK(mem.handleCC(makeMsg(MIDI_CONTROL_CHANGE, 1, 65)) == 1);
+    mem.reset();
+    CHECK(mem.handleCC(makeMsg(MIDI_CONTROL_CHANGE, 1, 65)) == 0);
+
+    // cost per message up to every controller on every channel being live
+    printf("  %8s %12s %8s\n", "live", "ns/msg", "dupes");
+    for(j = 0; j < 3; j ++) {
+        numCCs = liveCounts[j];
+        std::vector<midi::Message> msgs;
+        for(i = 0; i < numCCs; i ++) {
+            chan = i / 128;
+            cc = i % 128;
+            msgs.push_back(makeMsg(MIDI_CONTROL_CHANGE | chan, cc, 0));
+        }
+        mem.reset();
+        mem.setTimeout(1000);
+        dupes = 0;
+        rounds = (4000000 / numCCs) & ~1;
+        double start = nowNs();
+        for(round = 0; round < rounds; round ++) {
+            for(midi::Message& msg : msgs) {
+                msg.bytes[2] = (round >> 1) & 0x7f;  // every value is sent twice
+                dupes += mem.handleCC(msg);
+            }
+            mem.process();
+        }
+        double ns = (nowNs() - start) / ((double)rounds * numCCs);
+        printf("  %8d %12.2f %8d\n", numCCs, ns, dupes);
+        CHECK(dupes == (rounds / 2) * numCCs);
+    }
+}
+
+//
+// MidiRepeater
+//
+struct TestSender : MidiRepeaterSender {
+    std::vector<midi::Message> sent;
+
+    void sendMessage(const midi::Message& msg, int index) override {
+        sent.push_back(msg);
+    }
+};
+
+static void testMidiRepeater(void) {
+    MidiRepeater rep;
+    TestSender sender;
+    int i, maxSends, numSent;
+
+    printf("MidiRepeater\n");
+    rep.registerSender(&sender, 0);
+    rep.setSendInterval(50);
+    rep.setHistTimeout(20);
+    rep.setCheckInterval(10);
+
+    // off - echoes of a recent value are blocked until the history times out
+    rep.setMode(MidiRepeater::MODE_OFF);
+    rep.handleMessage(makeMsg(MIDI_CONTROL_CHANGE, 7, 100));
+    rep.handleMessage(makeMsg(MIDI_CONTROL_CHANGE, 7, 100));
+    CHECK(sender.sent.size() == 1);
+    rep.handleMessage(makeMsg(MIDI_CONTROL_CHANGE, 7, 101));
+    CHECK(sender.sent.size() == 2);
+    rep.handleMessage(makeMsg(MIDI_NOTE_ON, 60, 100));
+    CHECK(sender.sent.size() == 2);
+    for(i = 0; i < 40; i ++) {
+        rep.taskTimer();
+    }
+    rep.handleMessage(makeMsg(MIDI_CONTROL_CHANGE, 7, 101));
+    CHECK(sender.sent.size() == 3);
+
+    // on - everything is passed through
+    sender.sent.clear();
+    rep.reset();
+    rep.setMode(MidiRepeater::MODE_ON);
+    rep.handleMessage(makeMsg(MIDI_CONTROL_CHANGE, 7, 100));
+    rep.handleMessage(makeMsg(MIDI_CONTROL_CHANGE, 7, 100));
+    CHECK(sender.sent.size() == 2);
+
+    // gen - the last value is repeated every send interval
+    sender.sent.clear();
+    rep.reset();
+    rep.setMode(MidiRepeater::MODE_GEN);
+    rep.handleMessage(makeMsg(MIDI_CONTROL_CHANGE | 2, 7, 99));
+    CHECK(sender.sent.size() == 1);
+    for(i = 0; i < 49; i ++) {
+        rep.taskTimer();
+    }
+    CHECK(sender.sent.size() == 1);
+    for(i = 0; i < 11; i ++) {
+        rep.taskTimer();
+    }
+    CHECK(sender.sent.size() == 2);
+    CHECK(sender.sent[1].bytes[0] == (MIDI_CONTROL_CHANGE | 2) &&
+        sender.sent[1].bytes[1] == 7 && sender.sent[1].bytes[2] == 99);
+
+    // gen with every controller live - repeats are spread out
+    sender.sent.clear();
+    rep.reset();
+    rep.setMode(MidiRepeater::MODE_GEN);
+    rep.setSendInterval(1000);
+    rep.setCheckInterval(100);
+    for(i = 0; i < 2048; i ++) {
+        rep.handleMessage(makeMsg(MIDI_CONTROL_CHANGE | (i >> 7), i & 0x7f, 1));
+    }
+    sender.sent.clear();
+    maxSends = 0;
+    for(i = 0; i < 2000; i ++) {
+        numSent = sender.sent.size();
+        rep.taskTimer();
+        if((int)sender.sent.size() - numSent > maxSends) {
+            maxSends = sender.sent.size() - numSent;
+        }
+    }
+    CHECK(maxSends <= REPEAT_MAX_SENDS);
+    CHECK(sender.sent.size() >= 2048);
+
+    // task cost with every controller live
+    rep.registerSender(NULL, 0);
+    const int runs = 200000;
+    double start = nowNs();
+    for(i = 0; i < runs; i ++) {
+        rep.taskTimer();
+    }
+    printf("  taskTimer with 2048 live: %.1f ns per run\n", (nowNs() - start) / (double)runs);
+}
+
+//
+// MidiNoteMem
+//
+static void testMidiNoteMem(void) {
+    MidiNoteMem mem;
+    midi::Message msg;
+    int count;
+
+    printf("MidiNoteMem\n");
+    mem.addNote(makeMsg(MIDI_NOTE_ON, 60, 100));
+    mem.addNote(makeMsg(MIDI_NOTE_ON, 60, 90));
+    mem.addNote(makeMsg(MIDI_NOTE_ON | 15, 127, 1));
+    mem.addNote(makeMsg(MIDI_NOTE_ON | 3, 0, 50));
+    mem.addNote(makeMsg(MIDI_CONTROL_CHANGE, 61, 50));
+    CHECK(mem.getNumNotes() == 3);
+    CHECK(mem.getVelocity(0, 60) == 90);
+    CHECK(mem.getVelocity(15, 127) == 1);
+    CHECK(mem.getVelocity(0, 61) == 0);
+    CHECK(mem.getVelocity(16, 60) == 0);
+    // note on with 0 velocity is a note off
+    mem.addNote(makeMsg(MIDI_NOTE_ON, 60, 0));
+    mem.addNote(makeMsg(MIDI_NOTE_OFF, 60, 0));
+    CHECK(mem.getNumNotes() == 2);
+    CHECK(mem.getVelocity(0, 60) == 0);
+    // every remaining note is turned off once
+    count = 0;
+    while(mem.popNoteOff(&msg)) {
+        CHECK((msg.bytes[0] & 0xf0) == MIDI_NOTE_OFF);
+        CHECK(msg.bytes[0] == (MIDI_NOTE_OFF | 3) || msg.bytes[0] == (MIDI_NOTE_OFF | 15));
+        count ++;
+    }
+    CHECK(count == 2);
+    CHECK(mem.getNumNotes() == 0);
+}
+
+//
+// MidiSysexAssembler
+//
+static void testMidiSysex(void) {
+    MidiSysexAssembler sysex;
+    midi::Message msg, out;
+    int i;
+
+    printf("MidiSysexAssembler\n");
+    // dump in chunks with a clock in the middle
+    msg.setSize(3);
+    msg.bytes[0] = MIDI_SYSEX_START;
+    msg.bytes[1] = 0x41;
+    msg.bytes[2] = 0x10;
+    CHECK(sysex.handleMessage(msg) == 1);
+    CHECK(sysex.isActive());
+    CHECK(sysex.handleMessage(makeMsg1(MIDI_TIMING_TICK)) == 0);
+    msg.bytes[0] = 0x01;
+    msg.bytes[1] = 0x02;
+    msg.bytes[2] = 0x03;
+    CHECK(sysex.handleMessage(msg) == 1);
+    msg.setSize(2);
+    msg.bytes[0] = 0x04;
+    msg.bytes[1] = MIDI_SYSEX_END;
+    CHECK(sysex.handleMessage(msg) == 2);
+    CHECK(!sysex.isActive());
+    CHECK(sysex.getLen() == 8);
+    const uint8_t expect[8] = {MIDI_SYSEX_START, 0x41, 0x10, 0x01, 0x02, 0x03, 0x04, MIDI_SYSEX_END};
+    CHECK(sysex.getData() != NULL && memcmp(sysex.getData(), expect, 8) == 0);
+    CHECK(sysex.copyToMessage(&out) == 0 && out.getSize() == 8 &&
+        memcmp(out.bytes.data(), expect, 8) == 0);
+    sysex.reset();
+    CHECK(sysex.getData() == NULL);
+    CHECK(sysex.copyToMessage(&out) == -1);
+    // a status byte in the middle of a dump drops it
+    msg.setSize(1);
+    msg.bytes[0] = MIDI_SYSEX_START;
+    sysex.handleMessage(msg);
+    CHECK(sysex.handleMessage(makeMsg(MIDI_NOTE_ON, 60, 100)) == 0);
+    CHECK(!sysex.isActive());
+    CHECK(sysex.getDropCount() == 1);
+    // data with no dump in progress is consumed
+    msg.bytes[0] = 0x10;
+    CHECK(sysex.handleMessage(msg) == 1);
+    // a dump that is too long is dropped
+    msg.bytes[0] = MIDI_SYSEX_START;
+    sysex.handleMessage(msg);
+    msg.bytes[0] = 0x10;
+    for(i = 0; i < MidiSysexPool::BUF_LEN; i ++) {
+        sysex.handleMessage(msg);
+    }
+    CHECK(!sysex.isActive());
+    CHECK(sysex.getDropCount() == 2);
+
+    // the pool counts a drop when all buffers are in use
+    MidiSysexPool pool(2);
+    uint8_t *a = pool.acquire();
+    uint8_t *b = pool.acquire();
+    CHECK(a != NULL && b != NULL && a != b);
+    CHECK(pool.acquire() == NULL);
+    CHECK(pool.getDropCount() == 1);
+    pool.release(a);
+    CHECK(pool.acquire() == a);
+}
+
+//
+// Midi2Note
+//
+// get the note a voice is playing from its pitch
+template <int VOICES>
+static int voiceNote(Midi2Note<VOICES>& m2n, int voice) {
+    return (int)lrintf((m2n.getPitchVoltage(voice) + 5.0f) * 12.0f);
+}
+
+// check if a voice gate is on
+template <int VOICES>
+static int voiceGate(Midi2Note<VOICES>& m2n, int voice) {
+    return m2n.getGateVoltage(voice) > 5.0f;
+}
+
+template <int VOICES>
+static void noteOn(Midi2Note<VOICES>& m2n, int note) {
+    m2n.handleMessage(makeMsg(MIDI_NOTE_ON, note, 100));
+}
+
+template <int VOICES>
+static void noteOff(Midi2Note<VOICES>& m2n, int note) {
+    m2n.handleMessage(makeMsg(MIDI_NOTE_OFF, note, 0));
+}
+
+// set up for a test - setting the mode resets the channel
+template <int VOICES>
+static void setup(Midi2Note<VOICES>& m2n, int poly, int allocMode) {
+    m2n.setAllocMode(allocMode);
+    m2n.setPolyMode(poly);
+    m2n.setChannel(0);
+}
+
+static void testMidi2Note(void) {
+    Midi2Note<3> m2n;
+    Midi2Note<16> m2n16;
+    int i, ok;
+
+    printf("Midi2Note\n");
+    // mono - last note priority
+    setup(m2n, 0, Midi2Note<3>::ALLOC_LOWEST_FREE);
+    noteOn(m2n, 60);
+    noteOn(m2n, 64);
+    noteOn(m2n, 67);
+    CHECK(voiceNote(m2n, 0) == 67 && voiceGate(m2n, 0));
+    CHECK(!voiceGate(m2n, 1));
+    noteOff(m2n, 64);
+    CHECK(voiceNote(m2n, 0) == 67);
+    noteOff(m2n, 67);
+    CHECK(voiceNote(m2n, 0) == 60 && voiceGate(m2n, 0));
+    noteOff(m2n, 60);
+    CHECK(!voiceGate(m2n, 0));
+    // other channels and notes out of range are ignored
+    m2n.handleMessage(makeMsg(MIDI_NOTE_ON | 1, 60, 100));
+    noteOn(m2n, NOTE_MIN - 1);
+    CHECK(!voiceGate(m2n, 0));
+
+    // lowest free - notes are dropped when all voices are busy
+    setup(m2n, 1, Midi2Note<3>::ALLOC_LOWEST_FREE);
+    noteOn(m2n, 60);
+    noteOn(m2n, 62);
+    noteOn(m2n, 64);
+    noteOn(m2n, 65);
+    CHECK(voiceNote(m2n, 0) == 60 && voiceNote(m2n, 1) == 62 && voiceNote(m2n, 2) == 64);
+    noteOff(m2n, 62);
+    CHECK(voiceGate(m2n, 0) && !voiceGate(m2n, 1) && voiceGate(m2n, 2));
+    noteOn(m2n, 67);
+    CHECK(voiceNote(m2n, 1) == 67 && voiceGate(m2n, 1));
+
+    // round robin - the next free voice after the last one used
+    setup(m2n, 1, Midi2Note<3>::ALLOC_ROUND_ROBIN);
+    noteOn(m2n, 60);
+    noteOn(m2n, 62);
+    noteOff(m2n, 60);
+    noteOn(m2n, 64);
+    CHECK(voiceNote(m2n, 2) == 64 && voiceGate(m2n, 2));
+    CHECK(!voiceGate(m2n, 0));
+    noteOn(m2n, 65);
+    CHECK(voiceNote(m2n, 0) == 65 && voiceGate(m2n, 0));
+    noteOn(m2n, 67);  // all busy - dropped
+    CHECK(voiceNote(m2n, 0) == 65 && voiceNote(m2n, 1) == 62 && voiceNote(m2n, 2) == 64);
+
+    // steal oldest - a stolen voice is not turned off by the old note
+    setup(m2n, 1, Midi2Note<3>::ALLOC_STEAL_OLDEST);
+    noteOn(m2n, 60);
+    noteOn(m2n, 62);
+    noteOn(m2n, 64);
+    noteOn(m2n, 65);
+    CHECK(voiceNote(m2n, 0) == 65 && voiceNote(m2n, 1) == 62 && voiceNote(m2n, 2) == 64);
+    noteOff(m2n, 60);
+    CHECK(voiceGate(m2n, 0));
+    noteOn(m2n, 67);
+    CHECK(voiceNote(m2n, 1) == 67);
+    noteOff(m2n, 64);
+    noteOn(m2n, 69);  // a free voice is used before stealing
+    CHECK(voiceNote(m2n, 2) == 69 && voiceNote(m2n, 0) == 65 && voiceNote(m2n, 1) == 67);
+
+    // unison - every voice follows the mono stack
+    setup(m2n, 1, Midi2Note<3>::ALLOC_UNISON);
+    noteOn(m2n, 60);
+    noteOn(m2n, 64);
+    for(i = 0; i < 3; i ++) {
+        CHECK(voiceNote(m2n, i) == 64 && voiceGate(m2n, i));
+    }
+    noteOff(m2n, 64);
+    for(i = 0; i < 3; i ++) {
+        CHECK(voiceNote(m2n, i) == 60 && voiceGate(m2n, i));
+    }
+    noteOff(m2n, 60);
+    CHECK(!voiceGate(m2n, 0) && !voiceGate(m2n, 2));
+
+    // damper holds released voices - a sustained voice can be reused
+    setup(m2n, 1, Midi2Note<3>::ALLOC_LOWEST_FREE);
+    m2n.handleMessage(makeMsg(MIDI_CONTROL_CHANGE, MIDI_CONTROLLER_DAMPER_PEDAL, 127));
+    noteOn(m2n, 60);
+    noteOn(m2n, 62);
+    noteOff(m2n, 60);
+    CHECK(voiceGate(m2n, 0) && voiceGate(m2n, 1));
+    noteOn(m2n, 64);
+    CHECK(voiceNote(m2n, 0) == 64);
+    noteOff(m2n, 62);
+    m2n.handleMessage(makeMsg(MIDI_CONTROL_CHANGE, MIDI_CONTROLLER_DAMPER_PEDAL, 0));
+    CHECK(voiceGate(m2n, 0) && !voiceGate(m2n, 1));
+
+    // changing the mode keeps the channel
+    m2n.setAllocMode(Midi2Note<3>::ALLOC_ROUND_ROBIN);
+    CHECK(m2n.getChannel() == 0);
+
+    // full poly - steal the oldest of 16
+    setup(m2n16, 1, Midi2Note<16>::ALLOC_STEAL_OLDEST);
+    for(i = 0; i < 16; i ++) {
+        noteOn(m2n16, 40 + i);
+    }
+    ok = 1;
+    for(i = 0; i < 16; i ++) {
+        if(voiceNote(m2n16, i) != 40 + i || !voiceGate(m2n16, i)) {
+            ok = 0;
+        }
+    }
+    CHECK(ok);
+    noteOn(m2n16, 80);
+    noteOn(m2n16, 81);
+    CHECK(voiceNote(m2n16, 0) == 80 && voiceNote(m2n16, 1) == 81);
+    noteOff(m2n16, 40);
+    CHECK(voiceGate(m2n16, 0));
+    // the same note on two voices is released from both
+    setup(m2n16, 1, Midi2Note<16>::ALLOC_LOWEST_FREE);
+    noteOn(m2n16, 60);
+    noteOn(m2n16, 60);
+    CHECK(voiceNote(m2n16, 0) == 60 && voiceNote(m2n16, 1) == 60);
+    noteOff(m2n16, 60);
+    CHECK(!voiceGate(m2n16, 0) && !voiceGate(m2n16, 1));
+}
+
+int main(int argc, char **argv) {
+    testSpscQueue();
+    testMidiCoalesce();
+    testMidiCCMem();
+    testMidiRepeater();
+    testMidiNoteMem();
+    testMidiSysex();
+    testMidi2Note();
+    printf("%d checks - %d failed\n", testCount, failCount);
+    return failCount ? 1 : 0;
+}
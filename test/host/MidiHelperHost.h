@@ -0,0 +1,70 @@
+/*
+ * Host Stand-In for MidiHelper
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Kilpatrick Audio
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ * The real MidiHelper pulls in the Rack MIDI drivers and UI. The tests
+ * force include this instead with MIDI_HELPER_H defined so only the
+ * message decoders the utilities use are built. Keep these in step with
+ * src/utils/MidiHelper.cpp.
+ *
+ */
+#ifndef MIDI_HELPER_HOST_H
+#define MIDI_HELPER_HOST_H
+
+#include "../../src/plugin.hpp"
+#include "../../src/utils/MidiProtocol.h"
+
+class MidiHelper {
+public:
+    // check if the message is a control change message
+    static int isControlChangeMessage(const midi::Message& msg) {
+        if(msg.getSize() < 3) {
+            return 0;
+        }
+        if((msg.bytes[0] & 0xf0) == MIDI_CONTROL_CHANGE) {
+            return 1;
+        }
+        return 0;
+    }
+
+    // check if the message is a channel message
+    static int isChannelMessage(const midi::Message& msg) {
+        if(msg.getSize() < 2) {
+            return 0;
+        }
+        // SYSEX data chunks start with a data byte
+        if((msg.bytes[0] & 0x80) && (msg.bytes[0] & 0xf0) < 0xf0) {
+            return 1;
+        }
+        return 0;
+    }
+
+    // get the channel of a channel message
+    static int getChannelMsgChannel(const midi::Message& msg) {
+        if(msg.getSize() < 2) {
+            return 0;
+        }
+        if(msg.bytes[0] >= 0xf0) {
+            return -1;
+        }
+        return msg.bytes[0] & 0x0f;
+    }
+
+    // get the pitch bend value
+    // returns the value or -1 if the message is not a pitch bend
+    static int getPitchBendVal(const midi::Message& msg) {
+        if(msg.getSize() < 3) {
+            return 0;
+        }
+        if((msg.bytes[0] & 0xf0) != MIDI_PITCH_BEND) {
+            return -1;
+        }
+        return (msg.bytes[1] | msg.bytes[2] << 7) - 8192;
+    }
+};
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * Host Stand-In for the Rack API
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2022: Kilpatrick Audio
+ *
+ * Please see the license file included with this repo for license details.
+ *
+ * Only what the MIDI utilities under test use - lets them build on the
+ * host without the Rack SDK. Not part of the plugin build.
+ *
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+struct NVGcolor;
+
+namespace rack {
+
+struct Plugin;
+struct Model;
+
+namespace midi {
+
+// same layout and accessors as rack::midi::Message
+struct Message {
+    std::vector<uint8_t> bytes;
+    int64_t frame = -1;
+
+    Message() : bytes(3, 0) {}
+
+    int getSize() const {
+        return bytes.size();
+    }
+
+    void setSize(int size) {
+        bytes.resize(size);
+    }
+};
+
+}  // namespace midi
+
+}  // namespace rack